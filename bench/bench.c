@@ -0,0 +1,886 @@
+/* SGGC - A LIBRARY SUPPORTING SEGMENTED GENERATIONAL GARBAGE COLLECTION.
+          Benchmark program for allocation, write barrier, and collection
+
+   The SGGC library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+
+/* This program times operations of the SGGC library.  The benchmarks
+   (named as in the output) are:
+
+       alloc           allocation with sggc_alloc, sggc_alloc_small_kind,
+                       sggc_alloc_small_kind_quickly, and a function
+                       defined with SGGC_DEFINE_ALLOC_KIND_QUICKLY
+       barrier         sggc_old_to_new_check, for various generations of
+                       the objects involved
+       collect_list,   garbage collections at each level, for heaps
+       collect_tree,   shaped as a list, a tree, a wide vector, and a
+       collect_wide,   vector of pairs pointing to random elements
+       collect_random
+       collect_in_use  collections that call functions for objects or
+                       segments in use
+       churn           allocation with scattered free space, including
+                       the time for collections
+       ingest          bringing a large vector in from a file, by reading
+                       it or with sggc_alloc_mapped (if SGGC_MAPPED)
+       adopt           making vectors from buffers, by copying them or
+                       with sggc_alloc_external (if SGGC_EXTERNAL)
+
+   Results are written to standard output in CSV form, one line per
+   measurement, with fields as follows:
+
+       variant     build variant, from the program name ("base" for
+                   "bench", otherwise the part after "bench-")
+       benchmark   what is being measured
+       case        particular case of what is being measured
+       ops         number of operations timed in each repetition
+       median_ns   median over repetitions of nanoseconds per operation
+       min_ns      minimum over repetitions of nanoseconds per operation
+       max_ns      maximum over repetitions of nanoseconds per operation
+
+   For garbage collections, an operation is a single collection, and
+   each collection is a repetition, so that max_ns is the longest pause.
+
+   The program is run with an optional "-n" argument to suppress the
+   header line, followed by an optional scale factor (default 1) that
+   multiplies the sizes of the heaps used. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sggc-app.h"
+
+
+/* SIZES OF BENCHMARKS. */
+
+#define MAX_SEGMENTS 100000  /* Maximum segments, if not fixed at compile time*/
+
+#define REPS 5               /* Repetitions for allocation and barrier tests */
+#define ALLOC_OPS 100000     /* Objects allocated in one repetition */
+#define BIG_ALLOC_OPS 10000  /* Big objects allocated in one repetition */
+#define BARRIER_OBJS 10000   /* Number of objects for barrier tests */
+#define BARRIER_PASSES 20    /* Passes over objects for repeated barriers */
+#define HEAP_OBJS 100000     /* Approximate objects in heaps (times scale) */
+#define GARBAGE_OBJS 1000    /* Garbage allocated before each collection */
+#define COLLECTIONS 20       /* Collections timed for each heap and level */
+#define CHURN_OPS 1000000    /* Pairs allocated in one repetition of churn */
+#define CHURN_KEEP 8         /* One in this many new pairs is kept in churn */
+#define CHURN_GC 10000       /* Allocations between collections in churn */
+
+
+/* TYPES FOR THIS APPLICATION.  Type 0 is a pair of pointers, type 1 is a
+   vector of pointers. */
+
+#define TYPE_PAIR 0
+#define TYPE_VEC 1
+
+struct pair { sggc_cptr_t car, cdr; };
+struct vec { sggc_length_t len; sggc_cptr_t elt[]; };
+
+#define PAIR(v) ((struct pair *) SGGC_DATA(v))
+#define VEC(v) ((struct vec *) SGGC_DATA(v))
+
+
+/* ROOTS FOR THE GARBAGE COLLECTOR. */
+
+#define N_ROOTS 4
+
+static sggc_cptr_t roots[N_ROOTS];
+
+
+/* FUNCTIONS THAT THE APPLICATION NEEDS TO PROVIDE TO THE SGGC MODULE. */
+
+sggc_kind_t sggc_kind (sggc_type_t type, sggc_length_t length)
+{
+  return type == TYPE_PAIR ? 0 : length <= 3 ? 1 : length <= 7 ? 2 : 3;
+}
+
+sggc_nchunks_t sggc_nchunks (sggc_type_t type, sggc_length_t length)
+{
+  return type == TYPE_PAIR ? 1
+          : (sizeof (struct vec) + length * sizeof (sggc_cptr_t)
+              + SGGC_CHUNK_SIZE - 1) / SGGC_CHUNK_SIZE;
+}
+
+void sggc_find_root_ptrs (void)
+{
+  int i;
+  for (i = 0; i < N_ROOTS; i++)
+  { sggc_look_at (roots[i]);
+  }
+}
+
+#ifdef SGGC_FIND_OBJECT_MULTI
+int sggc_find_object_ptrs (sggc_cptr_t v, sggc_cptr_t *ptrs)
+{
+  if (SGGC_TYPE(v) == TYPE_PAIR)
+  { ptrs[0] = PAIR(v)->car;
+    ptrs[1] = PAIR(v)->cdr;
+    return 2;
+  }
+  else
+  { sggc_length_t i, n;
+    n = VEC(v)->len < SGGC_FIND_OBJECT_MULTI ? VEC(v)->len 
+                                             : SGGC_FIND_OBJECT_MULTI;
+    for (i = n; i < VEC(v)->len; i++)
+    { sggc_look_at (VEC(v)->elt[i]);
+    }
+    for (i = 0; i < n; i++)
+    { ptrs[i] = VEC(v)->elt[i];
+    }
+    return n;
+  }
+}
+#elif defined(SGGC_FIND_OBJECT_RETURN)
+sggc_cptr_t sggc_find_object_ptrs (sggc_cptr_t v)
+{
+  if (SGGC_TYPE(v) == TYPE_PAIR)
+  { sggc_look_at (PAIR(v)->car);
+    return PAIR(v)->cdr;
+  }
+  else
+  { sggc_length_t i;
+    for (i = 0; i < VEC(v)->len; i++)
+    { sggc_look_at (VEC(v)->elt[i]);
+    }
+    return SGGC_NO_OBJECT;
+  }
+}
+#else
+void sggc_find_object_ptrs (sggc_cptr_t v)
+{
+  if (SGGC_TYPE(v) == TYPE_PAIR)
+  { sggc_look_at (PAIR(v)->car);
+    sggc_look_at (PAIR(v)->cdr);
+  }
+  else
+  { sggc_length_t i;
+    for (i = 0; i < VEC(v)->len; i++)
+    { sggc_look_at (VEC(v)->elt[i]);
+    }
+  }
+}
+#endif
+
+
+/* ALLOCATION FUNCTIONS FOR THIS APPLICATION.  No garbage collection is
+   done here, so new objects needn't be protected while allocating.
+   Allocation failure is a fatal error. */
+
+static sggc_cptr_t check_alloc (sggc_cptr_t v)
+{
+  if (v == SGGC_NO_OBJECT)
+  { fprintf (stderr, "bench: out of space for objects\n");
+    exit(1);
+  }
+  return v;
+}
+
+static sggc_cptr_t alloc_pair (sggc_cptr_t car, sggc_cptr_t cdr)
+{
+  sggc_cptr_t v = check_alloc (sggc_alloc (TYPE_PAIR, 0));
+  PAIR(v)->car = car;
+  PAIR(v)->cdr = cdr;
+  return v;
+}
+
+static sggc_cptr_t alloc_vec (sggc_length_t len)
+{
+  sggc_cptr_t v = check_alloc (sggc_alloc (TYPE_VEC, len));
+  sggc_length_t i;
+  VEC(v)->len = len;
+  for (i = 0; i < len; i++)
+  { VEC(v)->elt[i] = SGGC_NO_OBJECT;
+  }
+  return v;
+}
+
+
+/* STORE INTO AN OBJECT, USING THE WRITE BARRIER. */
+
+static inline void set_car (sggc_cptr_t p, sggc_cptr_t v)
+{
+  PAIR(p)->car = v;
+  sggc_old_to_new_check (p, v);
+}
+
+static inline void set_elt (sggc_cptr_t p, sggc_length_t i, sggc_cptr_t v)
+{
+  VEC(p)->elt[i] = v;
+  sggc_old_to_new_check (p, v);
+}
+
+
+/* TIMING AND REPORTING. */
+
+static const char *variant;   /* Name of build variant, for output */
+
+static double sink;           /* Used to keep results from being ignored */
+
+static double now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double (const void *a, const void *b)
+{
+  double x = * (const double *) a, y = * (const double *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Write a line of results, given nanoseconds per operation for n
+   repetitions in t (which is sorted here). */
+
+static void report (const char *benchmark, const char *cse, long ops,
+                    double *t, int n)
+{
+  qsort (t, n, sizeof *t, cmp_double);
+  printf ("%s,%s,%s,%ld,%.1f,%.1f,%.1f\n", variant, benchmark, cse, ops,
+          n % 2 ? t[n/2] : (t[n/2-1] + t[n/2]) / 2, t[0], t[n-1]);
+  fflush (stdout);
+}
+
+
+/* ALLOCATION BENCHMARKS.  A level 2 collection is done (untimed) before
+   each repetition, so the objects allocated in the previous repetition
+   (which are not referenced) are freed. */
+
+enum { ALLOC_PAIR, ALLOC_SMALL_KIND, ALLOC_SMALL_KIND_QUICKLY,
+       ALLOC_KIND_0_QUICKLY, ALLOC_SMALL_VEC, ALLOC_BIG_VEC };
+
+SGGC_DEFINE_ALLOC_KIND_QUICKLY(0)  /* defines sggc_alloc_kind_0_quickly */
+
+static void bench_alloc (int method, const char *cse)
+{
+  double t[REPS];
+  sggc_cptr_t v, x;
+  long ops;
+  int r, i;
+
+  ops = method == ALLOC_BIG_VEC ? BIG_ALLOC_OPS : ALLOC_OPS;
+  x = 0;
+
+  for (r = 0; r < REPS; r++)
+  {
+    sggc_collect(2);
+
+    double start = now_ns();
+
+    switch (method)
+    { case ALLOC_PAIR:
+        for (i = 0; i < ops; i++)
+        { v = check_alloc (sggc_alloc (TYPE_PAIR, 0));
+          x ^= v;
+        }
+        break;
+      case ALLOC_SMALL_KIND:
+        for (i = 0; i < ops; i++)
+        { v = check_alloc (sggc_alloc_small_kind (0));
+          x ^= v;
+        }
+        break;
+      case ALLOC_SMALL_KIND_QUICKLY:
+        for (i = 0; i < ops; i++)
+        { v = sggc_alloc_small_kind_quickly (0);
+          if (v == SGGC_NO_OBJECT)
+          { v = check_alloc (sggc_alloc_small_kind (0));
+          }
+          x ^= v;
+        }
+        break;
+      case ALLOC_KIND_0_QUICKLY:
+        for (i = 0; i < ops; i++)
+        { v = sggc_alloc_kind_0_quickly ();
+          if (v == SGGC_NO_OBJECT)
+          { v = check_alloc (sggc_alloc_small_kind (0));
+          }
+          x ^= v;
+        }
+        break;
+      case ALLOC_SMALL_VEC:
+        for (i = 0; i < ops; i++)
+        { v = check_alloc (sggc_alloc (TYPE_VEC, 5));
+          VEC(v)->len = 0;
+          x ^= v;
+        }
+        break;
+      case ALLOC_BIG_VEC:
+        for (i = 0; i < ops; i++)
+        { v = check_alloc (sggc_alloc (TYPE_VEC, 100));
+          VEC(v)->len = 0;
+          x ^= v;
+        }
+        break;
+    }
+
+    t[r] = (now_ns() - start) / ops;
+  }
+
+  sink += x;
+  report ("alloc", cse, ops, t, REPS);
+}
+
+
+/* WRITE BARRIER BENCHMARKS.  Stores a pointer in an object and then calls
+   sggc_old_to_new_check, for references from young to young, old to young,
+   and old to old objects.  For old to young references, the first store
+   (which puts the object in the old-to-new set) is timed separately
+   from later stores (when the object is already in the set).  The
+   setup and the collections done to make objects old are not timed. */
+
+static void bench_barrier (void)
+{
+  double t_yy[REPS], t_oy_first[REPS], t_oy[REPS], t_oo[REPS];
+  static sggc_cptr_t young[BARRIER_OBJS];
+  sggc_cptr_t old;
+  double start;
+  int r, i, p;
+
+  for (r = 0; r < REPS; r++)
+  {
+    /* Create old objects, referenced from a vector in roots[0]. */
+
+    roots[0] = alloc_vec (BARRIER_OBJS);
+    for (i = 0; i < BARRIER_OBJS; i++)
+    { set_elt (roots[0], i, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+    }
+    sggc_collect(2);
+    sggc_collect(2);
+    old = roots[0];
+
+    /* Create young objects, which are not referenced from a root, but
+       which are not collected since no collection is done while in use. */
+
+    for (i = 0; i < BARRIER_OBJS; i++)
+    { young[i] = alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT);
+    }
+
+    /* Young to young. */
+
+    start = now_ns();
+    for (p = 0; p < BARRIER_PASSES; p++)
+    { for (i = 0; i < BARRIER_OBJS; i++)
+      { set_car (young[i], young[BARRIER_OBJS-1-i]);
+      }
+    }
+    t_yy[r] = (now_ns() - start) / ((double) BARRIER_OBJS * BARRIER_PASSES);
+
+    /* Old to old. */
+
+    start = now_ns();
+    for (p = 0; p < BARRIER_PASSES; p++)
+    { for (i = 0; i < BARRIER_OBJS; i++)
+      { set_car (VEC(old)->elt[i], VEC(old)->elt[BARRIER_OBJS-1-i]);
+      }
+    }
+    t_oo[r] = (now_ns() - start) / ((double) BARRIER_OBJS * BARRIER_PASSES);
+
+    /* Old to young, first time. */
+
+    start = now_ns();
+    for (i = 0; i < BARRIER_OBJS; i++)
+    { set_car (VEC(old)->elt[i], young[i]);
+    }
+    t_oy_first[r] = (now_ns() - start) / BARRIER_OBJS;
+
+    /* Old to young, when already in old-to-new set. */
+
+    start = now_ns();
+    for (p = 0; p < BARRIER_PASSES; p++)
+    { for (i = 0; i < BARRIER_OBJS; i++)
+      { set_car (VEC(old)->elt[i], young[BARRIER_OBJS-1-i]);
+      }
+    }
+    t_oy[r] = (now_ns() - start) / ((double) BARRIER_OBJS * BARRIER_PASSES);
+
+    roots[0] = SGGC_NO_OBJECT;
+    sggc_collect(2);
+  }
+
+  report ("barrier", "young_to_young",
+          (long) BARRIER_OBJS * BARRIER_PASSES, t_yy, REPS);
+  report ("barrier", "old_to_young_first",
+          (long) BARRIER_OBJS, t_oy_first, REPS);
+  report ("barrier", "old_to_young",
+          (long) BARRIER_OBJS * BARRIER_PASSES, t_oy, REPS);
+  report ("barrier", "old_to_old",
+          (long) BARRIER_OBJS * BARRIER_PASSES, t_oo, REPS);
+}
+
+
+/* FUNCTIONS TO BUILD HEAPS OF VARIOUS SHAPES.  Each returns the object
+   at the top of the structure built, containing about n objects. */
+
+static sggc_cptr_t build_list (long n)
+{
+  sggc_cptr_t l = SGGC_NO_OBJECT;
+  long i;
+
+  for (i = 0; i < n; i++)
+  { l = alloc_pair (SGGC_NO_OBJECT, l);
+  }
+
+  return l;
+}
+
+static sggc_cptr_t build_tree_depth (int d)
+{
+  if (d == 0)
+  { return SGGC_NO_OBJECT;
+  }
+  else
+  { sggc_cptr_t l = build_tree_depth (d-1);
+    sggc_cptr_t r = build_tree_depth (d-1);
+    return alloc_pair (l, r);
+  }
+}
+
+static sggc_cptr_t build_tree (long n)
+{
+  int d = 1;
+
+  while ((2L << d) - 1 <= n)
+  { d += 1;
+  }
+
+  return build_tree_depth (d);
+}
+
+static sggc_cptr_t build_wide (long n)
+{
+  sggc_cptr_t w = alloc_vec (n / 4);
+  long i;
+
+  for (i = 0; i < n / 4; i++)
+  { sggc_cptr_t e = alloc_vec (5);
+    set_elt (e, 0, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+    set_elt (e, 1, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+    set_elt (e, 2, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+    set_elt (w, i, e);
+  }
+
+  return w;
+}
+
+static sggc_cptr_t build_random (long n)
+{
+  sggc_cptr_t g = alloc_vec (n);
+  unsigned long s = 12345;
+  long i;
+
+  for (i = 0; i < n; i++)
+  { set_elt (g, i, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+  }
+
+  for (i = 0; i < n; i++)
+  { sggc_cptr_t p = VEC(g)->elt[i];
+    s = s * 1103515245 + 12345;
+    PAIR(p)->car = VEC(g)->elt[(s >> 8) % n];
+    sggc_old_to_new_check (p, PAIR(p)->car);
+    s = s * 1103515245 + 12345;
+    PAIR(p)->cdr = VEC(g)->elt[(s >> 8) % n];
+    sggc_old_to_new_check (p, PAIR(p)->cdr);
+  }
+
+  return g;
+}
+
+
+/* GARBAGE COLLECTION BENCHMARKS.  A heap of the given shape is built
+   and referenced from roots[0], and then aged to generation 2 with two
+   level 2 collections.  Collections at each level are then timed, with
+   some garbage allocated (untimed) before each. */
+
+static void bench_collect (const char *shape, sggc_cptr_t (*build) (long),
+                           long n)
+{
+  double t[COLLECTIONS];
+  char benchmark[100];
+  int level, c, i;
+
+  roots[0] = build (n);
+  sggc_collect(2);
+  sggc_collect(2);
+
+  sprintf (benchmark, "collect_%s", shape);
+
+  for (level = 0; level <= 2; level++)
+  {
+    char cse[20];
+    sprintf (cse, "level%d", level);
+
+    for (c = 0; c < COLLECTIONS; c++)
+    { for (i = 0; i < GARBAGE_OBJS; i++)
+      { (void) alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT);
+      }
+      double start = now_ns();
+      sggc_collect(level);
+      t[c] = now_ns() - start;
+    }
+
+    report (benchmark, cse, 1, t, COLLECTIONS);
+  }
+
+  roots[0] = SGGC_NO_OBJECT;
+  sggc_collect(2);
+}
+
+
+/* BENCHMARK OF FUNCTIONS CALLED FOR OBJECTS IN USE.  Level 2
+   collections of a tree are timed with no function called for objects
+   in use, with a function called for each object, and with a function
+   called for each segment, all of which total the chunks in use. */
+
+static double chunks_in_use;
+
+static void in_use_object (sggc_cptr_t v, sggc_nchunks_t nch)
+{
+  chunks_in_use += nch;
+}
+
+static void in_use_segment (sggc_cptr_t v, sggc_kind_t k, sbset_bits_t b,
+                            sggc_nchunks_t nch)
+{
+  chunks_in_use += (double) nch * sbset_bit_count(b);
+}
+
+static void bench_in_use (long n)
+{
+  double t[COLLECTIONS];
+  int method, c;
+
+  roots[0] = build_tree (n);
+  sggc_collect(2);
+
+  for (method = 0; method < 3; method++)
+  {
+    sggc_call_for_object_in_use (method == 1 ? in_use_object : 0);
+    sggc_call_for_segment_in_use (method == 2 ? in_use_segment : 0);
+
+    for (c = 0; c < COLLECTIONS; c++)
+    { chunks_in_use = 0;
+      double start = now_ns();
+      sggc_collect(2);
+      t[c] = now_ns() - start;
+      sink += chunks_in_use;
+    }
+
+    report ("collect_in_use", method == 0 ? "none" 
+                            : method == 1 ? "per_object" : "per_segment", 
+            1, t, COLLECTIONS);
+  }
+
+  sggc_call_for_object_in_use (0);
+  sggc_call_for_segment_in_use (0);
+
+  roots[0] = SGGC_NO_OBJECT;
+  sggc_collect(2);
+}
+
+
+/* CHURN BENCHMARK.  A vector of n pairs is referenced from roots[0].
+   Pairs are then allocated, with one in CHURN_KEEP of them replacing a 
+   random element of the vector, so that free space becomes scattered 
+   over many segments.  A collection is done every CHURN_GC allocations,
+   at level 2 for every 20th, level 1 for every 5th, and otherwise level
+   0.  The time per allocation includes the time for collections. */
+
+static void bench_churn (long n)
+{
+  double t[REPS];
+  unsigned long s = 12345;
+  sggc_cptr_t g;
+  long i;
+  int r;
+
+  g = roots[0] = alloc_vec (n);
+  for (i = 0; i < n; i++)
+  { set_elt (g, i, alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT));
+  }
+  sggc_collect(2);
+
+  for (r = 0; r < REPS; r++)
+  {
+    double start = now_ns();
+
+    for (i = 1; i <= CHURN_OPS; i++)
+    { sggc_cptr_t p = alloc_pair (SGGC_NO_OBJECT, SGGC_NO_OBJECT);
+      s = s * 1103515245 + 12345;
+      if ((s >> 8) % CHURN_KEEP == 0)
+      { s = s * 1103515245 + 12345;
+        set_elt (g, (s >> 8) % n, p);
+      }
+      if (i % CHURN_GC == 0)
+      { sggc_collect (i % (20*CHURN_GC) == 0 ? 2 
+                    : i % (5*CHURN_GC) == 0 ? 1 : 0);
+      }
+    }
+
+    t[r] = (now_ns() - start) / CHURN_OPS;
+  }
+
+  report ("churn", "alloc_pair", CHURN_OPS, t, REPS);
+
+  roots[0] = SGGC_NO_OBJECT;
+  sggc_collect(2);
+}
+
+
+/* INGESTION BENCHMARK.  A vector stored in a file is brought into memory
+   either by allocating it and reading it with read, or by mapping it
+   with sggc_alloc_mapped, after which all its elements are read (so
+   pages of the mapping are faulted in).  The vector isn't referenced,
+   so its elements needn't be valid pointers.  A level 2 collection
+   (untimed) frees the previous vector before each repetition. */
+
+#ifdef SGGC_MAPPED
+
+#define INGEST_LEN 1000000   /* Length of vector brought in from file */
+
+static void bench_ingest (void)
+{
+  double t_read[REPS], t_mapped[REPS];
+  size_t size = (size_t) sggc_nchunks (TYPE_VEC, INGEST_LEN) * SGGC_CHUNK_SIZE;
+  struct vec *w;
+  sggc_cptr_t v;
+  double start, s;
+  FILE *f;
+  long i;
+  int r;
+
+  w = calloc (size, 1);
+  f = tmpfile();
+  if (w == NULL || f == NULL)
+  { fprintf (stderr, "bench: can't set up file for ingestion\n");
+    exit(1);
+  }
+  w->len = INGEST_LEN;
+  for (i = 0; i < INGEST_LEN; i++)
+  { w->elt[i] = i;
+  }
+  if (fwrite (w, 1, size, f) != size || fflush (f) != 0)
+  { fprintf (stderr, "bench: can't write file for ingestion\n");
+    exit(1);
+  }
+  free (w);
+
+  for (r = 0; r < REPS; r++)
+  {
+    sggc_collect(2);
+
+    start = now_ns();
+    v = check_alloc (sggc_alloc (TYPE_VEC, INGEST_LEN));
+    if (lseek (fileno(f), 0, SEEK_SET) != 0
+         || read (fileno(f), VEC(v), size) != (ssize_t) size)
+    { fprintf (stderr, "bench: can't read file for ingestion\n");
+      exit(1);
+    }
+    for (s = 0, i = 0; i < VEC(v)->len; i++)
+    { s += VEC(v)->elt[i];
+    }
+    t_read[r] = now_ns() - start;
+    sink += s;
+
+    sggc_collect(2);
+
+    start = now_ns();
+    v = check_alloc (sggc_alloc_mapped (TYPE_VEC, fileno(f), 0, INGEST_LEN,
+                                        SGGC_MAP_PRIVATE | SGGC_MAP_READ_ONLY));
+    for (s = 0, i = 0; i < VEC(v)->len; i++)
+    { s += VEC(v)->elt[i];
+    }
+    t_mapped[r] = now_ns() - start;
+    sink += s;
+  }
+
+  sggc_collect(2);
+  fclose (f);
+
+  report ("ingest", "read", 1, t_read, REPS);
+  report ("ingest", "mapped", 1, t_mapped, REPS);
+}
+
+#endif
+
+
+/* ADOPTION BENCHMARK.  Buffers allocated with malloc (as if produced by
+   some other library) are made into vector objects either by allocating
+   an object, copying the buffer into it, and freeing the buffer, or with
+   sggc_alloc_external, in which case the buffer is freed when the object
+   is collected.  Setting up the buffers is not timed, nor is the level 2 
+   collection that frees the vectors from the previous repetition. */
+
+#ifdef SGGC_EXTERNAL
+
+#define ADOPT_LEN 1000       /* Length of vectors made from buffers */
+#define ADOPT_OPS 1000       /* Buffers adopted in one repetition */
+
+static long released;        /* Number of buffers released by SGGC */
+
+static void release_buffer (void *p, size_t n)
+{
+  free (p);
+  released += 1;
+}
+
+static void make_buffers (struct vec **w, size_t size)
+{
+  long i, j;
+
+  for (i = 0; i < ADOPT_OPS; i++)
+  { w[i] = malloc (size);
+    if (w[i] == NULL)
+    { fprintf (stderr, "bench: can't allocate buffer to adopt\n");
+      exit(1);
+    }
+    w[i]->len = ADOPT_LEN;
+    for (j = 0; j < ADOPT_LEN; j++)
+    { w[i]->elt[j] = SGGC_NO_OBJECT;
+    }
+  }
+}
+
+static void bench_adopt (void)
+{
+  double t_copy[REPS], t_external[REPS];
+  size_t size = (size_t) sggc_nchunks (TYPE_VEC, ADOPT_LEN) * SGGC_CHUNK_SIZE;
+  static struct vec *w[ADOPT_OPS];
+  sggc_cptr_t v, x;
+  double start;
+  long i;
+  int r;
+
+  x = 0;
+  released = 0;
+
+  for (r = 0; r < REPS; r++)
+  {
+    make_buffers (w, size);
+    sggc_collect(2);
+
+    start = now_ns();
+    for (i = 0; i < ADOPT_OPS; i++)
+    { v = check_alloc (sggc_alloc (TYPE_VEC, ADOPT_LEN));
+      memcpy (VEC(v), w[i], size);
+      free (w[i]);
+      x ^= v;
+    }
+    t_copy[r] = (now_ns() - start) / ADOPT_OPS;
+
+    make_buffers (w, size);
+    sggc_collect(2);
+
+    start = now_ns();
+    for (i = 0; i < ADOPT_OPS; i++)
+    { v = check_alloc (sggc_alloc_external (TYPE_VEC, ADOPT_LEN, w[i], size,
+                                            release_buffer));
+      x ^= v;
+    }
+    t_external[r] = (now_ns() - start) / ADOPT_OPS;
+  }
+
+  sggc_collect(2);
+
+  if (released != (long) REPS * ADOPT_OPS)
+  { fprintf (stderr, "bench: %ld buffers released, not %ld\n", 
+             released, (long) REPS * ADOPT_OPS);
+    exit(1);
+  }
+
+  sink += x;
+  report ("adopt", "copy", ADOPT_OPS, t_copy, REPS);
+  report ("adopt", "external", ADOPT_OPS, t_external, REPS);
+}
+
+#endif
+
+
+/* MAIN PROGRAM. */
+
+int main (int argc, char **argv)
+{
+  int header = 1;
+  long scale = 1;
+  int i;
+
+  /* Find variant name from program name. */
+
+  variant = strrchr (argv[0], '/');
+  variant = variant == NULL ? argv[0] : variant + 1;
+  if (strncmp (variant, "bench-", 6) == 0)
+  { variant += 6;
+  }
+  else
+  { variant = "base";
+  }
+
+  if (argc > 1 && strcmp (argv[1], "-n") == 0)
+  { header = 0;
+    argc -= 1;
+    argv += 1;
+  }
+
+  if (argc > 2 || (argc > 1 && (scale = atol(argv[1])) <= 0))
+  { fprintf (stderr, "Usage: bench [ -n ] [ scale ]\n");
+    exit(1);
+  }
+
+  if (header)
+  { printf ("variant,benchmark,case,ops,median_ns,min_ns,max_ns\n");
+  }
+
+  sggc_init (MAX_SEGMENTS);
+
+  for (i = 0; i < N_ROOTS; i++)
+  { roots[i] = SGGC_NO_OBJECT;
+  }
+
+  bench_alloc (ALLOC_PAIR, "sggc_alloc_pair");
+  bench_alloc (ALLOC_SMALL_KIND, "sggc_alloc_small_kind");
+  bench_alloc (ALLOC_SMALL_KIND_QUICKLY, "sggc_alloc_small_kind_quickly");
+  bench_alloc (ALLOC_KIND_0_QUICKLY, "sggc_alloc_kind_0_quickly");
+  bench_alloc (ALLOC_SMALL_VEC, "sggc_alloc_small_vec");
+  bench_alloc (ALLOC_BIG_VEC, "sggc_alloc_big_vec");
+
+  bench_barrier();
+
+  bench_collect ("list", build_list, HEAP_OBJS * scale);
+  bench_collect ("tree", build_tree, HEAP_OBJS * scale);
+  bench_collect ("wide", build_wide, HEAP_OBJS * scale);
+  bench_collect ("random", build_random, HEAP_OBJS * scale);
+
+  bench_in_use (HEAP_OBJS * scale);
+
+  bench_churn (HEAP_OBJS * scale);
+
+# ifdef SGGC_MAPPED
+    bench_ingest();
+# endif
+
+# ifdef SGGC_EXTERNAL
+    bench_adopt();
+# endif
+
+  if (sink == 0.5)  /* never true, but compiler doesn't know that */
+  { printf ("%f\n", sink);
+  }
+
+  return 0;
+}
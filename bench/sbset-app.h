@@ -0,0 +1 @@
+../sbset-app.h
\ No newline at end of file
@@ -0,0 +1,40 @@
+/* SGGC - A LIBRARY SUPPORTING SEGMENTED GENERATIONAL GARBAGE COLLECTION.
+          Benchmark program - sggc application header file
+
+   The SGGC library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+
+#define SGGC_CHUNK_SIZE 16      /* Number of bytes in a data chunk */
+
+#define SGGC_N_TYPES 2          /* Number of object types */
+
+typedef unsigned sggc_length_t; /* Type for holding an object length */
+typedef unsigned sggc_nchunks_t;/* Type for how many chunks are in a segment */
+
+/* Kind 0 is for pairs, kinds 1 and 2 for vectors of length up to 3 and
+   up to 7, and kind 3 for longer vectors (in big segments).  Vectors 
+   need twice as many chunks if compressed pointers are 64 bits. */
+
+#define SGGC_N_KINDS 4
+#ifdef SGGC_CPTR_64
+#define SGGC_KIND_CHUNKS { 1, 2, 4, 0 }
+#else
+#define SGGC_KIND_CHUNKS { 1, 1, 2, 0 }
+#endif
+#define SGGC_KIND_TYPES { 0, 1, 1, 1 }
+
+/* Include the generic SGGC header file. */
+
+#include "sggc.h"
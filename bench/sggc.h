@@ -0,0 +1 @@
+../sggc.h
\ No newline at end of file
@@ -146,8 +146,25 @@ static ptr_t global_bindings;  /* Global bindings of symbols with values */
 static unsigned freed_count;  /* Count of freed objects, if doing that */
 #endif
 
+#if CALL_FINALIZERS
+static unsigned registered_count; /* Count of objects with finalizers */
+static unsigned finalized_count;  /* Count of finalizer calls */
+#endif
+
+
+/* SCHEME FOR PROTECTING POINTERS FROM GARBAGE COLLECTION.  Not needed
+   if SGGC_CONSERVATIVE is defined, since the stack is then scanned for
+   pointers by sggc_look_at_stack. */
+
+#ifdef SGGC_CONSERVATIVE
 
-/* SCHEME FOR PROTECTING POINTERS FROM GARBAGE COLLECTION. */
+#define PROT1(v)
+#define PROT2(v)
+#define PROT3(v)
+#define PROT4(v)
+#define PROT_END ((void) 0)
+
+#else
 
 static struct ptr_var { ptr_t *var; struct ptr_var *next; } *first_ptr_var;
 
@@ -170,6 +187,8 @@ static struct ptr_var { ptr_t *var; struct ptr_var *next; } *first_ptr_var;
 
 #define PROT_END (first_ptr_var = saved_first_ptr_var)
 
+#endif
+
 
 /* FUNCTIONS THAT THE APPLICATION NEEDS TO PROVIDE TO THE SGGC MODULE. 
 
@@ -200,13 +219,34 @@ void sggc_find_root_ptrs (void)
     sggc_look_at (global_bindings);  
 # endif
 
-  struct ptr_var *p;
-  for (p = first_ptr_var; p != NULL; p = p->next)
-  { sggc_look_at (*p->var);
-  }
+# ifdef SGGC_CONSERVATIVE
+    sggc_look_at_stack();
+# else
+    struct ptr_var *p;
+    for (p = first_ptr_var; p != NULL; p = p->next)
+    { sggc_look_at (*p->var);
+    }
+# endif
 }
 
-#ifdef SGGC_FIND_OBJECT_RETURN
+#ifdef SGGC_FIND_OBJECT_MULTI
+int sggc_find_object_ptrs (sggc_cptr_t cptr, sggc_cptr_t *ptrs)
+{
+  if (SGGC_TYPE(cptr) == TYPE_LIST)
+  { ptrs[0] = LIST(cptr)->head;
+    ptrs[1] = LIST(cptr)->tail;
+    return 2;
+  }
+
+  else if (SGGC_TYPE(cptr) == TYPE_BINDING)
+  { ptrs[0] = BINDING(cptr)->value;
+    ptrs[1] = BINDING(cptr)->next;
+    return 2;
+  }
+
+  return 0;
+}
+#elif defined(SGGC_FIND_OBJECT_RETURN)
 sggc_cptr_t sggc_find_object_ptrs (sggc_cptr_t cptr)
 {
   if (SGGC_TYPE(cptr) == TYPE_LIST)
@@ -242,6 +282,13 @@ void sggc_find_object_ptrs (sggc_cptr_t cptr)
 
 static unsigned alloc_count = 1;  /* 1 for allocation of nil at init */
 
+#if USE_ALLOC_KIND_QUICKLY_CONST
+# if sggc_kind(TYPE_LIST,1) != 1   /* kind is a literal in the name below */
+#   error "sggc_alloc_kind_1_quickly is used for lists, but their kind isn't 1"
+# endif
+SGGC_DEFINE_ALLOC_KIND_QUICKLY(1)  /* defines sggc_alloc_kind_1_quickly */
+#endif
+
 static ptr_t alloc (sggc_type_t type)
 {
   sggc_cptr_t a;
@@ -262,7 +309,13 @@ static ptr_t alloc (sggc_type_t type)
   /* Try to allocate object, calling garbage collector if this initially
      fails. */
 
-# if USE_ALLOC_SMALL_KIND_QUICKLY
+# if USE_ALLOC_KIND_QUICKLY_CONST
+    a = type == TYPE_LIST ? sggc_alloc_kind_1_quickly()  /* checked above */
+                          : sggc_alloc_small_kind_quickly(type);
+    if (a == SGGC_NO_OBJECT)
+    { a = sggc_alloc_small_kind(type);
+    }
+# elif USE_ALLOC_SMALL_KIND_QUICKLY
     a = sggc_alloc_small_kind_quickly(type);  /* kind always same as type */
     if (a == SGGC_NO_OBJECT)
     { a = sggc_alloc_small_kind(type);
@@ -295,6 +348,15 @@ static ptr_t alloc (sggc_type_t type)
     BINDING(a)->next = nil;
   }
 
+  /* Register a finalizer for some objects, if doing that. */
+
+# if CALL_FINALIZERS
+    if (alloc_count % 7 == 0)
+    { sggc_register_finalizer (a);
+      registered_count += 1;
+    }
+# endif
+
   return a;
 }
 
@@ -675,12 +737,126 @@ int freed_fun (sggc_cptr_t cptr)
 #endif
 
 
+/* FUNCTION CALLED WHEN OBJECT WITH FINALIZER IS FREED, IF ENABLED. */
+
+#if CALL_FINALIZERS
+
+int finalizer_fun (sggc_cptr_t cptr)
+{
+  finalized_count += 1;
+  return 0;
+}
+
+#endif
+
+
+/* SET UP SYMBOLS AS CONSTANTS SHARED WITH OTHER PROCESSES.  The symbols
+   are put in a constant segment read from the file, if it exists, and
+   otherwise the segment is created and written to the file.  (This
+   can't be combined with IMAGE, since the constant segment is created
+   after nil.) */
+
+#ifdef SHARED_CONSTANTS
+
+static void constant_symbols (void)
+{
+  static char data[SGGC_CHUNKS_IN_SMALL_SEGMENT * SGGC_CHUNK_SIZE];
+  int n = sizeof symbol_chars - 1;
+  sggc_cptr_t v;
+  int i;
+
+  v = sggc_load_constants (SHARED_CONSTANTS);
+
+  if (v == SGGC_NO_OBJECT)
+  { for (i = 0; i < n; i++)
+    { data[i*SGGC_CHUNK_SIZE] = symbol_chars[i];
+    }
+    v = sggc_constant (TYPE_SYMBOL, TYPE_SYMBOL, n, data, 
+                       sggc_aux1_read_only (TYPE_SYMBOL));
+    if (v == SGGC_NO_OBJECT || sggc_save_constants (SHARED_CONSTANTS) != 0)
+    { printf("CAN'T SET UP CONSTANTS\n");
+      exit(1);
+    }
+  }
+
+  for (i = 0; i < n; i++)
+  { symbols[i] = v + i;
+    if (SYMBOL(symbols[i]) -> symbol != symbol_chars[i]) abort();
+  }
+}
+
+#endif
+
+
+/* SAVE AND LOAD AN IMAGE OF THE INITIAL STATE.  The root of the image is
+   a list whose first element is global_bindings, and whose remaining 
+   elements are the symbols, with nil found as the tail of the last cell. */
+
+#ifdef IMAGE
+
+static void save_image (void)
+{
+  ptr_t r, c;
+  int i;
+
+  r = nil;
+  PROT1(r);
+
+  for (i = sizeof symbol_chars - 2; i >= 0; i--)
+  { c = alloc (TYPE_LIST);
+    LIST(c) -> head = symbols[i];
+    LIST(c) -> tail = r;
+    r = c;
+  }
+
+  c = alloc (TYPE_LIST);
+  LIST(c) -> head = global_bindings;
+  LIST(c) -> tail = r;
+  r = c;
+
+  if (sggc_save_image (IMAGE, r) != 0)
+  { printf("CAN'T SAVE IMAGE\n");
+    exit(1);
+  }
+
+  PROT_END;
+}
+
+static int load_image (void)
+{
+  ptr_t r;
+  int i;
+
+  if (sggc_load_image (IMAGE, &r) != 0)
+  { return 0;
+  }
+
+  global_bindings = LIST(r) -> head;
+  r = LIST(r) -> tail;
+
+  for (i = 0; symbol_chars[i]; i++)
+  { symbols[i] = LIST(r) -> head;
+    r = LIST(r) -> tail;
+  }
+
+  nil = r;
+
+  return 1;
+}
+
+#endif
+
+
 /* MAIN PROGRAM. */
 
 int main (void)
 {
   int seqno = 1;
 
+# ifdef SGGC_CONSERVATIVE
+    sggc_stack_base (__builtin_frame_address(0));
+# endif
+
 # if NO_REUSE
     sggc_init (SGGC_MAX_SEGMENTS);
 # else
@@ -691,6 +867,10 @@ int main (void)
     sggc_no_reuse(1);
 # endif
 
+# ifdef SOFT_LIMIT
+    sggc_set_soft_limit (SOFT_LIMIT, 1);
+# endif
+
 # if CALL_NEWLY_FREED
   { sggc_kind_t k;
     for (k = 0; k < SGGC_N_KINDS; k++) 
@@ -699,33 +879,69 @@ int main (void)
   }
 # endif
 
-  nil = sggc_alloc (TYPE_NIL, 1);
+# if CALL_FINALIZERS
+    sggc_set_finalizer (finalizer_fun);
+# endif
 
-# ifndef SGGC_NO_OBJECT_ZERO
-    if (nil != 0) abort();
+# if PRETENURE
+    sggc_pretenure_kind (TYPE_NIL, 2);      /* objects created at start are */
+    sggc_pretenure_kind (TYPE_SYMBOL, 2);   /*   never freed, so put them   */
+    sggc_pretenure_kind (TYPE_BINDING, 2);  /*   straight in generation 2   */
 # endif
 
-  global_bindings = nil;
+# ifdef IMAGE
+    if (!load_image())
+# endif
+  { 
+    nil = sggc_alloc (TYPE_NIL, 1);
 
-  ptr_t n;
-  int i;
+#   ifndef SGGC_NO_OBJECT_ZERO
+      if (nil != 0) abort();
+#   endif
 
-  for (i = 0; symbol_chars[i]; i++)
-  { symbols[i] = alloc (TYPE_SYMBOL);
-    SYMBOL(symbols[i]) -> symbol = symbol_chars[i];
-#   if UNCOLLECT_LEVEL >= 3
-      n = sggc_alloc_small_kind (KIND_GLOBAL_BINDING);
-      alloc_count += 1;
-#   else
-      n = alloc (TYPE_BINDING);
+    global_bindings = nil;
+
+    ptr_t n;
+    int i;
+
+#   ifdef SHARED_CONSTANTS
+      constant_symbols();
+#   endif
+
+    for (i = 0; symbol_chars[i]; i++)
+    { 
+#     ifndef SHARED_CONSTANTS
+        symbols[i] = alloc (TYPE_SYMBOL);
+        SYMBOL(symbols[i]) -> symbol = symbol_chars[i];
+#     endif
+#     if UNCOLLECT_LEVEL >= 3
+        n = sggc_alloc_small_kind (KIND_GLOBAL_BINDING);
+        alloc_count += 1;
+#     else
+        n = alloc (TYPE_BINDING);
+#     endif
+      BOUND_SYMBOL(n) = symbol_chars[i];     /* no old-to-new check needed: */
+      BINDING(n) -> next = global_bindings;  /*   either n is new, or n is  */
+      BINDING(n) -> value = nil;             /*   uncollected, and so "to"  */
+      global_bindings = n;
+    }
+
+#   ifdef IMAGE
+      save_image();
 #   endif
-    BOUND_SYMBOL(n) = symbol_chars[i];     /* no old-to-new check needed:   */
-    BINDING(n) -> next = global_bindings;  /*   either n is new, or n is    */
-    BINDING(n) -> value = nil;             /*   uncollected, and so is "to" */
-    global_bindings = n;
   }
 
-  sggc_collect(2);
+# if PRETENURE
+    sggc_pretenure_kind (TYPE_NIL, 0);
+    sggc_pretenure_kind (TYPE_SYMBOL, 0);
+    sggc_pretenure_kind (TYPE_BINDING, 0);
+# endif
+
+# if FREEZE
+    sggc_freeze_heap();
+# else
+    sggc_collect(2);
+# endif
 
   /* The read / eval / print loop. */
 
@@ -734,6 +950,11 @@ int main (void)
     printf ("%d \\ ", seqno++);
     print (eval (expr, global_bindings));
     printf ("\n");
+#   if FREEZE
+      if (seqno % FREEZE == 0)
+      { sggc_freeze_heap();
+      }
+#   endif
   }
 
   return 0;
@@ -772,8 +993,21 @@ static void end_prog (void)
   printf("Big chunks... Gen0: %u, Gen1: %d, Gen2: %d, Uncollected: %d\n",
    (unsigned) sggc_info.gen0_big_chunks, (unsigned) sggc_info.gen1_big_chunks, 
    (unsigned) sggc_info.gen2_big_chunks, (unsigned) sggc_info.uncol_big_chunks);
+# ifdef SGGC_FREEZE
+    printf("Frozen objects: %u,  Frozen big chunks: %u\n",
+            sggc_info.frozen_count, (unsigned) sggc_info.frozen_big_chunks);
+# endif
   printf("Number of segments: %u,  Total memory usage: %llu bytes\n",
           sggc_info.n_segments, (unsigned long long) sggc_info.total_mem_usage);
+# ifdef SGGC_MEM_ACCOUNTING
+    printf("Memory... Segments: %llu, Tables: %llu, Small data: %llu, \
+Big data: %llu, Aux: %llu\n",
+            (unsigned long long) sggc_info.seg_mem_usage,
+            (unsigned long long) sggc_info.table_mem_usage,
+            (unsigned long long) sggc_info.small_data_mem_usage,
+            (unsigned long long) sggc_info.big_data_mem_usage,
+            (unsigned long long) sggc_info.aux_mem_usage);
+# endif
   printf("Number of allocations: %llu,  At time of last GC: %llu\n",
           (unsigned long long) sggc_info.allocations, 
           (unsigned long long) sggc_info.allocations_at_last_gc);
@@ -788,12 +1022,35 @@ static void end_prog (void)
     printf("Number of freed objects: %u\n",freed_count);
     total =  sggc_info.gen0_count + sggc_info.gen1_count + sggc_info.gen2_count
               + sggc_info.uncol_count + freed_count;
+#   ifdef SGGC_FREEZE
+      total += sggc_info.frozen_count;
+#   endif
     printf("Freed + still around: %u\n",total);
     if (total != alloc_count)
     { printf("DOESN'T MATCH ALLOC COUNT!\n");
     }
 # endif
 
+# ifdef SGGC_PRETENURE_FEEDBACK
+  { sggc_kind_t k;
+    printf("Pretenured kinds:");
+    for (k = 0; k < SGGC_N_KINDS; k++)
+    { if (sggc_kind_pretenured(k))
+      { printf(" %d",k);
+      }
+    }
+    printf("\n");
+  }
+# endif
+
+# if CALL_FINALIZERS
+    printf("Finalizers registered: %u, called: %u\n",
+            registered_count, finalized_count);
+    if (finalized_count > registered_count)
+    { printf("MORE FINALIZER CALLS THAN REGISTERED!\n");
+    }
+# endif
+
 # if UNCOLLECT_LEVEL >= 1
     if (count_uncol(TYPE_NIL) != 1) abort();
 # endif
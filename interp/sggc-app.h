@@ -18,7 +18,11 @@
    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
 
 
+#ifdef SGGC_CPTR_64
+#define SGGC_CHUNK_SIZE 16      /* Number of bytes in a data chunk, enough */
+#else                           /*   for two compressed pointers          */
 #define SGGC_CHUNK_SIZE 8       /* Number of bytes in a data chunk */
+#endif
 
 #define SGGC_N_TYPES 4          /* Number of object types */
 
@@ -25,7 +25,11 @@
 
 /* CHAINS FOR LINKING SEGMENTS IN SETS. */
 
+#ifdef SGGC_FINALIZERS
+#define SBSET_CHAINS 6       /* Number of chains that can be used for sets */
+#else
 #define SBSET_CHAINS 5       /* Number of chains that can be used for sets */
+#endif
 
 #  define SGGC_UNUSED_FREE_NEW 0  /* Unused, free or newly allocated objects */
 
@@ -39,39 +43,87 @@
 #  define SGGC_LOOK_AT 4          /* Objects that still need to be looked at
                                     in order to mark objects still in use */
 
+#ifdef SGGC_FINALIZERS
+#  define SGGC_FINALIZE 5         /* Objects with a finalizer registered */
+#endif
+
+/* Chains also used for sets of uncollected objects with old-to-new
+   references, which never share segments with collected objects, and
+   so never with the other sets using these chains. */
+
+#  define SGGC_UNCOL_REF_GEN0 SGGC_LOOK_AT   /* May reference generation 0 */
+#  define SGGC_UNCOL_REF_GEN1 SGGC_OLD_GEN1  /* May reference gen 0 or 1 */
+#  define SGGC_UNCOL_REF_GEN2 SGGC_OLD_TO_NEW /* May reference any collected */
+
 
 /* EXTRA INFORMATION STORED IN A SBSET_SEGMENT STRUCTURE.  Putting it
    here takes advantage of what might otherwise be 32 bits of unused
    padding, and makes the sbset_segment struct be exactly 64 bytes in
    size (maybe advantageous for index computation (if needed), and
-   perhaps for cache behaviour).
+   perhaps for cache behaviour), unless SGGC_FINALIZERS adds a chain.
 
    The info is a union of fields for small segments and for big
    segments, but the first few fields are the same for both kinds (and
-   may be referenced either way). */
+   may be referenced either way).  The 'frozen' field is present only
+   if SGGC_FREEZE is defined, in which case one bit less is available
+   for alloc_chunks, and one less is unused in small segments.  The
+   'mapped' field for big segments is present only if SGGC_MAPPED is
+   defined, also taking a bit from alloc_chunks.  The 'has_new' field
+   for small segments is present only if SGGC_CONSERVATIVE is defined,
+   taking one of the unused bits. */
+
+#ifdef SGGC_FREEZE
+#define SGGC_FROZEN_FIELD unsigned frozen : 1;
+#define SGGC_FROZEN_BITS 1
+#else
+#define SGGC_FROZEN_FIELD
+#define SGGC_FROZEN_BITS 0
+#endif
+
+#ifdef SGGC_MAPPED
+#define SGGC_MAPPED_FIELD unsigned mapped : 1;
+#define SGGC_MAPPED_BITS 1
+#else
+#define SGGC_MAPPED_FIELD
+#define SGGC_MAPPED_BITS 0
+#endif
+
+#ifdef SGGC_CONSERVATIVE
+#define SGGC_HAS_NEW_FIELD unsigned has_new : 1;
+#define SGGC_HAS_NEW_BITS 1
+#else
+#define SGGC_HAS_NEW_FIELD
+#define SGGC_HAS_NEW_BITS 0
+#endif
+
+#define SGGC_ALLOC_CHUNKS_BITS (19 - SGGC_FROZEN_BITS - SGGC_MAPPED_BITS)
+#define SGGC_SMALL_UNUSED_BITS (6 - SGGC_FROZEN_BITS - SGGC_HAS_NEW_BITS)
 
 #define SBSET_EXTRA_INFO \
   union \
   { struct                 /* For big segments... */ \
     { unsigned char kind;     /* The kind of segment                        */ \
       unsigned constant : 1;  /* 1 for a constant segment                   */ \
+      SGGC_FROZEN_FIELD       /* 1 for a segment of frozen objects          */ \
       unsigned align_off : 2; /* Offset added to address to align >> 3      */ \
       unsigned big : 1;       /* 1 for a big segment with one large object  */ \
       unsigned huge : 1;      /* 1 if maximum cnunks not less than 2^21     */ \
-      unsigned alloc_chunks : 19; /* Chunks that fit in allocated space, if */ \
-    } Big;                    /* huge is 0, else that >> by SGGC_HUGE_SHIFT */ \
+      SGGC_MAPPED_FIELD       /* 1 if data is mapped from a file            */ \
+      unsigned alloc_chunks : SGGC_ALLOC_CHUNKS_BITS; /* Chunks that fit in */ \
+    } Big;          /* allocated space, if huge is 0, else >> SGGC_HUGE_SHIFT */ \
     struct                 /* For small segments... */ \
     { unsigned char kind;     /* The kind of segment                        */ \
       unsigned constant : 1;  /* 1 for a constant segment                   */ \
+      SGGC_FROZEN_FIELD       /* 1 for a segment of frozen objects          */ \
       unsigned big : 1;       /* 1 for a big segment with one large object  */ \
-      unsigned unused : 6;    /* Bits not currently in use                  */ \
+      SGGC_HAS_NEW_FIELD      /* 1 if may have new objects, for scanning    */ \
+      unsigned unused : SGGC_SMALL_UNUSED_BITS; /* Bits not currently used  */ \
       /* setting of aux1_off and aux2_off below may be disabled in sggc.c   */ \
       unsigned char aux1_off; /* Offset of aux1 info from start of block    */ \
       unsigned char aux2_off; /* Offset of aux2 info from start of block    */ \
     } Small; \
   } X;
 
-
 /* POINTER TO ARRAY OF SEGMENTS OR POINTERS TO SEGMENTS.  This array
    of segments or pointers to them is allocated when the GC is
    initialized, with the segments themselves allocated later, as
@@ -82,18 +134,31 @@
 #define SGGC_EXTERN extern
 #endif
 
+/* STORAGE CLASS FOR VARIABLES HOLDING THE STATE OF A HEAP.  These are
+   thread-local if SGGC_HEAPS is defined, so each thread works on its
+   own current heap (see sggc_heap_switch). */
+
+#ifndef SGGC_HEAP_VAR
+#ifdef SGGC_HEAPS
+#define SGGC_HEAP_VAR __thread
+#else
+#define SGGC_HEAP_VAR
+#endif
+#endif
+
 #ifdef SGGC_MAX_SEGMENTS
 #ifdef SGGC_SEG_DIRECT
 #define SBSET_DO_BEFORE_INLINE \
-  SGGC_EXTERN struct sbset_segment sggc_segment[SGGC_MAX_SEGMENTS];
+  SGGC_EXTERN SGGC_HEAP_VAR struct sbset_segment \
+    sggc_segment[SGGC_MAX_SEGMENTS];
 #else
-SGGC_EXTERN struct sbset_segment *sggc_segment[SGGC_MAX_SEGMENTS];
+SGGC_EXTERN SGGC_HEAP_VAR struct sbset_segment *sggc_segment[SGGC_MAX_SEGMENTS];
 #endif
 #else
 #ifdef SGGC_SEG_DIRECT
-SGGC_EXTERN struct sbset_segment *sggc_segment;
+SGGC_EXTERN SGGC_HEAP_VAR struct sbset_segment *sggc_segment;
 #else
-SGGC_EXTERN struct sbset_segment **sggc_segment;
+SGGC_EXTERN SGGC_HEAP_VAR struct sbset_segment **sggc_segment;
 #endif
 #endif
 
@@ -424,3 +424,152 @@ SBSET_PROC_CLASS void sbset_remove_segment (struct sbset *set,
 
   CHK_SET(set);
 }
+
+
+/* SORT THE SEGMENTS OF A SET INTO ORDER OF INCREASING INDEX.  Segments
+   with no elements are first removed from the chain.  The sort is an
+   LSD radix sort, relinking the chain in place, with each pass using 
+   the next SORT_RADIX_BITS bits of the index, stopping once the higher
+   bits are zero for all segments.  When SBSET_STATIC is set, this is
+   compiled only if SBSET_USE_SORT_CHAIN is defined, so that a module
+   including sbset.c that doesn't use it gets no unused function. */
+
+#define SORT_RADIX_BITS 8
+#define SORT_BUCKETS (1 << SORT_RADIX_BITS)
+
+#if !SBSET_STATIC || defined(SBSET_USE_SORT_CHAIN) \
+                  || defined(SBSET_USE_SORT_CHAIN_BY_COUNT)
+
+static void concat_buckets (struct sbset *set, sbset_index_t *head, 
+                            sbset_index_t *tail, int n)
+{
+  int chain = set->chain;
+  sbset_index_t *p;
+  int i;
+
+  p = &set->first;
+  for (i = 0; i < n; i++)
+  { if (head[i] != SBSET_END_OF_CHAIN)
+    { *p = head[i];
+      p = &SBSET_SEGMENT(tail[i])->next[chain];
+    }
+  }
+  *p = SBSET_END_OF_CHAIN;
+}
+
+#endif
+
+#if !SBSET_STATIC || defined(SBSET_USE_SORT_CHAIN)
+
+SBSET_PROC_CLASS void sbset_sort_chain (struct sbset *set)
+{
+  CHK_SET(set);
+  int chain = set->chain;
+
+  sbset_index_t head[SORT_BUCKETS], tail[SORT_BUCKETS];
+  sbset_index_t index, nindex, max, *p;
+  struct sbset_segment *seg;
+  int shift, i;
+
+  /* Remove empty segments, and find the largest index. */
+
+  max = 0;
+  p = &set->first;
+  while ((index = *p) != SBSET_END_OF_CHAIN)
+  { seg = SBSET_SEGMENT(index);
+    CHK_SEGMENT(seg,chain);
+    if (seg->bits[chain] == 0)
+    { *p = seg->next[chain];
+      seg->next[chain] = SBSET_NOT_IN_CHAIN;
+    }
+    else
+    { if (index > max) max = index;
+      p = &seg->next[chain];
+    }
+  }
+
+  /* Distribute segments into buckets by one digit of their index, keeping
+     their previous order within a bucket, and then concatenate the 
+     buckets, for successive digits starting with the lowest. */
+
+  for (shift = 0; ; shift += SORT_RADIX_BITS)
+  { 
+    for (i = 0; i < SORT_BUCKETS; i++)
+    { head[i] = SBSET_END_OF_CHAIN;
+    }
+
+    for (index = set->first; index != SBSET_END_OF_CHAIN; index = nindex)
+    { seg = SBSET_SEGMENT(index);
+      nindex = seg->next[chain];
+      i = (index >> shift) & (SORT_BUCKETS - 1);
+      if (head[i] == SBSET_END_OF_CHAIN)
+      { head[i] = index;
+      }
+      else
+      { SBSET_SEGMENT(tail[i])->next[chain] = index;
+      }
+      tail[i] = index;
+    }
+
+    concat_buckets (set, head, tail, SORT_BUCKETS);
+
+    if ((max >> shift) < SORT_BUCKETS)
+    { break;
+    }
+  }
+
+  CHK_SET(set);
+}
+
+#endif
+
+
+/* SORT THE SEGMENTS OF A SET BY HOW MANY ELEMENTS THEY CONTAIN.  Segments
+   with fewer elements come first, with segments having the same number
+   of elements staying in their previous order.  Segments with no elements
+   are removed from the chain.  Done with one pass of a bucket sort.
+   When SBSET_STATIC is set, this is compiled only if 
+   SBSET_USE_SORT_CHAIN_BY_COUNT is defined, as for sbset_sort_chain. */
+
+#define COUNT_BUCKETS ((int) (8 * sizeof (sbset_bits_t) + 1))
+
+#if !SBSET_STATIC || defined(SBSET_USE_SORT_CHAIN_BY_COUNT)
+
+SBSET_PROC_CLASS void sbset_sort_chain_by_count (struct sbset *set)
+{
+  CHK_SET(set);
+  int chain = set->chain;
+
+  sbset_index_t head[COUNT_BUCKETS], tail[COUNT_BUCKETS];
+  sbset_index_t index, nindex;
+  struct sbset_segment *seg;
+  int i;
+
+  for (i = 0; i < COUNT_BUCKETS; i++)
+  { head[i] = SBSET_END_OF_CHAIN;
+  }
+
+  for (index = set->first; index != SBSET_END_OF_CHAIN; index = nindex)
+  { seg = SBSET_SEGMENT(index);
+    CHK_SEGMENT(seg,chain);
+    nindex = seg->next[chain];
+    i = sbset_bit_count (seg->bits[chain]);
+    if (i == 0)
+    { seg->next[chain] = SBSET_NOT_IN_CHAIN;
+      continue;
+    }
+    if (head[i] == SBSET_END_OF_CHAIN)
+    { head[i] = index;
+    }
+    else
+    { SBSET_SEGMENT(tail[i])->next[chain] = index;
+    }
+    tail[i] = index;
+  }
+
+  concat_buckets (set, head, tail, COUNT_BUCKETS);
+
+  CHK_SET(set);
+}
+
+#endif
@@ -39,11 +39,20 @@
    and is designed to be 32 bits.  The sbset_index_t type must be signed,
    and should also be 32 bits, to limit space used.  The sbset_offset_t type
    is not used in data structures, and can be int, as that is big enough
-   and presumably most efficient. */
+   and presumably most efficient.
+
+   If SBSET_VALUE_64 is defined, sbset_value_t and sbset_index_t are 64
+   bits instead, allowing more than 2^(32-SBSET_OFFSET_BITS) segments, at
+   the cost of more space for values and for the chain links in segments. */
 
 typedef int sbset_offset_t;
+#ifdef SBSET_VALUE_64
+typedef int64_t sbset_index_t;
+typedef uint64_t sbset_value_t;
+#else
 typedef int32_t sbset_index_t;
 typedef uint32_t sbset_value_t;
+#endif
 
 
 /* MACROS TO CREATE / ACCESS (INDEX, OFFSET) PAIRS. */
@@ -398,6 +407,256 @@ static inline int sbset_remove (struct sbset *set, sbset_value_t val)
 }
 
 
+/* ITERATION OVER THE SEGMENTS OF A SET.  Visits each segment with
+   elements in a set once, giving its index and its bits, without the
+   per-element steps of sbset_first and sbset_next.  Used as follows:
+
+       struct sbset_iter it;
+       sbset_bits_t b;
+       sbset_for_each_segment (&it, set, b)
+       { ... sbset_iter_index(&it) is the index of the segment, and
+             b is its bits, which may be replaced by calling
+             sbset_iter_assign_bits(&it,nb) ...
+       }
+
+   Segments in the chain with no elements are unlinked as they are
+   passed over, as are segments whose bits are set to zero with
+   sbset_iter_assign_bits, once the iteration moves past them, so one
+   pass leaves no unused segments in the chain.  Other than by using
+   sbset_iter_assign_bits on the current segment, the set must not be
+   changed during the iteration. */
+
+struct sbset_iter
+{ struct sbset *set;          /* Set being iterated over */
+  sbset_index_t prev;         /* Segment before current, or END_OF_CHAIN */
+  sbset_index_t index;        /* Current segment, or END_OF_CHAIN when done */
+};
+
+#define sbset_for_each_segment(it,s,b) \
+  for ((b) = sbset_iter_first((it),(s)); (b) != 0; (b) = sbset_iter_next(it))
+
+
+/* SKIP TO A SEGMENT WITH ELEMENTS, STARTING AT THE CURRENT ONE.  Unlinks
+   unused segments that are skipped, and returns the bits of the segment
+   found, or zero if the end of the chain is reached. */
+
+static inline sbset_bits_t sbset_iter_skip_unused (struct sbset_iter *it)
+{
+  int chain = it->set->chain;
+
+  while (it->index != SBSET_END_OF_CHAIN)
+  { 
+    struct sbset_segment *seg = SBSET_SEGMENT(it->index);
+    sbset_bits_t b = seg->bits[chain];
+    if (b != 0) 
+    { return b;
+    }
+
+    sbset_index_t nindex = seg->next[chain];
+    if (it->prev == SBSET_END_OF_CHAIN)
+    { it->set->first = nindex;
+    }
+    else
+    { SBSET_SEGMENT(it->prev)->next[chain] = nindex;
+    }
+    seg->next[chain] = SBSET_NOT_IN_CHAIN;
+    it->index = nindex;
+  }
+
+  return 0;
+}
+
+
+/* START AN ITERATION OVER THE SEGMENTS OF A SET.  Returns the bits for
+   the first segment with elements, or zero if the set is empty. */
+
+static inline sbset_bits_t sbset_iter_first (struct sbset_iter *it,
+                                             struct sbset *set)
+{
+  it->set = set;
+  it->prev = SBSET_END_OF_CHAIN;
+  it->index = set->first;
+
+  return sbset_iter_skip_unused (it);
+}
+
+
+/* GO TO THE NEXT SEGMENT IN AN ITERATION.  Returns the bits for the next
+   segment with elements, or zero if there are no more.  The segment
+   being left is unlinked if its bits were set to zero. */
+
+static inline sbset_bits_t sbset_iter_next (struct sbset_iter *it)
+{
+  sbset_index_t index = it->index;
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+  int chain = it->set->chain;
+
+  if (seg->bits[chain] == 0)
+  { it->index = seg->next[chain];
+    if (it->prev == SBSET_END_OF_CHAIN)
+    { it->set->first = it->index;
+    }
+    else
+    { SBSET_SEGMENT(it->prev)->next[chain] = it->index;
+    }
+    seg->next[chain] = SBSET_NOT_IN_CHAIN;
+  }
+  else
+  { it->prev = index;
+    it->index = seg->next[chain];
+  }
+
+  return sbset_iter_skip_unused (it);
+}
+
+
+/* RETURN THE INDEX OF THE CURRENT SEGMENT IN AN ITERATION. */
+
+static inline sbset_index_t sbset_iter_index (struct sbset_iter *it)
+{
+  return it->index;
+}
+
+
+/* ASSIGN NEW BITS FOR THE CURRENT SEGMENT IN AN ITERATION.  The count
+   of elements is updated.  If the bits are zero, the segment will be
+   unlinked from the chain when the iteration moves past it. */
+
+static inline void sbset_iter_assign_bits (struct sbset_iter *it,
+                                           sbset_bits_t b)
+{
+  struct sbset_segment *seg = SBSET_SEGMENT(it->index);
+  struct sbset *set = it->set;
+
+  set->n_elements -= sbset_bit_count(seg->bits[set->chain]);
+  seg->bits[set->chain] = b;
+  set->n_elements += sbset_bit_count(b);
+}
+
+
+/* ATOMIC VERSIONS OF SET OPERATIONS.  Present only if SBSET_ATOMIC is
+   defined, using the gcc/clang __atomic builtins.  These may be called
+   concurrently from several threads for the same set (or other sets
+   using the same chain), but not concurrently with the non-atomic
+   operations on sets using that chain (eg, sbset_first or sbset_next,
+   which may unlink segments).  The application may use them for only
+   those sets that are actually shared between threads.
+
+   Membership bits are changed with atomic fetch-or / fetch-and, which
+   is where each operation takes effect.  The count of elements is
+   updated with relaxed atomic operations, so it is exact only once
+   concurrent operations have finished. */
+
+#ifdef SBSET_ATOMIC
+
+#if !defined(__GNUC__) && !defined(__clang__)
+#error "SBSET_ATOMIC requires the __atomic builtins of gcc or clang"
+#endif
+
+
+/* CHECK WHETHER A VALUE IS AN ELEMENT OF ANY SET USING A GIVEN CHAIN,
+   WHILE THE SETS MAY BE CHANGED ATOMICALLY BY OTHER THREADS. */
+
+static inline int sbset_chain_contains_atomic (int chain, sbset_value_t val)
+{
+  sbset_index_t index = SBSET_VAL_INDEX(val);
+  sbset_offset_t offset = SBSET_VAL_OFFSET(val);
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+
+  return (__atomic_load_n (&seg->bits[chain], __ATOMIC_ACQUIRE) >> offset) & 1;
+}
+
+
+/* RETURN THE NUMBER OF ELEMENTS IN A SET THAT MAY BE CHANGED ATOMICALLY. */
+
+static inline sbset_value_t sbset_n_elements_atomic (struct sbset *set)
+{
+  return __atomic_load_n (&set->n_elements, __ATOMIC_RELAXED);
+}
+
+
+/* PUT A SEGMENT IN THE CHAIN FOR A SET, IF IT ISN'T ALREADY THERE.  The
+   thread that changes the segment's 'next' field from SBSET_NOT_IN_CHAIN 
+   takes on the job of linking it in, so that it is linked only once,
+   by compare-and-swap of the first segment of the set.  Other threads
+   may see the segment as being in the chain before it is linked, but 
+   it will be linked once all operations have finished. */
+
+static inline void sbset_link_segment_atomic (struct sbset *set, 
+                                              sbset_index_t index,
+                                              struct sbset_segment *seg)
+{
+  sbset_index_t expected = SBSET_NOT_IN_CHAIN;
+  sbset_index_t first = __atomic_load_n (&set->first, __ATOMIC_ACQUIRE);
+
+  if (!__atomic_compare_exchange_n (&seg->next[set->chain], &expected, first,
+                                    0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  { return;  /* already linked, or being linked by another thread */
+  }
+
+  while (!__atomic_compare_exchange_n (&set->first, &first, index,
+                                       0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+  { __atomic_store_n (&seg->next[set->chain], first, __ATOMIC_RELAXED);
+  }
+}
+
+
+/* ADD A VALUE TO A SET ATOMICALLY.  As for sbset_add, but may be done
+   concurrently with other atomic operations.  The bit is first looked 
+   at without modifying it, to avoid taking exclusive ownership of the
+   cache line when the value is already present. */
+
+static inline int sbset_add_atomic (struct sbset *set, sbset_value_t val)
+{
+  sbset_index_t index = SBSET_VAL_INDEX(val);
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+  sbset_bits_t *bits = &seg->bits[set->chain];
+
+  sbset_bits_t t = (sbset_bits_t)1 << SBSET_VAL_OFFSET(val);
+
+  if (__atomic_load_n (bits, __ATOMIC_RELAXED) & t)
+  { return 1;
+  }
+
+  if (__atomic_fetch_or (bits, t, __ATOMIC_ACQ_REL) & t)
+  { return 1;
+  }
+
+  sbset_link_segment_atomic (set, index, seg);
+  __atomic_fetch_add (&set->n_elements, 1, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+
+/* REMOVE A VALUE FROM A SET ATOMICALLY.  As for sbset_remove, but may be 
+   done concurrently with other atomic operations.  As for sbset_remove,
+   the segment is left in the set's chain. */
+
+static inline int sbset_remove_atomic (struct sbset *set, sbset_value_t val)
+{
+  sbset_index_t index = SBSET_VAL_INDEX(val);
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+  sbset_bits_t *bits = &seg->bits[set->chain];
+
+  sbset_bits_t t = (sbset_bits_t)1 << SBSET_VAL_OFFSET(val);
+
+  if ((__atomic_load_n (bits, __ATOMIC_RELAXED) & t) == 0)
+  { return 0;
+  }
+
+  if ((__atomic_fetch_and (bits, ~t, __ATOMIC_ACQ_REL) & t) == 0)
+  { return 0;
+  }
+
+  __atomic_fetch_sub (&set->n_elements, 1, __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+#endif
+
+
 /* NON-INLINE FUNCTIONS USED BY THE APPLICATION.
 
    There are no non-inline function declarations if SBSET_NO_FUNCTIONS
@@ -427,6 +686,8 @@ void sbset_move_first (struct sbset *src, struct sbset *dst);
 void sbset_move_next (struct sbset *src, sbset_value_t val, struct sbset *dst);
 void sbset_add_segment (struct sbset *set, sbset_value_t val, int chain);
 void sbset_remove_segment (struct sbset *set, sbset_value_t val, int chain);
+void sbset_sort_chain (struct sbset *set);
+void sbset_sort_chain_by_count (struct sbset *set);
 
 #endif
 
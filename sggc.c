@@ -23,14 +23,34 @@
      discussion of the implementation of SGGC. */
 
 
+#if defined(SGGC_RELEASE_FREE_DATA) || defined(SGGC_IMAGE) \
+     || defined(SGGC_SHARED_CONSTANTS) || defined(SGGC_MAPPED)
+#define _DEFAULT_SOURCE  /* So madvise and mmap will be declared */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(SGGC_RELEASE_FREE_DATA) || defined(SGGC_IMAGE) \
+     || defined(SGGC_SHARED_CONSTANTS) || defined(SGGC_MAPPED)
+#include <sys/mman.h>
+#endif
+
+#ifdef SGGC_MAPPED
+#include <sys/stat.h>
+#endif
+
 #define SGGC_EXTERN    /* So globals will be declared here without 'extern' */
 #include "sggc-app.h"
 
 #if SBSET_STATIC
+# ifdef SGGC_SORT_CHAINS
+#   define SBSET_USE_SORT_CHAIN   /* Needed only if used, to avoid warning */
+# endif
+# ifdef SGGC_ALLOC_DENSE_FIRST
+#   define SBSET_USE_SORT_CHAIN_BY_COUNT
+# endif
 # include "sbset.c"    /* Define set procedures here as static, not linked */
 #endif
 
@@ -44,6 +64,93 @@
 #endif
 
 
+/* RELEASE OF MEMORY FOR FREE SMALL DATA AREAS.  Small data areas are
+   then aligned to the page size, and by default allocated in blocks
+   covering several pages, so that whole pages may be entirely free. */
+
+#ifdef SGGC_RELEASE_FREE_DATA
+
+#ifndef SGGC_PAGE_SIZE
+#define SGGC_PAGE_SIZE 4096
+#endif
+
+#ifndef SGGC_RELEASE_ADVICE
+#define SGGC_RELEASE_ADVICE MADV_DONTNEED
+#endif
+
+#if !defined(SGGC_SMALL_DATA_AREA_ALIGN) \
+      || SGGC_SMALL_DATA_AREA_ALIGN < SGGC_PAGE_SIZE
+# undef SGGC_SMALL_DATA_AREA_ALIGN
+# define SGGC_SMALL_DATA_AREA_ALIGN SGGC_PAGE_SIZE
+#endif
+
+#ifndef SGGC_SMALL_DATA_AREA_BLOCKING
+# define SGGC_SMALL_DATA_AREA_BLOCKING \
+   (16 * SGGC_PAGE_SIZE > SGGC_CHUNK_SIZE * SGGC_CHUNKS_IN_SMALL_SEGMENT \
+     ? 16 * SGGC_PAGE_SIZE / (SGGC_CHUNK_SIZE * SGGC_CHUNKS_IN_SMALL_SEGMENT) \
+     : 1)
+#endif
+
+#endif
+
+
+/* SAVING AND LOADING HEAP IMAGES AND FILES OF CONSTANTS.  Data areas in
+   an image file start at an offset that is a multiple of SGGC_PAGE_SIZE,
+   so that they can be mapped into memory, and are each aligned to 
+   SGGC_IMAGE_ALIGN, as are areas in a file of constant segments. */
+
+#if defined(SGGC_IMAGE) || defined(SGGC_SHARED_CONSTANTS)
+
+#ifndef SGGC_PAGE_SIZE
+#define SGGC_PAGE_SIZE 4096
+#endif
+
+#ifndef SGGC_IMAGE_ALIGN
+#if defined(SGGC_SMALL_DATA_AREA_ALIGN) && SGGC_SMALL_DATA_AREA_ALIGN > 64
+#define SGGC_IMAGE_ALIGN SGGC_SMALL_DATA_AREA_ALIGN
+#elif defined(SGGC_DATA_ALIGNMENT) && SGGC_DATA_ALIGNMENT > 64
+#define SGGC_IMAGE_ALIGN SGGC_DATA_ALIGNMENT
+#else
+#define SGGC_IMAGE_ALIGN 64
+#endif
+#endif
+
+#define IMAGE_ROUND(pos) \
+  (((pos) + SGGC_IMAGE_ALIGN - 1) & ~(uint64_t) (SGGC_IMAGE_ALIGN - 1))
+
+#endif
+
+#ifdef SGGC_IMAGE
+
+static SGGC_HEAP_VAR char *image_data;       /* Data areas of image, or NULL */
+static SGGC_HEAP_VAR size_t image_data_size; /* Size of data areas of image */
+static SGGC_HEAP_VAR int image_data_mapped;  /* Were data areas mapped? */
+
+#define IN_IMAGE(p) \
+  ((char *)(p) >= image_data && (char *)(p) < image_data + image_data_size)
+
+#endif
+
+
+/* BIG OBJECTS WITH DATA MAPPED FROM A FILE OR SUPPLIED BY THE APPLICATION.
+   The file offset or address of the data must be suitably aligned, since
+   the data area is not copied. */
+
+#ifdef SGGC_MAPPED
+#ifndef SGGC_PAGE_SIZE
+#define SGGC_PAGE_SIZE 4096
+#endif
+#endif
+
+#if defined(SGGC_MAPPED) || defined(SGGC_EXTERNAL)
+#if defined(SGGC_DATA_ALIGNMENT) && SGGC_DATA_ALIGNMENT > 8
+#define GIVEN_DATA_ALIGN SGGC_DATA_ALIGNMENT
+#else
+#define GIVEN_DATA_ALIGN 8
+#endif
+#endif
+
+
 /* BLOCKING/ALIGNMENT FOR DATA AREAS. */
 
 #ifndef SGGC_SMALL_DATA_AREA_BLOCKING
@@ -108,6 +215,166 @@
 #endif
 
 
+/* MEMORY RECORDED FOR EACH HEAP.  When SGGC_HEAPS is defined, every
+   block allocated with the macros above is preceded by a header that
+   links it into a list of blocks for the current heap, so that
+   sggc_heap_free can free all memory used by a heap.  The macros are
+   then redefined to do this, with heap_raw_alloc and heap_raw_free
+   being used for structures recording heaps, which are in no heap. */
+
+#ifdef SGGC_HEAPS
+
+union heap_mem_hdr
+{ struct { union heap_mem_hdr *next, *prev; } link;
+  long double align;   /* So memory after the header is aligned as usual */
+};
+
+static SGGC_HEAP_VAR union heap_mem_hdr *heap_mem_list; /* Blocks in heap */
+
+static void *heap_raw_alloc (size_t n)
+{ return sggc_mem_alloc (n);
+}
+
+static void heap_raw_free (void *p)
+{ sggc_mem_free (p);
+}
+
+static void *heap_mem_link (union heap_mem_hdr *h)
+{
+  if (h == NULL)
+  { return NULL;
+  }
+
+  h->link.prev = NULL;
+  h->link.next = heap_mem_list;
+  if (heap_mem_list != NULL)
+  { heap_mem_list->link.prev = h;
+  }
+  heap_mem_list = h;
+
+  return h + 1;
+}
+
+static void *heap_mem_alloc (size_t n)
+{ return heap_mem_link (sggc_mem_alloc (sizeof (union heap_mem_hdr) + n));
+}
+
+static void *heap_mem_alloc_zero (size_t n)
+{ return heap_mem_link (sggc_mem_alloc_zero (sizeof(union heap_mem_hdr) + n));
+}
+
+static void heap_mem_free (void *p)
+{
+  union heap_mem_hdr *h;
+
+  if (p == NULL)
+  { return;
+  }
+
+  h = (union heap_mem_hdr *) p - 1;
+  if (h->link.prev != NULL)
+  { h->link.prev->link.next = h->link.next;
+  }
+  else
+  { heap_mem_list = h->link.next;
+  }
+  if (h->link.next != NULL)
+  { h->link.next->link.prev = h->link.prev;
+  }
+
+  sggc_mem_free (h);
+}
+
+#undef sggc_mem_alloc
+#undef sggc_mem_alloc_zero
+#undef sggc_mem_free
+#define sggc_mem_alloc(n) heap_mem_alloc(n)
+#define sggc_mem_alloc_zero(n) heap_mem_alloc_zero(n)
+#define sggc_mem_free(p) heap_mem_free(p)
+
+#endif
+
+
+/* MEMORY ACCOUNTING.  MEM_SIZE gives the memory usage to record for an
+   allocation that asked for 'requested' bytes, of which 'nominal' bytes
+   are used.  If SGGC_MEM_ACCOUNTING is defined, this is the estimate
+   from SGGC_MEM_ALLOCATED of what the allocator actually used, otherwise
+   it is just the nominal size.  MEM_ADD and MEM_SUB change the total
+   memory usage, and if SGGC_MEM_ACCOUNTING is defined, the usage for a 
+   category (seg, table, small_data, big_data, or aux). 
+
+   The default for SGGC_MEM_ALLOCATED suits allocators that add a size
+   word and round to twice the size of a size word, as glibc does.  When
+   SGGC_HEAPS is defined, the header put before each block to record it
+   for its heap is included in what is requested from the allocator. */
+
+#ifdef SGGC_MEM_ACCOUNTING
+
+#ifndef SGGC_MEM_ALLOCATED
+#define SGGC_MEM_ALLOCATED(n) \
+  (((n) + 3*sizeof(size_t) - 1) & ~(2*sizeof(size_t) - 1))
+#endif
+
+#ifdef SGGC_HEAPS
+#define MEM_SIZE(nominal,requested) \
+  SGGC_MEM_ALLOCATED((requested) + sizeof (union heap_mem_hdr))
+#else
+#define MEM_SIZE(nominal,requested) SGGC_MEM_ALLOCATED(requested)
+#endif
+#define MEM_ADD(cat,n) \
+  (sggc_info.cat##_mem_usage += (n), sggc_info.total_mem_usage += (n))
+#define MEM_SUB(cat,n) \
+  (sggc_info.cat##_mem_usage -= (n), sggc_info.total_mem_usage -= (n))
+
+#else
+
+#define MEM_SIZE(nominal,requested) (nominal)
+#define MEM_ADD(cat,n) (sggc_info.total_mem_usage += (n))
+#define MEM_SUB(cat,n) (sggc_info.total_mem_usage -= (n))
+
+#endif
+
+/* Extra space requested for a big data area so it can be aligned. */
+
+#if defined(SGGC_DATA_ALIGNMENT) && SGGC_DATA_ALIGNMENT > 8
+#define BIG_ALIGN_EXTRA (SGGC_DATA_ALIGNMENT - 1)
+#else
+#define BIG_ALIGN_EXTRA 0
+#endif
+
+
+/* MEDIUM-SIZED BIG OBJECTS.  If SGGC_MEDIUM_OBJECTS is defined, data
+   areas for big objects of no more than SGGC_MEDIUM_MAX bytes are taken
+   from slots in regions of SGGC_MEDIUM_REGION bytes, with each region
+   holding slots of a single size class, rather than being allocated
+   individually. */
+
+#ifdef SGGC_MEDIUM_OBJECTS
+
+#ifndef SGGC_MEDIUM_MAX
+#define SGGC_MEDIUM_MAX 16384
+#endif
+
+#ifndef SGGC_MEDIUM_REGION
+#define SGGC_MEDIUM_REGION 65536
+#endif
+
+#if SGGC_MEDIUM_REGION < SGGC_MEDIUM_MAX
+#error "SGGC_MEDIUM_REGION must be at least SGGC_MEDIUM_MAX"
+#endif
+
+#define MEDIUM_MAX_CHUNKS (SGGC_MEDIUM_MAX / SGGC_CHUNK_SIZE)
+#define MEDIUM_MAX_CLASSES 64  /* More than enough for any sensible sizes,
+                                  checked in sggc_init */
+
+#endif
+
+/* Size of a block of auxiliary information. */
+
+#define AUX_BLOCK_BYTES(size,block_size) \
+  ((size_t) SGGC_CHUNKS_IN_SMALL_SEGMENT * (block_size) * (size))
+
+
 /* NUMBERS OF CHUNKS ALLOWED FOR AN OBJECT IN KINDS OF SEGMENTS.  Zero
    means that this kind of segment is big, containing one object of
    size found using sggc_chunks.  The application must define the
@@ -132,11 +399,14 @@ static const sggc_type_t sggc_kind_types[SGGC_N_KINDS] = SGGC_KIND_TYPES;
   ((SGGC_OFFSET_CALC) (sz) << SBSET_OFFSET_BITS) * (SGGC_OFFSET_CALC) (ix))
 #define UNDO_OFFSET(ptrs,ix,sz) ((ptrs)[ix] += \
   ((SGGC_OFFSET_CALC) (sz) << SBSET_OFFSET_BITS) * (SGGC_OFFSET_CALC) (ix))
+#define WITHOUT_OFFSET(ptrs,ix,sz) ((char *) (ptrs)[ix] + \
+  ((SGGC_OFFSET_CALC) (sz) << SBSET_OFFSET_BITS) * (SGGC_OFFSET_CALC) (ix))
 
 #else
 
-#define OFFSET(ptrs,ix,sz) 0       /* nothing to do */
-#define UNDO_OFFSET(ptrs,ix,sz) 0  /* nothing to do */
+#define OFFSET(ptrs,ix,sz) ((void) 0)       /* nothing to do */
+#define UNDO_OFFSET(ptrs,ix,sz) ((void) 0)  /* nothing to do */
+#define WITHOUT_OFFSET(ptrs,ix,sz) ((char *) (ptrs)[ix])
 
 #endif
 
@@ -145,8 +415,8 @@ static const sggc_type_t sggc_kind_types[SGGC_N_KINDS] = SGGC_KIND_TYPES;
    Computed at initialization from SGGC_CHUNKS_IN_SMALL_SEGMENT and 
    sggc_kind_chunks. */
 
-static int kind_objects[SGGC_N_KINDS];
-static int kind_chunk_end[SGGC_N_KINDS];
+static SGGC_HEAP_VAR int kind_objects[SGGC_N_KINDS];
+static SGGC_HEAP_VAR int kind_chunk_end[SGGC_N_KINDS];
 
 
 /* MACRO TO FIND THE NUMBER OF CHUNKS ALLOCATED FOR A BIG SEGMENT. */
@@ -160,13 +430,13 @@ static int kind_chunk_end[SGGC_N_KINDS];
 /* BLOCKS OF SPACE ALLOCATED FOR AUXILIARY INFORMATION. */
 
 #ifdef SGGC_AUX1_SIZE
-static char *kind_aux1_block[SGGC_N_KINDS];
-static unsigned char kind_aux1_block_pos[SGGC_N_KINDS];
+static SGGC_HEAP_VAR char *kind_aux1_block[SGGC_N_KINDS];
+static SGGC_HEAP_VAR unsigned char kind_aux1_block_pos[SGGC_N_KINDS];
 #endif
 
 #ifdef SGGC_AUX2_SIZE
-static char *kind_aux2_block[SGGC_N_KINDS];
-static unsigned char kind_aux2_block_pos[SGGC_N_KINDS];
+static SGGC_HEAP_VAR char *kind_aux2_block[SGGC_N_KINDS];
+static SGGC_HEAP_VAR unsigned char kind_aux2_block_pos[SGGC_N_KINDS];
 #endif
 
 
@@ -174,11 +444,54 @@ static unsigned char kind_aux2_block_pos[SGGC_N_KINDS];
    the application's sggc_aux1_read_only and sggc_aux2_read_only functions. */
 
 #ifdef SGGC_AUX1_READ_ONLY
-static char *kind_aux1_read_only[SGGC_N_KINDS];
+static SGGC_HEAP_VAR char *kind_aux1_read_only[SGGC_N_KINDS];
 #endif
 
 #ifdef SGGC_AUX2_READ_ONLY
-static char *kind_aux2_read_only[SGGC_N_KINDS];
+static SGGC_HEAP_VAR char *kind_aux2_read_only[SGGC_N_KINDS];
+#endif
+
+
+/* TABLES OF BLOCKS OF AUXILIARY INFORMATION.  Only present if 
+   SGGC_FREE_AUX_BLOCKS is defined.  Each table has an entry for every
+   (not read-only) block of auxiliary information allocated, sorted by
+   block address, so that the block used by a segment can be found by
+   binary search.  The entry records how many segments use the block,
+   and (during a level 2 collection) how many of these are entirely free. */
+
+#if !defined(SGGC_AUX1_SIZE) && !defined(SGGC_AUX2_SIZE)
+#undef SGGC_FREE_AUX_BLOCKS     /* nothing to free */
+#endif
+
+#ifdef SGGC_FREE_AUX_BLOCKS
+#define AUX_OFF_USED 1   /* aux1_off and aux2_off are needed to find blocks */
+#else
+#define AUX_OFF_USED 0   /* aux1_off and aux2_off are not set */
+#endif
+
+#ifdef SGGC_FREE_AUX_BLOCKS
+
+struct aux_block_info
+{ char *block;            /* Start of the block of auxiliary information */
+  int users;              /* Number of segments with aux info in block */
+  int free_users;         /* Number of these found to be entirely free */
+  int freeable;           /* Set if the block will be freed */
+};
+
+struct aux_block_table
+{ struct aux_block_info *info;  /* Entries, sorted by block address */
+  int n;                        /* Number of entries in use */
+  int size;                     /* Number of entries allocated */
+};
+
+#ifdef SGGC_AUX1_SIZE
+static SGGC_HEAP_VAR struct aux_block_table aux1_blocks;
+#endif
+
+#ifdef SGGC_AUX2_SIZE
+static SGGC_HEAP_VAR struct aux_block_table aux2_blocks;
+#endif
+
 #endif
 
 
@@ -186,8 +499,8 @@ static char *kind_aux2_read_only[SGGC_N_KINDS];
    SGGC_SEG_BLOCKING is defined (and greater than 1). */
 
 #if SGGC_SEG_BLOCKING > 1
-static struct sbset_segment *seg_block; /* Pointer to next segment in block */
-static int seg_block_remaining;       /* # of segments remaining in seg_block */
+static SGGC_HEAP_VAR struct sbset_segment *seg_block; /* Next seg in block */
+static SGGC_HEAP_VAR int seg_block_remaining; /* # of segments left in block */
 #endif
 
 
@@ -196,35 +509,135 @@ static int seg_block_remaining;       /* # of segments remaining in seg_block */
 #define SMALL_DATA_AREA_SIZE \
   ((size_t) SGGC_CHUNK_SIZE * SGGC_CHUNKS_IN_SMALL_SEGMENT)
 
-static char *small_data_area_next;    /* Next position in small data area */
-static char *small_data_area_end;     /* End of small data area */
+static SGGC_HEAP_VAR char *small_data_area_next; /* Next position in area */
+static SGGC_HEAP_VAR char *small_data_area_end;  /* End of small data area */
 
 
 /* BIT VECTORS FOR FULL SEGMENTS.  Computed at initialization from 
    sggc_kind_chunks and SBSET_OFFSET_BITS. */
 
-static sbset_bits_t kind_full[SGGC_N_KINDS];
+static SGGC_HEAP_VAR sbset_bits_t kind_full[SGGC_N_KINDS];
+
+
+/* SIZE CLASSES AND REGIONS FOR MEDIUM-SIZED BIG OBJECTS.  Size classes
+   (in chunks) go up by factors of 3/2 and 4/3 alternately, starting
+   with the smallest size that can hold a pointer and keeps data areas
+   aligned.  Free slots are linked through their first word. */
+
+#ifdef SGGC_MEDIUM_OBJECTS
+
+static SGGC_HEAP_VAR sggc_nchunks_t medium_chunks[MEDIUM_MAX_CLASSES];
+                                                     /* Chunks in slots */
+static SGGC_HEAP_VAR char *medium_free[MEDIUM_MAX_CLASSES]; /* Free slots */
+static SGGC_HEAP_VAR char *medium_next[MEDIUM_MAX_CLASSES]; /* Next unused */
+static SGGC_HEAP_VAR char *medium_end[MEDIUM_MAX_CLASSES];  /* End of region */
+
+#endif
+
+
+/* RELEASE FUNCTIONS FOR BIG OBJECTS WITH EXTERNAL DATA.  If SGGC_EXTERNAL
+   is defined, a table indexed by segment is allocated when the first
+   object with a data area supplied by the application is created, 
+   recording the function to call to release the data area and its 
+   size.  The release function is NULL for other segments. */
+
+#ifdef SGGC_EXTERNAL
+
+static SGGC_HEAP_VAR struct external
+{ void (*release) (void *, size_t);  /* Function to release data area */
+  size_t nbytes;                     /* Size of data area in bytes */
+} *external;
+
+#endif
+
+
+/* GENERATIONS FOR PRETENURED KINDS.  Zero if objects of the kind are
+   allocated normally, or 1 or 2 if they are put directly in old generation
+   1 or 2, as set by sggc_pretenure_kind, or by pretenuring feedback. */
+
+static SGGC_HEAP_VAR int kind_pretenure[SGGC_N_KINDS];
+
+
+/* PRETENURING FEEDBACK.  If SGGC_PRETENURE_FEEDBACK is defined, a kind
+   using small segments is automatically pretenured into old generation 1
+   when, at a level 0 collection, at least SGGC_PRETENURE_MIN objects of
+   that kind were allocated since the previous collection, and at least
+   SGGC_PRETENURE_SURVIVAL percent of them survived.  This is
+   re-evaluated at level 1 collections: a kind pretenured by feedback
+   stops being pretenured if at least SGGC_PRETENURE_MIN objects of that
+   kind were in generation 1, and fewer than SGGC_PRETENURE_RETAIN
+   percent of them survived (moving to generation 2).  It may then be
+   pretenured again at a later level 0 collection. */
+
+#ifdef SGGC_PRETENURE_FEEDBACK
+
+#ifndef SGGC_PRETENURE_MIN
+#define SGGC_PRETENURE_MIN 1000
+#endif
+
+#ifndef SGGC_PRETENURE_SURVIVAL
+#define SGGC_PRETENURE_SURVIVAL 90
+#endif
+
+#ifndef SGGC_PRETENURE_RETAIN
+#define SGGC_PRETENURE_RETAIN 50
+#endif
+
+#if SGGC_PRETENURE_RETAIN > SGGC_PRETENURE_SURVIVAL
+#error "SGGC_PRETENURE_RETAIN must not be greater than SGGC_PRETENURE_SURVIVAL"
+#endif
+
+static SGGC_HEAP_VAR unsigned kind_gen1_before[SGGC_N_KINDS];
+                       /* Size of old_gen1[k] before level 0 or 1 collection */
+static SGGC_HEAP_VAR unsigned kind_gen2_before[SGGC_N_KINDS];
+                           /* Size of old_gen2[k] before level 1 collection */
+static SGGC_HEAP_VAR char kind_feedback[SGGC_N_KINDS];
+                            /* 1 if kind_pretenure[k] was set by feedback */
+#endif
 
 
 /* SETS OF OBJECTS. */
 
 #define old_to_new sggc_old_to_new_set   /* External for inline use in sggc.h */
 
-static struct sbset free_or_new[SGGC_N_KINDS]; /* Free or newly allocated */
-static struct sbset unused;                    /* Big segments not being used */
-static struct sbset old_gen1[SGGC_N_KINDS];    /* Survived collection once */
-static struct sbset old_gen1_big;              /*   - for big objects */
-static struct sbset old_gen2[SGGC_N_KINDS];    /* Survived collection >1 time */
-static struct sbset old_gen2_big;              /*   - for big objects */
-struct sbset old_to_new;                       /* May have old->new references*/
-static struct sbset to_look_at;                /* Not yet looked at in sweep */
-static struct sbset constants;                 /* Prealloc'd constant segments*/
+static SGGC_HEAP_VAR struct sbset free_or_new[SGGC_N_KINDS]; /* Free or new */
+static SGGC_HEAP_VAR struct sbset unused;           /* Big segments not used */
+static SGGC_HEAP_VAR struct sbset old_gen1[SGGC_N_KINDS]; /* Survived GC once */
+static SGGC_HEAP_VAR struct sbset old_gen1_big;     /*   - for big objects */
+static SGGC_HEAP_VAR struct sbset old_gen2[SGGC_N_KINDS]; /* Survived GC >1 */
+static SGGC_HEAP_VAR struct sbset old_gen2_big;     /*   - for big objects */
+SGGC_HEAP_VAR struct sbset old_to_new;         /* May have old->new refs */
+static SGGC_HEAP_VAR struct sbset to_look_at;  /* Not yet looked at in sweep */
+
+#ifdef SGGC_MARK_STACK
+static SGGC_HEAP_VAR sggc_cptr_t *mark_stack; /* Objects to look at, LIFO */
+static SGGC_HEAP_VAR size_t mark_stack_size;  /* Entries space allocated for */
+static SGGC_HEAP_VAR size_t mark_stack_top;   /* Number of entries in use */
+#endif
+static SGGC_HEAP_VAR struct sbset constants;   /* Prealloc'd constant segs */
+
+#ifdef SGGC_FREE_AUX_BLOCKS
+static SGGC_HEAP_VAR struct sbset aux_freed[SGGC_N_KINDS]; /* Aux info freed */
+#endif
+
+#ifdef SGGC_FINALIZERS
+static SGGC_HEAP_VAR struct sbset finalize; /* Have finalizer registered */
+#endif
+
+#ifdef SGGC_FREEZE
+static SGGC_HEAP_VAR struct sbset frozen[SGGC_N_KINDS]; /* Frozen, never GC'd*/
+#endif
 
 #ifdef SGGC_KIND_UNCOLLECTED
 #define uncollected sggc_uncollected_sets /* External for inline use in sggc.h*/
-struct sbset uncollected[SGGC_N_KINDS];     /* Objects never collected */
+SGGC_HEAP_VAR struct sbset uncollected[SGGC_N_KINDS]; /* Never collected */
 #endif
 
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+#define uncol_old_to_new sggc_uncol_old_to_new_sets /* External, as above */
+SGGC_HEAP_VAR struct sbset uncol_old_to_new[3]; /* Uncollected objects that */
+#endif                                 /*   may refer to generation <= index */
+
 
 /* INDICATORS OF WHICH KINDS ARE FOR UNCOLLECTED OBJECTS. */
 
@@ -235,8 +648,15 @@ const int sggc_kind_uncollected[SGGC_N_KINDS] = SGGC_KIND_UNCOLLECTED;
 
 /* FUNCTIONS TO SOMETIMES BE CALLED FOR OBJECTS AT END OF COLLECTION. */
 
-static int (*call_for_newly_freed[SGGC_N_KINDS]) (sggc_cptr_t);
-static void (*call_for_object_in_use) (sggc_cptr_t, sggc_nchunks_t);
+static SGGC_HEAP_VAR int (*call_for_newly_freed[SGGC_N_KINDS]) (sggc_cptr_t);
+#ifdef SGGC_FINALIZERS
+static SGGC_HEAP_VAR int (*finalizer) (sggc_cptr_t);
+#endif
+static SGGC_HEAP_VAR void (*call_for_object_in_use) (sggc_cptr_t,
+                                                     sggc_nchunks_t);
+static SGGC_HEAP_VAR void (*call_for_segment_in_use) (sggc_cptr_t, sggc_kind_t,
+                                                      sbset_bits_t,
+                                                      sggc_nchunks_t);
 
 
 /* RECORDS OF NEXT FREE OBJECTS FOR EACH KIND.  These are used only
@@ -254,26 +674,37 @@ static void (*call_for_object_in_use) (sggc_cptr_t, sggc_nchunks_t);
    These have external scope to allow use in sggc_alloc_small_kind_quickly, 
    which is declared as static inline in sggc.h. */
 
-sggc_cptr_t sggc_next_free_val[SGGC_N_KINDS];
-sbset_bits_t sggc_next_free_bits[SGGC_N_KINDS];
-int sggc_next_segment_not_free[SGGC_N_KINDS];
+SGGC_HEAP_VAR sggc_cptr_t sggc_next_free_val[SGGC_N_KINDS];
+SGGC_HEAP_VAR sbset_bits_t sggc_next_free_bits[SGGC_N_KINDS];
+SGGC_HEAP_VAR int sggc_next_segment_not_free[SGGC_N_KINDS];
 
 
 /* MAXIMUM NUMBER OF SEGMENTS, AND INDEX OF NEXT SEGMENT TO USE. */
 
-static sbset_index_t maximum_segments;         /* Max segments, fixed for now */
-static sbset_index_t next_segment;             /* Number of segments in use */
+static SGGC_HEAP_VAR sbset_index_t maximum_segments; /* Max segs, fixed now */
+static SGGC_HEAP_VAR sbset_index_t next_segment;     /* # of segments in use */
 
 
 /* GLOBAL VARIABLES USED FOR LOOKING AT OLD-NEW REFERENCES. */
 
-static int collect_level = -1; /* Level of current garbage collection */
-static int old_to_new_check;   /* Controls how old-to-new processing is done */
+static SGGC_HEAP_VAR int collect_level = -1; /* Level of current collection */
+SGGC_HEAP_VAR int sggc_old_to_new_checking; /* Controls old-to-new handling,
+                                               external for sggc.h */
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+static SGGC_HEAP_VAR int uncol_youngest; /* Youngest gen ref'd from uncol obj */
+#endif
 
 
 /* SUPPRESS MEMORY REUSE FLAG. */
 
-static int do_not_reuse_memory;  /* Non-zero to suppress reuse */
+static SGGC_HEAP_VAR int do_not_reuse_memory;  /* Non-zero to suppress reuse */
+
+
+/* SOFT LIMIT ON MEMORY USAGE. */
+
+static SGGC_HEAP_VAR size_t soft_limit;      /* Limit on total mem usage, or 0*/
+static SGGC_HEAP_VAR int soft_limit_collect; /* Collect when limit reached? */
+static SGGC_HEAP_VAR int soft_limit_reached; /* Last alloc failed by limit? */
 
 
 /* MACRO TO DO SOMETHING FOR ELEMENT AND THOSE FOLLOWING IN THE SAME SEGMENT. 
@@ -294,12 +725,15 @@ static int do_not_reuse_memory;  /* Non-zero to suppress reuse */
    so that the maximum number of chunks can be recorded in the available 
    space after shifting it right by SGGC_HUGE_SHIFT bits. */
 
-#define HUGE_CHUNKS (1 << 19)  /* Number of chunks where object becomes huge */
+#define HUGE_CHUNKS (1 << SGGC_ALLOC_CHUNKS_BITS) /* Chunks for huge object */
 
 #ifndef SGGC_HUGE_SHIFT
 #define SGGC_HUGE_SHIFT 13     /* Amount to shift to try to get # in range */
 #endif
 
+#define HUGE_ROUND(nch) \
+  (((nch) + (1<<SGGC_HUGE_SHIFT) - 1) >> SGGC_HUGE_SHIFT << SGGC_HUGE_SHIFT)
+
 
 /* ------------------------------ INITIALIZATION ---------------------------- */
 
@@ -401,6 +835,25 @@ int sggc_init (unsigned max_segments)
     }
   }
 
+  /* Set up size classes for medium-sized big objects. */
+
+# ifdef SGGC_MEDIUM_OBJECTS
+  { sggc_nchunks_t min = 1, n;
+    int c;
+    while (min * SGGC_CHUNK_SIZE < sizeof (char *)
+            || min * SGGC_CHUNK_SIZE < BIG_ALIGN_EXTRA + 1)
+    { min *= 2;
+    }
+    n = min;
+    for (c = 0; n < MEDIUM_MAX_CHUNKS; c++)
+    { if (c == MEDIUM_MAX_CLASSES - 1) abort();  /* too many classes */
+      medium_chunks[c] = n;
+      n = n == min ? 2*min : (n/min) % 3 == 0 ? n/3*4 : n/2*3;
+    }
+    medium_chunks[c] = MEDIUM_MAX_CHUNKS;
+  }
+# endif
+
   /* Initialize tables of read-only auxiliary information. */
 
 # ifdef SGGC_AUX1_READ_ONLY
@@ -468,6 +921,24 @@ int sggc_init (unsigned max_segments)
   sbset_init(&old_to_new,SGGC_OLD_TO_NEW);
   sbset_init(&to_look_at,SGGC_LOOK_AT);
   sbset_init(&constants,SGGC_OLD_GEN2_UNCOL);
+#ifdef SGGC_FREE_AUX_BLOCKS
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { sbset_init(&aux_freed[k],SGGC_UNUSED_FREE_NEW);
+  }
+#endif
+#ifdef SGGC_FINALIZERS
+  sbset_init(&finalize,SGGC_FINALIZE);
+#endif
+#ifdef SGGC_FREEZE
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { sbset_init(&frozen[k],SGGC_OLD_GEN2_UNCOL);
+  }
+#endif
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+  sbset_init(&uncol_old_to_new[0],SGGC_UNCOL_REF_GEN0);
+  sbset_init(&uncol_old_to_new[1],SGGC_UNCOL_REF_GEN1);
+  sbset_init(&uncol_old_to_new[2],SGGC_UNCOL_REF_GEN2);
+#endif
 
   /* Initialize to no free objects of each kind. */
 
@@ -486,8 +957,8 @@ int sggc_init (unsigned max_segments)
   { maximum_segments = SGGC_MAX_SEGMENTS;
   }
 # endif
-  if (maximum_segments > ((~(uint32_t)0) >> SBSET_OFFSET_BITS) + 1)
-  { maximum_segments = ((~(uint32_t)0) >> SBSET_OFFSET_BITS) + 1;
+  if (maximum_segments > ((~(sbset_value_t)0) >> SBSET_OFFSET_BITS) + 1)
+  { maximum_segments = ((~(sbset_value_t)0) >> SBSET_OFFSET_BITS) + 1;
   }
 
   /* Initialize next segment that can be used.  Skip segment 0 if
@@ -514,10 +985,48 @@ int sggc_init (unsigned max_segments)
   sggc_info.gen1_big_chunks = 0;
   sggc_info.gen2_big_chunks = 0;
   sggc_info.uncol_big_chunks = 0;
+#ifdef SGGC_FREEZE
+  sggc_info.frozen_count = 0;
+  sggc_info.frozen_big_chunks = 0;
+#endif
 
   sggc_info.n_segments = 0;
   sggc_info.total_mem_usage = 0;
 
+# ifdef SGGC_MAPPED
+    sggc_info.mapped_mem_usage = 0;
+# endif
+
+# ifdef SGGC_EXTERNAL
+    sggc_info.external_mem_usage = 0;
+# endif
+
+# ifdef SGGC_MEM_ACCOUNTING
+    sggc_info.seg_mem_usage = 0;
+    sggc_info.table_mem_usage = 0;
+    sggc_info.small_data_mem_usage = 0;
+    sggc_info.big_data_mem_usage = 0;
+    sggc_info.aux_mem_usage = 0;
+#   ifndef SGGC_MAX_SEGMENTS  /* count dynamically allocated tables now */
+#     ifdef SGGC_SEG_DIRECT
+        MEM_ADD (seg, MEM_SIZE (0, max_segments * sizeof *sggc_segment));
+#     else
+        MEM_ADD (table, MEM_SIZE (0, max_segments * sizeof *sggc_segment));
+#     endif
+      MEM_ADD (table, MEM_SIZE (0, max_segments * sizeof *sggc_data));
+      MEM_ADD (table, MEM_SIZE (0, max_segments * sizeof *sggc_type));
+#     ifdef SGGC_AUX1_SIZE
+        MEM_ADD (table, MEM_SIZE (0, max_segments * sizeof *sggc_aux1));
+#     endif
+#     ifdef SGGC_AUX2_SIZE
+        MEM_ADD (table, MEM_SIZE (0, max_segments * sizeof *sggc_aux2));
+#     endif
+#   endif
+# endif
+
+  soft_limit = 0;
+  soft_limit_collect = 0;
+
   sggc_info.allocations = 0;
   sggc_info.allocations_at_last_gc = 0;
 
@@ -567,67 +1076,166 @@ int sggc_init (unsigned max_segments)
 /* -------------------------------- ALLOCATION ------------------------------ */
 
 
-/* UPDATE THE POSITION TO USE NEXT IN A BLOCK OF AUXILIARY INFORMATION.
-   For big segments (with only one object), auxiliary information is
-   used sequentially for each new segment, until all of an auxiliary
-   block has been used.  For small segments (with several objects),
-   new segments are allocated successive positions for the auxiliary
-   information for the segment's first object, until a position is
-   reached where this spot is already used by the second object of a
-   previous segment, at which time the position used jumps forward
-   past all previously-used positions.  In either case, when no space 
-   is left in the auxiliary block, the block pointer is set to NULL,
-   to indicate that a new block must be allocated next time. */
+/* FIND THE ENTRY FOR THE AUXILIARY INFORMATION BLOCK CONTAINING AN ADDRESS.
+   Returns the entry with the largest block address not greater than 'p'. */
 
-static void next_aux_pos (sggc_kind_t kind, char **block, unsigned char *pos,
-                          int block_size)
-{
-  int new_pos;  /* used to avoid overflow in operations on *pos */
+#ifdef SGGC_FREE_AUX_BLOCKS
 
-  sggc_nchunks_t nch = sggc_kind_chunks[kind];
+static struct aux_block_info *aux_block_find (struct aux_block_table *t, 
+                                              char *p)
+{
+  int lo, hi;
 
-  new_pos = *pos + 1;
+  lo = 0; 
+  hi = t->n - 1;
 
-  if (nch == 0)  /* big segment */
-  { if (new_pos >= block_size * SGGC_CHUNKS_IN_SMALL_SEGMENT)
-    { *block = NULL;
-      *pos = 0;  /* though should be irrelevant */
+  while (lo < hi)
+  { int mid = (lo + hi + 1) / 2;
+    if ((uintptr_t) t->info[mid].block <= (uintptr_t) p)
+    { lo = mid;
     }
     else
-    { *pos = new_pos;
+    { hi = mid - 1;
     }
   }
-  else  /* small segment */
-  { if (*pos % nch == 0) 
-    { new_pos += nch * (kind_objects[kind] - 1);
-    }
-    if (new_pos + nch * (kind_objects[kind] - 1) 
-         >= block_size * SGGC_CHUNKS_IN_SMALL_SEGMENT)
-    { *block = NULL;
-      *pos = 0;  /* though should be irrelevant */
-    }
-    else
-    { *pos = new_pos;
-    }
+
+  if (EXTRA_CHECKS)
+  { if (t->n == 0 || (uintptr_t) t->info[lo].block > (uintptr_t) p) abort();
   }
 
+  return &t->info[lo];
 }
 
+#endif
 
-/* ALLOCATE A NEW SEGMENT.  Returns -1 if unable to allocate (reached 
-   maximum segments, or memory allocation failed).  Otherwise, returns
-   the index of the new segment, which will have been initialized, but
-   will not have its type or kind set yet (flags will all be 0). */
-
-static sbset_index_t new_segment (void)
-{
-  struct sbset_segment *seg;
 
-  if (next_segment == maximum_segments)
-  { return -1;
-  }
+/* ADD AN ENTRY FOR A NEWLY-ALLOCATED AUXILIARY INFORMATION BLOCK.  Returns
+   0 if successful, -1 if space for a larger table couldn't be allocated. */
 
-  /* Find or allocate memory for the segment structure. */
+#ifdef SGGC_FREE_AUX_BLOCKS
+
+static int aux_block_insert (struct aux_block_table *t, char *block)
+{
+  int i;
+
+  if (t->n == t->size)
+  { int new_size = t->size == 0 ? 16 : 2 * t->size;
+    struct aux_block_info *new_info;
+    new_info = sggc_mem_alloc (new_size * sizeof *new_info);
+    if (new_info == NULL)
+    { return -1;
+    }
+    if (t->n > 0)
+    { memcpy (new_info, t->info, t->n * sizeof *new_info);
+      sggc_mem_free (t->info);
+#     ifdef SGGC_MEM_ACCOUNTING
+        MEM_SUB (table, MEM_SIZE (0, t->size * sizeof *new_info));
+#     endif
+    }
+#   ifdef SGGC_MEM_ACCOUNTING
+      MEM_ADD (table, MEM_SIZE (0, new_size * sizeof *new_info));
+#   endif
+    t->info = new_info;
+    t->size = new_size;
+  }
+
+  for (i = t->n; i > 0; i--)
+  { if ((uintptr_t) t->info[i-1].block < (uintptr_t) block)
+    { break;
+    }
+    t->info[i] = t->info[i-1];
+  }
+
+  t->info[i].block = block;
+  t->info[i].users = 0;
+  t->info[i].free_users = 0;
+  t->info[i].freeable = 0;
+  t->n += 1;
+
+  return 0;
+}
+
+#endif
+
+
+/* CHECK WHETHER THE AUXILIARY INFORMATION FOR A SEGMENT HAS BEEN FREED.
+   This is indicated by its aux1 or aux2 pointer being NULL. */
+
+#ifdef SGGC_FREE_AUX_BLOCKS
+
+static inline int aux_was_freed (sbset_index_t index)
+{
+# ifdef SGGC_AUX1_SIZE
+    return sggc_aux1[index] == (sggc_dptr) NULL;
+# else
+    return sggc_aux2[index] == (sggc_dptr) NULL;
+# endif
+}
+
+#endif
+
+
+/* UPDATE THE POSITION TO USE NEXT IN A BLOCK OF AUXILIARY INFORMATION.
+   For big segments (with only one object), auxiliary information is
+   used sequentially for each new segment, until all of an auxiliary
+   block has been used.  For small segments (with several objects),
+   new segments are allocated successive positions for the auxiliary
+   information for the segment's first object, until a position is
+   reached where this spot is already used by the second object of a
+   previous segment, at which time the position used jumps forward
+   past all previously-used positions.  In either case, when no space 
+   is left in the auxiliary block, the block pointer is set to NULL,
+   to indicate that a new block must be allocated next time. */
+
+static void next_aux_pos (sggc_kind_t kind, char **block, unsigned char *pos,
+                          int block_size)
+{
+  int new_pos;  /* used to avoid overflow in operations on *pos */
+
+  sggc_nchunks_t nch = sggc_kind_chunks[kind];
+
+  new_pos = *pos + 1;
+
+  if (nch == 0)  /* big segment */
+  { if (new_pos >= block_size * SGGC_CHUNKS_IN_SMALL_SEGMENT)
+    { *block = NULL;
+      *pos = 0;  /* though should be irrelevant */
+    }
+    else
+    { *pos = new_pos;
+    }
+  }
+  else  /* small segment */
+  { if (*pos % nch == 0) 
+    { new_pos += nch * (kind_objects[kind] - 1);
+    }
+    if (new_pos + nch * (kind_objects[kind] - 1) 
+         >= block_size * SGGC_CHUNKS_IN_SMALL_SEGMENT)
+    { *block = NULL;
+      *pos = 0;  /* though should be irrelevant */
+    }
+    else
+    { *pos = new_pos;
+    }
+  }
+
+}
+
+
+/* ALLOCATE A NEW SEGMENT.  Returns -1 if unable to allocate (reached 
+   maximum segments, or memory allocation failed).  Otherwise, returns
+   the index of the new segment, which will have been initialized, but
+   will not have its type or kind set yet (flags will all be 0). */
+
+static sbset_index_t new_segment (void)
+{
+  struct sbset_segment *seg;
+
+  if (next_segment == maximum_segments)
+  { return -1;
+  }
+
+  /* Find or allocate memory for the segment structure. */
 
 # ifdef SGGC_SEG_DIRECT
     seg = sggc_segment + next_segment;
@@ -638,6 +1246,10 @@ static sbset_index_t new_segment (void)
       if (sb == NULL)
       { return -1;
       }
+#     ifdef SGGC_MEM_ACCOUNTING
+        MEM_ADD (seg, MEM_SIZE (0, SGGC_SEG_BLOCKING 
+                                     * sizeof (struct sbset_segment)));
+#     endif
       seg_block_remaining = SGGC_SEG_BLOCKING;
 
       /* Align to 64-byte boundary. */
@@ -676,23 +1288,39 @@ static sbset_index_t new_segment (void)
      Total memory usage is incremented in this way as segments are
      used regardless of whether or not the data is statically
      allocated, on the assumption that virtual memory space is not
-     allocate physical memory until used.  */
+     allocate physical memory until used.  
 
-  sggc_info.total_mem_usage += sizeof (struct sbset_segment);
+     With SGGC_MEM_ACCOUNTING defined, dynamically allocated tables 
+     (and blocks of segments) were instead counted when allocated, and 
+     the allocator's overhead is included for individually allocated 
+     segment structures. */
 
-# ifndef SGGC_SEG_DIRECT
-    sggc_info.total_mem_usage += sizeof (struct sbset_segment *);
+# if defined(SGGC_SEG_DIRECT)
+#   if !defined(SGGC_MEM_ACCOUNTING) || defined(SGGC_MAX_SEGMENTS)
+      MEM_ADD (seg, sizeof (struct sbset_segment));
+#   endif
+# elif !defined(SGGC_MEM_ACCOUNTING) || !(SGGC_SEG_BLOCKING > 1)
+    MEM_ADD (seg, MEM_SIZE (sizeof (struct sbset_segment), 
+                            sizeof (struct sbset_segment)));
 # endif
 
-  sggc_info.total_mem_usage += sizeof (char *);
-# ifdef SGGC_AUX1_SIZE
-    sggc_info.total_mem_usage += sizeof (char *);
-# endif
-# ifdef SGGC_AUX2_SIZE
-    sggc_info.total_mem_usage += sizeof (char *);
-# endif
+# if !defined(SGGC_MEM_ACCOUNTING) || defined(SGGC_MAX_SEGMENTS)
+
+#   ifndef SGGC_SEG_DIRECT
+      MEM_ADD (table, sizeof (struct sbset_segment *));
+#   endif
+
+    MEM_ADD (table, sizeof (char *));
+#   ifdef SGGC_AUX1_SIZE
+      MEM_ADD (table, sizeof (char *));
+#   endif
+#   ifdef SGGC_AUX2_SIZE
+      MEM_ADD (table, sizeof (char *));
+#   endif
 
-  sggc_info.total_mem_usage += sizeof (sggc_type_t);
+    MEM_ADD (table, sizeof (sggc_type_t));
+
+# endif
 
   sggc_info.n_segments += 1;
 
@@ -723,6 +1351,14 @@ static void get_small_data_area (void)
     if (small_data_area_next == NULL)
     { return;
     }
+#   if defined(SGGC_MEM_ACCOUNTING) && SGGC_SMALL_DATA_AREA_ALIGN
+      MEM_ADD (small_data, MEM_SIZE (0, 
+                SMALL_DATA_AREA_SIZE*SGGC_SMALL_DATA_AREA_BLOCKING
+                 + SGGC_SMALL_DATA_AREA_ALIGN - 1));
+#   elif defined(SGGC_MEM_ACCOUNTING)
+      MEM_ADD (small_data, MEM_SIZE (0, 
+                SMALL_DATA_AREA_SIZE*SGGC_SMALL_DATA_AREA_BLOCKING));
+#   endif
 #   if SGGC_SMALL_DATA_AREA_ALIGN
       small_data_area_next = (char *) 
        (((uintptr_t)small_data_area_next + SGGC_SMALL_DATA_AREA_ALIGN - 1) 
@@ -736,119 +1372,33 @@ static void get_small_data_area (void)
 }
 
 
-/* ALLOCATE AN OBJECT OF SPECIFIED KIND, TYPE, AND LENGTH.  The length
-   is used only for big kinds. The value returned is SGGC_NO_OBJECT if
-   allocation fails (but note that it might succeed if retried after
-   garbage collection is done), or if the number of chunks required 
-   is greater than can be stored in alloc_chunks.
-
-   Used to implement sggc_alloc, sggc_alloc_kind, and sggc_alloc_small_kind. 
-
-   Uses sggc_alloc_small_kind_quickly when possible. */
+/* CHECK WHETHER ALLOCATING MORE MEMORY WOULD EXCEED THE SOFT LIMIT.  
+   Records in soft_limit_reached that the limit was reached, if so. */
 
-static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind, 
-                                                sggc_type_t type,
-                                                sggc_length_t length)
+static int over_soft_limit (size_t n)
 {
-  int big;                   /* will object go in a big segment? */
-
-  sggc_nchunks_t nch = sggc_kind_chunks[kind]; /* number of chunks for object */
-
-  char *data;                /* pointer to data area for segment used */
-  size_t data_size = 0;      /* size of data area, if allocated here, else 0 */
-  int align_offset = 0;      /* offset added to data to make it aligned */
-
-  sbset_index_t index;       /* index of segment that object will be in */
-  struct sbset_segment *seg; /* ptr to struct for seg object goes in */
-  sggc_cptr_t v;             /* pointer to object to be returned as value */
-
-  /* Look for an existing segment for this object to go in.  For a
-     small segment, just call sggc_alloc_small_kind_quickly, and
-     return the result directly if it succeeds.  For a big segment,
-     take a segment from 'unused', if one is there.  For a big
-     segment, or if no existing small segment is found, allocate the
-     data area for the (big or small) segment.  Return with failure
-     indication if this allocation fails. */
-
-  if (nch == 0) /* big segment */
-  { 
-    v = sbset_first (&unused, 1); /* since removed with sbset_first, will be */
-                                  /*   OK to later add it to free_or_new[k]  */
-    if (v != SGGC_NO_OBJECT)
-    { if (SGGC_DEBUG) printf("sggc_alloc: found %x in unused\n",(unsigned)v);
-      index = SBSET_VAL_INDEX(v);
-      seg = SBSET_SEGMENT(index);
-      sggc_type[index] = type;  /* may reuse big segments of other types */
-      seg->X.Big.kind = kind; 
-    }
-
-    nch = sggc_nchunks (type, length);
-
-    /* Increase nch if necesary for huge objects so it can be shifted to fit. */
-
-    if (nch >= HUGE_CHUNKS)
-    { nch = ((nch + (1<<SGGC_HUGE_SHIFT) - 1) >> SGGC_HUGE_SHIFT) 
-                                              << SGGC_HUGE_SHIFT;
-      if ((nch >> SGGC_HUGE_SHIFT) >= HUGE_CHUNKS) 
-      { return SGGC_NO_OBJECT;
-      }
-    }
-
-    data_size = (size_t) SGGC_CHUNK_SIZE * nch;
-#   if !defined(SGGC_DATA_ALIGNMENT) || SGGC_DATA_ALIGNMENT <= 8
-      data = sggc_mem_alloc_data (data_size);
-#   else
-    { char *d = sggc_mem_alloc_data (data_size + SGGC_DATA_ALIGNMENT - 1);
-      data = (char *) (((uintptr_t)d + SGGC_DATA_ALIGNMENT - 1) 
-                          & ~ ((uintptr_t)SGGC_DATA_ALIGNMENT - 1));
-      align_offset = data - d;
-    }
-#   endif
+  size_t usage = sggc_info.total_mem_usage;
 
-    if (SGGC_DEBUG) 
-    { printf (
-       "sggc_alloc: called mem_alloc_data for data (big %d, %d chunks):: %p\n", 
-        kind, (int)nch, data);
-#     if defined(SGGC_DATA_ALIGNMENT)
-        printf ("sggc_alloc: alignment offset of %d was added\n",align_offset);
-#     endif
-    }
+# ifdef SGGC_EXTERNAL
+    usage += sggc_info.external_mem_usage;
+# endif
 
-    big = 1;
+  if (soft_limit != 0 && usage + n > soft_limit)
+  { soft_limit_reached = 1;
+    return 1;
   }
 
-  else /* small segment */
-  {
-    v = sggc_alloc_small_kind_quickly(kind);
-    if (v != SGGC_NO_OBJECT)
-    { if (SGGC_DEBUG)
-      { printf("sggc_alloc: found %x in next_free\n",(unsigned)v);
-        printf("sggc_alloc: next_free_val[%d]=%x, next_free_bits[%d]=%016llx\n",
-                kind, sggc_next_free_val[kind], 
-                kind, (unsigned long long) sggc_next_free_bits[kind]);
-      }
-      return v;
-    }
-
-    get_small_data_area();
-    data_size = SMALL_DATA_AREA_SIZE;
-    data = small_data_area_next - SMALL_DATA_AREA_SIZE;
-
-    big = 0;
-  }
+  return 0;
+}
 
-  if (data == NULL) 
-  { return SGGC_NO_OBJECT;
-  }
 
-  /* Make sure we have blocks of auxiliary information 1 and 2 available 
-     (if required), in case we need them (though we may not).  Return
-     SGGC_NO_OBJECT if we can't allocate these blocks (freeing data
-     if it was allocated).  Trying to allocate them now avoids the need to 
-     back out later operations if the allocation fails, and is not really
-     a waste since the amount allocated should be small, and will be
-     needed sooner or later, even if not now. */
+/* MAKE SURE BLOCKS OF AUXILIARY INFORMATION ARE AVAILABLE FOR A KIND.
+   Allocates new blocks of auxiliary information 1 and 2 for the kind,
+   if required and not already available.  Returns 0 if successful, and
+   -1 if allocating a block failed. */
 
+static int get_aux_blocks (sggc_kind_t kind)
+{
 # ifdef SGGC_AUX1_SIZE
     char *const read_only_aux1 = 
 #     ifdef SGGC_AUX1_READ_ONLY
@@ -861,10 +1411,19 @@ static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind,
                                (SGGC_CHUNKS_IN_SMALL_SEGMENT
                                  * SGGC_AUX1_BLOCK_SIZE * SGGC_AUX1_SIZE);
       if (kind_aux1_block[kind] == NULL) 
-      { goto fail;
+      { return -1;
       }
-      sggc_info.total_mem_usage += SGGC_CHUNKS_IN_SMALL_SEGMENT
-                                    * SGGC_AUX1_BLOCK_SIZE * SGGC_AUX1_SIZE;
+#     ifdef SGGC_FREE_AUX_BLOCKS
+        if (aux_block_insert (&aux1_blocks, kind_aux1_block[kind]) < 0)
+        { sggc_mem_free (kind_aux1_block[kind]);
+          kind_aux1_block[kind] = NULL;
+          return -1;
+        }
+#     endif
+      MEM_ADD (aux, MEM_SIZE (AUX_BLOCK_BYTES (SGGC_AUX1_SIZE, 
+                                               SGGC_AUX1_BLOCK_SIZE),
+                              AUX_BLOCK_BYTES (SGGC_AUX1_SIZE,
+                                               SGGC_AUX1_BLOCK_SIZE)));
       kind_aux1_block_pos[kind] = 0;
       if (SGGC_DEBUG)
       { printf(
@@ -886,10 +1445,19 @@ static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind,
                                (SGGC_CHUNKS_IN_SMALL_SEGMENT
                                  * SGGC_AUX2_BLOCK_SIZE * SGGC_AUX2_SIZE);
       if (kind_aux2_block[kind] == NULL) 
-      { goto fail;
+      { return -1;
       }
-      sggc_info.total_mem_usage += SGGC_CHUNKS_IN_SMALL_SEGMENT
-                                    * SGGC_AUX2_BLOCK_SIZE * SGGC_AUX2_SIZE;
+#     ifdef SGGC_FREE_AUX_BLOCKS
+        if (aux_block_insert (&aux2_blocks, kind_aux2_block[kind]) < 0)
+        { sggc_mem_free (kind_aux2_block[kind]);
+          kind_aux2_block[kind] = NULL;
+          return -1;
+        }
+#     endif
+      MEM_ADD (aux, MEM_SIZE (AUX_BLOCK_BYTES (SGGC_AUX2_SIZE, 
+                                               SGGC_AUX2_BLOCK_SIZE),
+                              AUX_BLOCK_BYTES (SGGC_AUX2_SIZE,
+                                               SGGC_AUX2_BLOCK_SIZE)));
       kind_aux2_block_pos[kind] = 0;
       if (SGGC_DEBUG)
       { printf(
@@ -899,102 +1467,52 @@ static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind,
     }
 # endif
 
-  /* Try to create a new segment for this object, if none found above. */
-
-  sggc_cptr_t u = v;  /* to remember whether it wasn't allocated before */
+  return 0;
+}
 
-  if (v == SGGC_NO_OBJECT)  /* new segment, big or small */
-  { 
-    index = new_segment();
-    if (index < 0)
-    { goto fail;
-    }
 
-    sggc_type[index] = type;
-    seg = SBSET_SEGMENT(index);
-    seg->X.Big.big = big;
-    seg->X.Big.kind = kind;  /* small.kind and big.kind are the same place */
+/* ASSIGN AUXILIARY INFORMATION FOR A NEW SEGMENT.  Space must have been
+   made available previously with get_aux_blocks.  The cptr v is used
+   only for debug output. */
 
-    v = SGGC_CPTR_VAL(index,0);
-    if (SGGC_DEBUG) 
-    { printf("sggc_alloc: created %x in new segment\n", (unsigned)v);
-    }
-  }
+static void assign_aux (sggc_kind_t kind, sbset_index_t index,
+                        struct sbset_segment *seg, sggc_cptr_t v, int big)
+{
+# if defined(SGGC_AUX1_SIZE) && defined(SGGC_AUX1_READ_ONLY)
+    char *const read_only_aux1 = kind_aux1_read_only[kind];
+# endif
+# if defined(SGGC_AUX2_SIZE) && defined(SGGC_AUX2_READ_ONLY)
+    char *const read_only_aux2 = kind_aux2_read_only[kind];
+# endif
 
-  /* Add the object to 'uncollected[kind]' or 'free_or_new[kind]', now
-     that we know there won't be a failure. */
-
-#ifdef SGGC_KIND_UNCOLLECTED
-  if (sggc_kind_uncollected[kind])
-  { sbset_add (&uncollected[kind], v);
-    sggc_info.uncol_count += 1;
-  }
-  else
-#endif
-  { sbset_add (&free_or_new[kind], v);
-    sggc_info.gen0_count += 1;
-  }
-
-  /* For new small segments, put all other objects in the new segment
-     into free_or_new (unless uncollected), and use them as the
-     current set of free objects, since there were none before. */
-
-  if (u == SGGC_NO_OBJECT && !big)  /* new small segment */
-  { 
-#ifdef SGGC_KIND_UNCOLLECTED
-    if (!sggc_kind_uncollected[kind])
-#endif
-    { sbset_assign_segment_bits (&free_or_new[kind], v, kind_full[kind]);
-      if (SGGC_DEBUG)
-      { printf(
-         "sggc_alloc: new segment has bits %016llx, %d in free_or_new[%d]\n", 
-         (unsigned long long) sbset_chain_segment_bits (SGGC_UNUSED_FREE_NEW,v),
-         sbset_n_elements(&free_or_new[kind]), kind);
-      }
-    }
-
-    sggc_next_free_bits[kind] = kind_full[kind] >> sggc_kind_chunks[kind];
-    sggc_next_free_val[kind] = sggc_next_free_bits[kind] == 0 
-                                  ? SGGC_NO_OBJECT : v + sggc_kind_chunks[kind];
-    sggc_next_segment_not_free[kind] = 1;
-
-    if (SGGC_DEBUG)
-    { printf("sggc_alloc: next_free_val[%d]=%x, next_free_bits[%d]=%016llx\n",
-              kind, sggc_next_free_val[kind], 
-              kind, (unsigned long long) sggc_next_free_bits[kind]);
-    }
-  }
-
-  /* For new segments (big or small), assign auxiliary information
-     We've previously guaranteed that auxiliary space is available. */
-
-  if (u == SGGC_NO_OBJECT)
-  {
-#   ifdef SGGC_AUX1_SIZE
-#     ifdef SGGC_AUX1_READ_ONLY
-      if (read_only_aux1)
-      { sggc_aux1[index] = (sggc_dptr) read_only_aux1;
-        if (SGGC_DEBUG)
-        { printf("sggc_alloc: used read-only aux1 for %x\n", v);
-        }
-      }
-      else
-#     endif
-      { sggc_aux1[index] = (sggc_dptr) (kind_aux1_block[kind] 
-                             + kind_aux1_block_pos[kind] * SGGC_AUX1_SIZE);
-        if (0 && !big) /* could be enabled if aux1_off were ever actually used*/
-        { seg->X.Small.aux1_off = kind_aux1_block_pos[kind];
-        }
-        if (SGGC_DEBUG)
-        { printf(
-            "sggc_alloc: aux1 block for %x has pos %d in block for kind %d\n",
-             v, kind_aux1_block_pos[kind], kind);
-        }
-        next_aux_pos (kind, &kind_aux1_block[kind], &kind_aux1_block_pos[kind],
-                      SGGC_AUX1_BLOCK_SIZE);
-      }
-      OFFSET(sggc_aux1,index,SGGC_AUX1_SIZE);
-#   endif
+#   ifdef SGGC_AUX1_SIZE
+#     ifdef SGGC_AUX1_READ_ONLY
+      if (read_only_aux1)
+      { sggc_aux1[index] = (sggc_dptr) read_only_aux1;
+        if (SGGC_DEBUG)
+        { printf("sggc_alloc: used read-only aux1 for %x\n", (unsigned) v);
+        }
+      }
+      else
+#     endif
+      { sggc_aux1[index] = (sggc_dptr) (kind_aux1_block[kind] 
+                             + kind_aux1_block_pos[kind] * SGGC_AUX1_SIZE);
+        if (AUX_OFF_USED && !big) /* aux1_off is used only to free aux blocks */
+        { seg->X.Small.aux1_off = kind_aux1_block_pos[kind];
+        }
+#       ifdef SGGC_FREE_AUX_BLOCKS
+          aux_block_find (&aux1_blocks, kind_aux1_block[kind]) -> users += 1;
+#       endif
+        if (SGGC_DEBUG)
+        { printf(
+            "sggc_alloc: aux1 block for %x has pos %d in block for kind %d\n",
+             (unsigned) v, kind_aux1_block_pos[kind], kind);
+        }
+        next_aux_pos (kind, &kind_aux1_block[kind], &kind_aux1_block_pos[kind],
+                      SGGC_AUX1_BLOCK_SIZE);
+      }
+      OFFSET(sggc_aux1,index,SGGC_AUX1_SIZE);
+#   endif
 
 #   ifdef SGGC_AUX2_SIZE
 #     ifdef SGGC_AUX2_READ_ONLY
@@ -1008,9 +1526,12 @@ static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind,
 #     endif
       { sggc_aux2[index] = (sggc_dptr) (kind_aux2_block[kind] 
                              + kind_aux2_block_pos[kind] * SGGC_AUX2_SIZE);
-        if (0 && !big) /* could be enabled if aux2_off were ever actually used*/
+        if (AUX_OFF_USED && !big) /* aux2_off is used only to free aux blocks */
         { seg->X.Small.aux2_off = kind_aux2_block_pos[kind];
         }
+#       ifdef SGGC_FREE_AUX_BLOCKS
+          aux_block_find (&aux2_blocks, kind_aux2_block[kind]) -> users += 1;
+#       endif
         if (SGGC_DEBUG)
         { printf(
             "sggc_alloc: aux2 block for %x has pos %d in block for kind %d\n",
@@ -1021,572 +1542,1735 @@ static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind,
       }
       OFFSET(sggc_aux2,index,SGGC_AUX2_SIZE);
 #   endif
-  }
-
-  if (EXTRA_CHECKS)
-  { if (sbset_contains (&old_to_new, v)) abort();
-    if (sbset_contains (&to_look_at, v)) abort();
-  }
-
-  /* Set up the data pointer for the segment. */
-
-  if (big)
-  { if (nch < HUGE_CHUNKS)
-    { seg->X.Big.alloc_chunks = nch;
-      seg->X.Big.huge = 0;
-    }
-    else
-    { seg->X.Big.alloc_chunks = nch >> SGGC_HUGE_SHIFT;
-      seg->X.Big.huge = 1;
-    }
-    seg->X.Big.align_off = align_offset >> 3;
-#ifdef SGGC_KIND_UNCOLLECTED
-    if (sggc_kind_uncollected[kind])
-    { sggc_info.uncol_big_chunks += nch;
-    }
-    else
-#endif
-    { sggc_info.gen0_big_chunks += nch;
-    }
-  }
+}
 
-  sggc_data[index] = (sggc_dptr) data;
-  sggc_info.total_mem_usage += data_size;  /* will be 0 if not allocated here */
 
-  OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
+/* ALLOCATE AND FREE DATA AREAS FOR MEDIUM-SIZED BIG OBJECTS.  The number
+   of chunks is increased to the size of its class when allocating.  A
+   new region is allocated when the current one for the class has no
+   room, with the rest of the old region left unused.  Regions are never
+   freed, but free slots are reused for objects of the same class.  The
+   soft limit is checked only when allocating a new region, since using
+   space in a region already allocated doesn't change memory usage. */
 
-  /* Update allocation counts. */
+#ifdef SGGC_MEDIUM_OBJECTS
 
-  sggc_info.allocations += 1;
+static int medium_class (sggc_nchunks_t nch)
+{
+  int c;
 
-# ifdef SGGC_TRACE_CPTR
-    if (v == sggc_trace_cptr)
-    { sggc_trace_cptr_count += 1;
-      if (sggc_trace_cptr_in_use) abort();
-      sggc_trace_cptr_in_use = 1;
-      if (sggc_trace_cptr_count == sggc_trace_alloc_trap)
-      { if (SGGC_DEBUG) 
-        { printf(
-           "sggc_alloc_kind_type_length: abort on alloc %d of traced cptr %x\n",
-            sggc_trace_cptr_count, sggc_trace_cptr);
-        }
-        abort();
-      }
-    }
-# endif
+  for (c = 0; medium_chunks[c] < nch; c++) ;
 
-  /* Return newly allocated object. */
+  return c;
+}
 
-  return v;
+static char *medium_alloc (sggc_nchunks_t *nch)
+{
+  int c = medium_class (*nch);
+  size_t size = (size_t) SGGC_CHUNK_SIZE * medium_chunks[c];
+  char *p;
 
-fail: 
+  *nch = medium_chunks[c];
 
-  /* Some allocation failed.  Return SGGC_NO_OBJECT, after freeing 'data', 
-     and for a big segment, putting it back in 'unused'. */
+  p = medium_free[c];
+  if (p != NULL)
+  { medium_free[c] = * (char **) p;
+#   ifdef SGGC_DATA_ALLOC_ZERO
+      memset (p, 0, size);
+#   endif
+    return p;
+  }
 
-  if (big)
-  { if (v != SGGC_NO_OBJECT) 
-    { sbset_add (&unused, v);
+  if ((size_t) (medium_end[c] - medium_next[c]) < size)
+  { char *r;
+    if (over_soft_limit (SGGC_MEDIUM_REGION))
+    { return NULL;
     }
-    sggc_mem_free (data - align_offset);
-  }
-  else
-  { small_data_area_next -= SMALL_DATA_AREA_SIZE;
+    r = sggc_mem_alloc_data (SGGC_MEDIUM_REGION + BIG_ALIGN_EXTRA);
+    if (r == NULL)
+    { return NULL;
+    }
+    MEM_ADD (big_data, MEM_SIZE (SGGC_MEDIUM_REGION, 
+                                 SGGC_MEDIUM_REGION + BIG_ALIGN_EXTRA));
+#   if BIG_ALIGN_EXTRA > 0
+      r = (char *) (((uintptr_t)r + SGGC_DATA_ALIGNMENT - 1) 
+                      & ~ ((uintptr_t)SGGC_DATA_ALIGNMENT - 1));
+#   endif
+    if (SGGC_DEBUG) 
+    { printf ("sggc_alloc: new region for medium objects of %d chunks:: %p\n",
+               (int) *nch, r);
+    }
+    medium_next[c] = r;
+    medium_end[c] = r + SGGC_MEDIUM_REGION;
   }
 
-  return SGGC_NO_OBJECT;
-}
-
-
-/* ALLOCATE AN OBJECT WITH GIVEN TYPE AND LENGTH. */
-
-sggc_cptr_t sggc_alloc (sggc_type_t type, sggc_length_t length)
-{
-  sggc_kind_t kind = sggc_kind(type,length);
-
-  if (SGGC_DEBUG) 
-  { printf("sggc_alloc: type %u, length %u, kind %d\n",
-            (unsigned) type, (unsigned) length, (int) kind);
-  }
+  p = medium_next[c];
+  medium_next[c] += size;
 
-  return sggc_alloc_kind_type_length (kind, type, length);
+  return p;
 }
 
-
-/* ALLOCATE AN OBJECT WITH GIVEN KIND AND LENGTH.  
-  
-   Not defined if the application did not provide SGGC_KIND_TYPES. */
-
-#ifdef SGGC_KIND_TYPES
-
-sggc_cptr_t sggc_alloc_kind (sggc_kind_t kind, sggc_length_t length)
+static void medium_free_data (char *p, sggc_nchunks_t nch)
 {
-  if (SGGC_DEBUG) 
-  { printf("sggc_alloc_kind: kind %d (type %u), length %u\n", 
-            (int) kind, (unsigned) sggc_kind_types[kind], (unsigned) length);
-  }
+  int c = medium_class (nch);
 
-  return sggc_alloc_kind_type_length (kind, sggc_kind_types[kind], length);
+  * (char **) p = medium_free[c];
+  medium_free[c] = p;
 }
 
 #endif
 
 
-/* ALLOCATE AN OBJECT WITH GIVEN KIND, WHICH MUST BE FOR A SMALL SEGMENT. 
+/* ALLOCATE AN OBJECT OF SPECIFIED KIND, TYPE, AND LENGTH.  The length
+   is used only for big kinds. The value returned is SGGC_NO_OBJECT if
+   allocation fails (but note that it might succeed if retried after
+   garbage collection is done), or if the number of chunks required 
+   is greater than can be stored in alloc_chunks, or if memory for a
+   new data area would take memory usage over the soft limit.
 
-   Not defined if the application did not provide SGGC_KIND_TYPES. */
+   If given_data is not NULL, the object must be of a big kind, and
+   given_data is used as its data area, rather than allocating one.
 
-#ifdef SGGC_KIND_TYPES
+   Used to implement sggc_alloc_kind_type_length, sggc_alloc_mapped, 
+   and sggc_alloc_external, below.
 
-sggc_cptr_t sggc_alloc_small_kind (sggc_kind_t kind)
+   Uses sggc_alloc_small_kind_quickly when possible. */
+
+static sggc_cptr_t alloc_kind_type_length (sggc_kind_t kind, 
+                                           sggc_type_t type,
+                                           sggc_length_t length,
+                                           char *given_data)
 {
-  if (SGGC_DEBUG) 
-  { printf("sggc_alloc_small_kind: kind %d (type %u)\n", 
-            (int) kind, (unsigned) sggc_kind_types[kind]);
-  }
+  int big;                   /* will object go in a big segment? */
 
-  return sggc_alloc_kind_type_length (kind, sggc_kind_types[kind], 0);
-}
+  sggc_nchunks_t nch = sggc_kind_chunks[kind]; /* number of chunks for object */
 
-#endif
+  char *data;                /* pointer to data area for segment used */
+  size_t data_size = 0;      /* size of data area, if allocated here, else 0 */
+  int align_offset = 0;      /* offset added to data to make it aligned */
 
+  /* index and seg are set whenever used, but are initialized to keep
+     compilers from warning that they may be used uninitialized. */
 
-/* RETURN ACTUAL NUMBER OF CHUNKS IN DATA AREA OF AN OBJECT. */
+  sbset_index_t index = 0;          /* index of segment object will be in */
+  struct sbset_segment *seg = NULL; /* ptr to struct for seg object goes in */
+  sggc_cptr_t v;                    /* pointer to object to return as value */
 
-sggc_nchunks_t sggc_nchunks_allocated (sggc_cptr_t object)
-{
-  sggc_kind_t kind = SGGC_KIND(object);
+  /* Look for an existing segment for this object to go in.  For a
+     small segment, just call sggc_alloc_small_kind_quickly, and
+     return the result directly if it succeeds.  For a big segment,
+     take a segment from 'unused', if one is there.  For a big
+     segment, or if no existing small segment is found, allocate the
+     data area for the (big or small) segment.  Return with failure
+     indication if this allocation fails. */
 
-  return sggc_kind_chunks[kind] != 0 ? sggc_kind_chunks[kind]    /* small seg */
-   : CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(object)));   /* big seg */
-}
+  if (nch == 0) /* big segment */
+  { 
+    v = sbset_first (&unused, 1); /* since removed with sbset_first, will be */
+                                  /*   OK to later add it to free_or_new[k]  */
+    if (v != SGGC_NO_OBJECT)
+    { if (SGGC_DEBUG) printf("sggc_alloc: found %x in unused\n",(unsigned)v);
+      index = SBSET_VAL_INDEX(v);
+      seg = SBSET_SEGMENT(index);
+      sggc_type[index] = type;  /* may reuse big segments of other types */
+      seg->X.Big.kind = kind; 
+    }
 
+    nch = sggc_nchunks (type, length);
 
-/* REGISTER A CONSTANT SEGMENT. */
+    /* Increase nch if necesary for huge objects so it can be shifted to fit. */
 
-sggc_cptr_t sggc_constant (sggc_type_t type, sggc_kind_t kind, int n_objects,
-                           char *data
-#ifdef SGGC_AUX1_SIZE
-                         , char *aux1
-#endif
-#ifdef SGGC_AUX2_SIZE
-                         , char *aux2
-#endif
-)
-{
-  sbset_bits_t bits;
-  int i;
+    if (nch >= HUGE_CHUNKS)
+    { nch = HUGE_ROUND (nch);
+      if ((nch >> SGGC_HUGE_SHIFT) >= HUGE_CHUNKS) 
+      { return SGGC_NO_OBJECT;
+      }
+    }
 
-  if (n_objects < 1) abort();          /* must be at least one object */
-  if (n_objects > kind_objects[kind]) abort(); /* too many objects */
+#   if defined(SGGC_MAPPED) || defined(SGGC_EXTERNAL)
+    if (given_data != NULL)  /* data_size stays 0, since counted apart */
+    { data = given_data;
+    }
+    else
+#   endif
+#   ifdef SGGC_MEDIUM_OBJECTS
+    if (nch <= MEDIUM_MAX_CHUNKS)  /* data_size stays 0, since memory is */
+    { data = medium_alloc (&nch);  /*   counted when region is allocated */
+      if (data == NULL && v != SGGC_NO_OBJECT)
+      { sbset_add (&unused, v);
+        return SGGC_NO_OBJECT;
+      }
+    }
+    else
+#   endif
+  { 
+    data_size = (size_t) SGGC_CHUNK_SIZE * nch;
 
-  bits = 0;
-  for (i = 0; i < n_objects; i++)
-  { bits |= (sbset_bits_t)1 << (i*sggc_kind_chunks[kind]);
-  }
+    if (over_soft_limit (data_size))
+    { if (v != SGGC_NO_OBJECT)
+      { sbset_add (&unused, v);
+      }
+      return SGGC_NO_OBJECT;
+    }
 
-  sbset_index_t index = new_segment();
-  if (index < 0)
-  { return SGGC_NO_OBJECT;
+#   if !defined(SGGC_DATA_ALIGNMENT) || SGGC_DATA_ALIGNMENT <= 8
+      data = sggc_mem_alloc_data (data_size);
+#   else
+    { char *d = sggc_mem_alloc_data (data_size + SGGC_DATA_ALIGNMENT - 1);
+      data = (char *) (((uintptr_t)d + SGGC_DATA_ALIGNMENT - 1) 
+                          & ~ ((uintptr_t)SGGC_DATA_ALIGNMENT - 1));
+      align_offset = data - d;
+    }
+#   endif
   }
 
-  struct sbset_segment *seg = SBSET_SEGMENT(index);
-  sggc_cptr_t v = SGGC_CPTR_VAL(index,0);
+    if (SGGC_DEBUG) 
+    { printf (
+       "sggc_alloc: called mem_alloc_data for data (big %d, %d chunks):: %p\n", 
+        kind, (int)nch, data);
+#     if defined(SGGC_DATA_ALIGNMENT)
+        printf ("sggc_alloc: alignment offset of %d was added\n",align_offset);
+#     endif
+    }
 
-  /* The seg->X.Small fields below coincide with the seg->X.Big fields. */
+    big = 1;
+  }
 
-  seg->X.Small.big = sggc_kind_chunks[kind] == 0;
-  seg->X.Small.constant = 1;
-  seg->X.Small.kind = kind;
+  else /* small segment */
+  {
+    v = sggc_alloc_small_kind_quickly(kind);
+    if (v != SGGC_NO_OBJECT)
+    { if (SGGC_DEBUG)
+      { printf("sggc_alloc: found %x in next_free\n",(unsigned)v);
+        printf("sggc_alloc: next_free_val[%d]=%x, next_free_bits[%d]=%016llx\n",
+                kind, (unsigned) sggc_next_free_val[kind], 
+                kind, (unsigned long long) sggc_next_free_bits[kind]);
+      }
+      return v;
+    }
 
-  sbset_add (&constants, v);
-  sbset_assign_segment_bits (&constants, v, bits);
+#   ifdef SGGC_FREE_AUX_BLOCKS
+      if (sbset_n_elements (&aux_freed[kind]) != 0) /* reuse segment and its */
+      { sggc_cptr_t w = sbset_first (&aux_freed[kind], 0);    /* data area */
+        data = WITHOUT_OFFSET (sggc_data, SBSET_VAL_INDEX(w), SGGC_CHUNK_SIZE);
+      }
+      else
+#   endif
+    { if (over_soft_limit (SMALL_DATA_AREA_SIZE))
+      { return SGGC_NO_OBJECT;
+      }
+      get_small_data_area();
+      data_size = SMALL_DATA_AREA_SIZE;
+      data = small_data_area_next - SMALL_DATA_AREA_SIZE;
+    }
 
-  sggc_type[index] = type;
+    big = 0;
+  }
 
-  sggc_data[index] = (sggc_dptr) data;
-  OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
+  if (data == NULL) 
+  { return SGGC_NO_OBJECT;
+  }
 
-# ifdef SGGC_AUX1_SIZE
-    sggc_aux1[index] = (sggc_dptr) aux1;
-    OFFSET(sggc_aux1,index,SGGC_AUX1_SIZE);
-    seg->X.Small.aux1_off = 0;
-# endif
+  /* Make sure we have blocks of auxiliary information 1 and 2 available 
+     (if required), in case we need them (though we may not).  Return
+     SGGC_NO_OBJECT if we can't allocate these blocks (freeing data
+     if it was allocated).  Trying to allocate them now avoids the need to 
+     back out later operations if the allocation fails, and is not really
+     a waste since the amount allocated should be small, and will be
+     needed sooner or later, even if not now. */
 
-# ifdef SGGC_AUX2_SIZE
-    sggc_aux2[index] = (sggc_dptr) aux2;
-    OFFSET(sggc_aux2,index,SGGC_AUX2_SIZE);
-    seg->X.Small.aux2_off = 0;
-# endif
-    
-  if (SGGC_DEBUG) 
-  { printf("sggc_constant: first object in segment is %x\n", (unsigned)v);
+  if (get_aux_blocks (kind) < 0)
+  { goto fail;
   }
 
-  return v;
-}
+  /* Try to create a new segment for this object, if none found above. */
 
+  sggc_cptr_t u = v;  /* to remember whether it wasn't allocated before */
 
-/* ---------------------------- GARBAGE COLLECTION -------------------------- */
+# ifdef SGGC_FREE_AUX_BLOCKS
+    if (big && v != SGGC_NO_OBJECT && aux_was_freed(index))
+    { u = SGGC_NO_OBJECT; /* segment from 'unused' needs new aux info */
+    }
+# endif
 
+  if (v == SGGC_NO_OBJECT)  /* new segment, big or small */
+  { 
+#   ifdef SGGC_FREE_AUX_BLOCKS
+      if (!big && sbset_n_elements (&aux_freed[kind]) != 0)
+      { 
+        /* Reuse a segment of this kind whose auxiliary information was
+           freed.  It is put back in free_or_new[kind] with no elements,
+           so that it is treated below like a new segment. */
+
+        v = sbset_first (&aux_freed[kind], 0);
+        sbset_move_first (&aux_freed[kind], &free_or_new[kind]);
+        sbset_assign_segment_bits (&free_or_new[kind], v, 0);
+        index = SBSET_VAL_INDEX(v);
+        seg = SBSET_SEGMENT(index);
+        sggc_type[index] = type;
+        if (SGGC_DEBUG) 
+        { printf("sggc_alloc: reused %x from aux_freed\n", (unsigned)v);
+        }
+      }
+      else
+#   endif
+    { index = new_segment();
+      if (index < 0)
+      { goto fail;
+      }
 
-/* PRINT DEBUG INFORMATION FOR GARBAGE COLLECTION. */
+      sggc_type[index] = type;
+      seg = SBSET_SEGMENT(index);
+      seg->X.Big.big = big;
+      seg->X.Big.kind = kind;  /* small.kind and big.kind are the same place */
 
-static void collect_debug (void)
-{ 
-  int k;
+      v = SGGC_CPTR_VAL(index,0);
+      if (SGGC_DEBUG) 
+      { printf("sggc_alloc: created %x in new segment\n", (unsigned)v);
+      }
+    }
+  }
 
-  printf(
-  "  unused: %d, old_to_new: %d, to_look_at: %d, constants: %d\n",
-       sbset_n_elements(&unused), 
-       sbset_n_elements(&old_to_new),
-       sbset_n_elements(&to_look_at),
-       sbset_n_elements(&constants));
+  /* Add the object to 'uncollected[kind]' or 'free_or_new[kind]', now
+     that we know there won't be a failure. */
 
-  printf("    old gen 1");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" [%d]: %3d ",k,sbset_n_elements(&old_gen1[k]));
+#ifdef SGGC_KIND_UNCOLLECTED
+  if (sggc_kind_uncollected[kind])
+  { sbset_add (&uncollected[kind], v);
+    sggc_info.uncol_count += 1;
   }
-  printf(" big: %3d ",sbset_n_elements(&old_gen1_big));
-  printf("\n");
-
-  printf("    old gen 2");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" [%d]: %3d ",k,sbset_n_elements(&old_gen2[k]));
+  else
+#endif
+  { sbset_add (&free_or_new[kind], v);
+    sggc_info.gen0_count += 1;
   }
-  printf(" big: %3d ",sbset_n_elements(&old_gen2_big));
-  printf("\n");
 
+  /* For new small segments, put all other objects in the new segment
+     into free_or_new (unless uncollected), and use them as the
+     current set of free objects, since there were none before. */
+
+  if (u == SGGC_NO_OBJECT && !big)  /* new small segment */
+  { 
 #ifdef SGGC_KIND_UNCOLLECTED
-  printf("  uncollected");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" [%d]: %3d ",k,sbset_n_elements(&uncollected[k]));
-  }
-  printf("\n");
+    if (!sggc_kind_uncollected[kind])
 #endif
+    { sbset_assign_segment_bits (&free_or_new[kind], v, kind_full[kind]);
+      if (SGGC_DEBUG)
+      { printf(
+         "sggc_alloc: new segment has bits %016llx, %d in free_or_new[%d]\n", 
+         (unsigned long long) sbset_chain_segment_bits (SGGC_UNUSED_FREE_NEW,v),
+         (int) sbset_n_elements(&free_or_new[kind]), kind);
+      }
+    }
 
-  printf("  free_or_new");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" [%d]: %3d ",k,sbset_n_elements(&free_or_new[k]));
+    sggc_next_free_bits[kind] = kind_full[kind] >> sggc_kind_chunks[kind];
+    sggc_next_free_val[kind] = sggc_next_free_bits[kind] == 0 
+                                  ? SGGC_NO_OBJECT : v + sggc_kind_chunks[kind];
+    sggc_next_segment_not_free[kind] = 1;
+
+    if (SGGC_DEBUG)
+    { printf("sggc_alloc: next_free_val[%d]=%x, next_free_bits[%d]=%016llx\n",
+              kind, (unsigned) sggc_next_free_val[kind], 
+              kind, (unsigned long long) sggc_next_free_bits[kind]);
+    }
   }
-  printf("\n");
 
-  printf("next_free_val");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { if (sggc_next_free_val[k] == SGGC_NO_OBJECT)
-    { printf(" [%d]: --- ",k);
+  /* For new segments (big or small), assign auxiliary information
+     We've previously guaranteed that auxiliary space is available. */
+
+  if (u == SGGC_NO_OBJECT)
+  { assign_aux (kind, index, seg, v, big);
+  }
+
+  if (EXTRA_CHECKS)
+  { if (sbset_contains (&old_to_new, v)) abort();
+    if (sbset_contains (&to_look_at, v)) abort();
+  }
+
+  /* Set up the data pointer for the segment. */
+
+  if (big)
+  { if (nch < HUGE_CHUNKS)
+    { seg->X.Big.alloc_chunks = nch;
+      seg->X.Big.huge = 0;
     }
     else
-    { printf(" [%d]: %3llx%c",k,(unsigned long long)sggc_next_free_val[k],
-                                 sggc_next_segment_not_free[k] ? ' ' : '^');
+    { seg->X.Big.alloc_chunks = nch >> SGGC_HUGE_SHIFT;
+      seg->X.Big.huge = 1;
+    }
+    seg->X.Big.align_off = align_offset >> 3;
+#   ifdef SGGC_MAPPED
+      seg->X.Big.mapped = 0;  /* set by sggc_alloc_mapped if appropriate */
+#   endif
+#ifdef SGGC_KIND_UNCOLLECTED
+    if (sggc_kind_uncollected[kind])
+    { sggc_info.uncol_big_chunks += nch;
+    }
+    else
+#endif
+    { sggc_info.gen0_big_chunks += nch;
     }
   }
-  printf("\n");
 
-  printf("             ");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" %08lx ",(unsigned long)(sggc_next_free_bits[k]>>32));
+  sggc_data[index] = (sggc_dptr) data;
+  if (big)
+  { if (data_size != 0)  /* will be 0 for medium objects, counted in region */
+    { MEM_ADD (big_data, MEM_SIZE (data_size, data_size + BIG_ALIGN_EXTRA));
+    }
   }
-  printf("\n");
-
-  printf("             ");
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  { printf(" %08lx ",(unsigned long)(sggc_next_free_bits[k]&0xffffffff));
+  else /* data_size will be 0 if data area was not allocated here */
+  { 
+#   ifndef SGGC_MEM_ACCOUNTING  /* else counted when block was allocated */
+      MEM_ADD (small_data, data_size);
+#   endif
   }
-  printf("\n");
-}
 
+  OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
 
-/* PUT AN OBJECT IN THE APPROPRIATE OLD GENERATION.  The object is
-   assumed to have already been removed from its 'free_or_new' set. */
+  /* Update allocation counts. */
 
-static void put_in_right_old_gen (sggc_cptr_t v)
-{
-  const sggc_kind_t k = SGGC_KIND(v);
-  struct sbset *ogen1 = sggc_kind_chunks[k]==0 ? &old_gen1_big : &old_gen1[k];
+  sggc_info.allocations += 1;
 
-  if (collect_level > 0)
-  { 
-    if (sbset_remove (ogen1, v))
-    { 
-      /* Object is in generation 1; move it to generation 2. */
+# ifdef SGGC_PRETENURE_FEEDBACK
+    sggc_kind_allocations[kind] += 1;
+# endif
 
-      sbset_add (sggc_kind_chunks[k]==0 ? &old_gen2_big : &old_gen2[k], v);
-      if (SGGC_DEBUG) printf("sggc_collect: %x now old_gen2\n",(unsigned)v);
-      return;
+# ifdef SGGC_TRACE_CPTR
+    if (v == sggc_trace_cptr)
+    { sggc_trace_cptr_count += 1;
+      if (sggc_trace_cptr_in_use) abort();
+      sggc_trace_cptr_in_use = 1;
+      if (sggc_trace_cptr_count == sggc_trace_alloc_trap)
+      { if (SGGC_DEBUG) 
+        { printf(
+           "sggc_alloc_kind_type_length: abort on alloc %d of traced cptr %x\n",
+            sggc_trace_cptr_count, (unsigned) sggc_trace_cptr);
+        }
+        abort();
+      }
     }
+# endif
 
-    if (collect_level == 2 && sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, v))
-    { 
-      /* Object is in generation 2; leave it there. */
+  /* Return newly allocated object. */
 
-      return;
-    }
-  }  
+  return v;
 
-  /* Object is in generation 0; move it to generation 1. */
+fail: 
 
-  sbset_add (ogen1, v);
-  if (SGGC_DEBUG) printf("sggc_collect: %x now old_gen1\n",(unsigned)v);
+  /* Some allocation failed.  Return SGGC_NO_OBJECT, after freeing 'data', 
+     and for a big segment, putting it back in 'unused'. */
+
+  if (big)
+  { if (v != SGGC_NO_OBJECT) 
+    { sbset_add (&unused, v);
+    }
+#   if defined(SGGC_MAPPED) || defined(SGGC_EXTERNAL)
+      if (given_data != NULL)  /* still belongs to caller */
+      { }
+      else
+#   endif
+#   ifdef SGGC_MEDIUM_OBJECTS
+      if (data_size == 0)  /* medium object */
+      { medium_free_data (data, nch);
+      }
+      else
+#   endif
+    sggc_mem_free (data - align_offset);
+  }
+  else if (data_size != 0)  /* not if reusing segment from aux_freed */
+  { small_data_area_next -= SMALL_DATA_AREA_SIZE;
+  }
+
+  return SGGC_NO_OBJECT;
 }
 
 
-/* DO A GARBAGE COLLECTION AT THE SPECIFIED LEVEL. 
+/* PUT A NEWLY-ALLOCATED OBJECT IN AN OLD GENERATION.  Used for
+   pretenuring.  The object is also put in old_to_new, so that any
+   references to newer objects stored in it before the next collection
+   (perhaps without a call of sggc_old_to_new_check, as is allowed for
+   newly-allocated objects) will be found.  Objects of uncollected kinds
+   are left as they are. */
 
-   This is done using several sub-procedures, primarily so that profiling
-   will show how much time is spent in each.  (Accordingly, most have
-   external scope even though only used here, to discourage inlining.) 
- */
+static void make_old (sggc_cptr_t v, int gen)
+{
+  sggc_kind_t kind = SGGC_KIND(v);
+  int big = sggc_kind_chunks[kind] == 0;
+  sggc_nchunks_t nch = 0;
 
-  /* Handle what needs to be done for an object that is now free.
-     Returns zero if the object turns out not to be free after all.
-     As arguments, takes the object thought to be free and the
-     call_for_newly_freed procedure for its kind (zero if none). */
+# ifdef SGGC_KIND_UNCOLLECTED
+    if (sggc_kind_uncollected[kind])
+    { return;
+    }
+# endif
 
-static inline int object_now_free (sggc_cptr_t v, int (*call)(sggc_cptr_t))
-{
-  /* Call the application-supplied procedure for a newly-freed object, if
-     there is one. */
+  sbset_remove (&free_or_new[kind], v);
+  sggc_info.gen0_count -= 1;
 
-  if (call && (*call)(v))
-  { if (SGGC_DEBUG)
-    { printf ("sggc_collect: not freeing %x after all\n", (unsigned)v);
-    }
-    return 0;
+  if (big)
+  { nch = CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v)));
+    sggc_info.gen0_big_chunks -= nch;
   }
 
-# ifdef SGGC_TRACE_CPTR
-    if (v == sggc_trace_cptr)
-    {
-      /* Clear in_use flag for traced ctpr. */
-
-      if (!sggc_trace_cptr_in_use) abort();
-      sggc_trace_cptr_in_use = 0;
+  if (gen == 1)
+  { sbset_add (big ? &old_gen1_big : &old_gen1[kind], v);
+    sggc_info.gen1_count += 1;
+    sggc_info.gen1_big_chunks += nch;
+  }
+  else
+  { sbset_add (big ? &old_gen2_big : &old_gen2[kind], v);
+    sggc_info.gen2_count += 1;
+    sggc_info.gen2_big_chunks += nch;
+  }
 
-      /* Abort if indicated by sggc_trace_free_trap. */
+  sbset_add (&old_to_new, v);
 
-      if (sggc_trace_cptr_count == sggc_trace_free_trap)
-      { if (SGGC_DEBUG)
-        { printf("sggc_collect: abort on free %d of traced cptr %x\n",
-                  sggc_trace_cptr_count, sggc_trace_cptr);
-        }
-        abort();
-      }
-    }
+# ifdef SGGC_PRETENURE_FEEDBACK
+    sggc_kind_allocations[kind] -= 1;  /* count only objects in gen 0 */
 # endif
 
-  /* Clear freed data and aux areas if asked to do so. */
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc: %x pretenured in old_gen%d\n", (unsigned)v, gen);
+  }
+}
 
-# ifdef SGGC_CLEAR_FREE
-  { sggc_kind_t k = SGGC_KIND(v);
-    sggc_nchunks_t nch = sggc_kind_chunks[k];
 
-    if (SGGC_DATA(v) != NULL)
-    { char *d = SGGC_DATA(v);
-#     ifdef SGGC_KEEP_CPTR
-        if (* (sggc_cptr_t *) (d + SGGC_KEEP_CPTR) != v)
-        { printf(
-          "sggc_collect: abort from bad cptr (%x) in freed data of %x (%p)\n",
-           * (sggc_cptr_t *) (d + SGGC_KEEP_CPTR), v, d);
-          abort();
-        }
-#     endif
-      memset (d, SGGC_CLEAR_DATA_BYTE, SGGC_CHUNK_SIZE * nch);
-#     ifdef SGGC_KEEP_CPTR
-        * (sggc_cptr_t *) (d + SGGC_KEEP_CPTR) = v;
-#     endif
-    }
+/* ALLOCATE AN OBJECT OF SPECIFIED KIND, TYPE, AND LENGTH, COLLECTING IF
+   NEEDED.  Calls alloc_kind_type_length, and if that fails because the
+   soft limit was reached, and sggc_set_soft_limit asked for garbage
+   collections to be done, does collections at levels 0, 1, and 2 in
+   turn, retrying the allocation after each, until one succeeds.  The
+   object is then put in old generation 'gen', if that is not zero.
 
-#   ifdef SGGC_AUX1_SIZE
-#   ifdef SGGC_AUX1_READ_ONLY
-    if (!kind_aux1_read_only[k])
-#   endif
-    { memset (SGGC_AUX1(v), SGGC_CLEAR_AUX1_BYTE, SGGC_AUX1_SIZE);
-    }
-#   endif
+   Used to implement sggc_alloc, sggc_alloc_kind, sggc_alloc_small_kind,
+   and sggc_alloc_old. */
 
-#   ifdef SGGC_AUX2_SIZE
-#   ifdef SGGC_AUX2_READ_ONLY
-    if (!kind_aux2_read_only[k])
-#   endif
-    { memset (SGGC_AUX2(v), SGGC_CLEAR_AUX2_BYTE, SGGC_AUX2_SIZE);
+static sggc_cptr_t sggc_alloc_kind_type_length (sggc_kind_t kind, 
+                                                sggc_type_t type,
+                                                sggc_length_t length,
+                                                int gen)
+{
+  sggc_cptr_t v;
+  int level;
+
+  soft_limit_reached = 0;
+  v = alloc_kind_type_length (kind, type, length, NULL);
+
+  for (level = 0; 
+       v == SGGC_NO_OBJECT && soft_limit_reached && soft_limit_collect 
+         && level <= 2;
+       level++)
+  { if (SGGC_DEBUG) 
+    { printf("sggc_alloc: soft limit reached, collecting at level %d\n",level);
     }
-#   endif
+    sggc_collect (level);
+    soft_limit_reached = 0;
+    v = alloc_kind_type_length (kind, type, length, NULL);
   }
-# endif
 
-  return 1;
+  if (gen != 0 && v != SGGC_NO_OBJECT)
+  { make_old (v, gen);
+  }
+
+  return v;
 }
 
-  /* Put objects in the old generations being collected in the 
-     free_or_new set for their kind. */
 
-void sggc_collect_put_in_free_or_new (void)
+/* SET A SOFT LIMIT ON MEMORY USAGE. */
+
+void sggc_set_soft_limit (size_t limit, int collect)
 {
-  sggc_kind_t k;
-  sggc_cptr_t v;
+  soft_limit = limit;
+  soft_limit_collect = collect;
+}
 
-  /* Put old objects of small kinds in the corresponding free_or_new set. */
 
-  for (k = 0; k < SGGC_N_KINDS; k++) 
-  {
-    if (!SGGC_SEGMENT_AT_A_TIME) /* do it the old way, one object at a time */
-    {
-      if (collect_level == 2)
-      { for (v = sbset_first(&old_gen2[k], 0);
-             v != SBSET_NO_VALUE;
-             v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
-        { sbset_add (&free_or_new[k], v);
-          if (SGGC_DEBUG)
-          { printf("sggc_collect: put %x from old_gen2 in free\n",(unsigned)v);
-          }
-        }
-      }
-  
-      if (collect_level >= 1)
-      { for (v = sbset_first(&old_gen1[k], 0);
-             v != SBSET_NO_VALUE;
-             v = sbset_chain_next(SGGC_OLD_GEN1,v))
-        { sbset_add (&free_or_new[k], v);
-          if (SGGC_DEBUG)
-          { printf("sggc_collect: put %x from old_gen1 in free\n",(unsigned)v);
-          }
-        }
-      }
-    }
-    else /* do it a segment at a time */
-    {
-      if (collect_level == 2)
-      { for (v = sbset_first(&old_gen2[k], 0); 
-             v != SBSET_NO_VALUE; 
-             v = sbset_chain_next_segment(SGGC_OLD_GEN2_UNCOL,v))
-        { sbset_add_segment (&free_or_new[k], v, SGGC_OLD_GEN2_UNCOL);
-          if (SGGC_DEBUG) 
-          { DO_FOR_SEGMENT (SGGC_OLD_GEN2_UNCOL, v,
-              printf("sggc_collect: put %x from old_gen2 in free\n",
-                      (unsigned)w));
-          }
-        }
-      }
-  
-      if (collect_level >= 1)
-      { for (v = sbset_first(&old_gen1[k], 0);
-             v != SBSET_NO_VALUE; 
-             v = sbset_chain_next_segment(SGGC_OLD_GEN1,v))
-        { sbset_add_segment (&free_or_new[k], v, SGGC_OLD_GEN1);
-          if (SGGC_DEBUG) 
-          { DO_FOR_SEGMENT (SGGC_OLD_GEN1, v,
-              printf("sggc_collect: put %x from old_gen1 in free\n",
-                      (unsigned)w));
-          }
-        }
-      }
-    }
-  }
+/* ALLOCATE AN OBJECT WITH GIVEN TYPE AND LENGTH. */
 
-  /* Put old objects of big kinds in the corresponding free_or_new set. */
+sggc_cptr_t sggc_alloc (sggc_type_t type, sggc_length_t length)
+{
+  sggc_kind_t kind = sggc_kind(type,length);
 
-  if (collect_level == 2)
-  { for (v = sbset_first(&old_gen2_big, 0);
-         v != SBSET_NO_VALUE;
-         v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
-    { sbset_add (&free_or_new[SGGC_KIND(v)], v);
-      if (SGGC_DEBUG)
-      { printf("sggc_collect: put %x from old_gen2 in free\n",(unsigned)v);
-      }
-    }
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc: type %u, length %u, kind %d\n",
+            (unsigned) type, (unsigned) length, (int) kind);
   }
+
+  return sggc_alloc_kind_type_length (kind, type, length, 
+                                     kind_pretenure[kind]);
+}
+
+
+/* ALLOCATE AN OBJECT WITH GIVEN KIND AND LENGTH.  
   
-  if (collect_level >= 1)
-  { for (v = sbset_first(&old_gen1_big, 0);
-         v != SBSET_NO_VALUE;
-         v = sbset_chain_next(SGGC_OLD_GEN1,v))
-    { sbset_add (&free_or_new[SGGC_KIND(v)], v);
-      if (SGGC_DEBUG)
-      { printf("sggc_collect: put %x from old_gen1 in free\n",(unsigned)v);
-      }
-    }
+   Not defined if the application did not provide SGGC_KIND_TYPES. */
+
+#ifdef SGGC_KIND_TYPES
+
+sggc_cptr_t sggc_alloc_kind (sggc_kind_t kind, sggc_length_t length)
+{
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_kind: kind %d (type %u), length %u\n", 
+            (int) kind, (unsigned) sggc_kind_types[kind], (unsigned) length);
   }
+
+  return sggc_alloc_kind_type_length (kind, sggc_kind_types[kind], length,
+                                     kind_pretenure[kind]);
 }
 
-  /* Handle old-to-new references.  Done in cooperation with
-     sggc_look_at, using the global variables collect_level (the level
-     of collection being done) and old_to_new_check (which contains
-     the generation of the referring object (1 or 2, or 3 for
-     uncollected), except it is cleared to 0 to indicate that further
-     special processing is unnecessary (which may also mean that the
-     old-to-new entry is still needed), and to -1 to indicate that
-     furthermore subsequent calls of sggc_look_at should be ignored. */
+#endif
 
-void sggc_collect_old_to_new (void)
+
+/* ALLOCATE AN OBJECT WITH GIVEN KIND, WHICH MUST BE FOR A SMALL SEGMENT. 
+
+   Not defined if the application did not provide SGGC_KIND_TYPES. */
+
+#ifdef SGGC_KIND_TYPES
+
+sggc_cptr_t sggc_alloc_small_kind (sggc_kind_t kind)
 {
-  sggc_cptr_t v;
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_small_kind: kind %d (type %u)\n", 
+            (int) kind, (unsigned) sggc_kind_types[kind]);
+  }
 
-  v = sbset_first(&old_to_new, 0);
+  return sggc_alloc_kind_type_length (kind, sggc_kind_types[kind], 0,
+                                     kind_pretenure[kind]);
+}
 
-  while (v != SBSET_NO_VALUE)
-  { int remove = 0;
-    if (SGGC_DEBUG) 
-    { printf ("sggc_collect: old->new for %x (gen%d)\n", (unsigned)v,
-        sbset_chain_contains(SGGC_OLD_GEN2_UNCOL,v) ? 2 
-#ifdef SGGC_KIND_UNCOLLECTED
-          + sggc_kind_uncollected[SGGC_KIND(v)]
-#endif
-        : sbset_chain_contains(SGGC_OLD_GEN1,v) ? 1 : 0);
-    }
-    if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, v)) /* v is oldgen2 or uncol */
-    { old_to_new_check = 2;
-#ifdef SGGC_KIND_UNCOLLECTED
-      if (sggc_kind_uncollected[SGGC_KIND(v)])
-      { old_to_new_check = 3;
-      }
 #endif
-    }
-    else /* v is in old generation 1 */
-    { if (collect_level == 0)
-      { old_to_new_check = 0;
-        remove = 1;
-      }
-      else
-      { old_to_new_check = 1;
-      }
-    }
-#   ifdef SGGC_FIND_OBJECT_RETURN
-      sggc_look_at (sggc_find_object_ptrs (v));
-#   else
-      sggc_find_object_ptrs (v);
-#   endif
-    if (old_to_new_check > 0) 
-    { remove = 1;
-    }
-    if (SGGC_DEBUG) 
-    { if (remove) 
-      { printf("sggc_collect: old->new for %x no longer needed\n",(unsigned)v);
-      }
-      else 
-      { printf("sggc_collect: old->new for %x still needed\n",(unsigned)v);
-      }
-    }
-    v = sbset_next (&old_to_new, v, remove);
+
+
+/* ALLOCATE AN OBJECT WITH GIVEN TYPE AND LENGTH IN AN OLD GENERATION. 
+   The generation must be 1 or 2. */
+
+sggc_cptr_t sggc_alloc_old (sggc_type_t type, sggc_length_t length, int gen)
+{
+  sggc_kind_t kind = sggc_kind(type,length);
+
+  if (gen < 1 || gen > 2) abort();
+
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_old: type %u, length %u, kind %d, gen %d\n",
+            (unsigned) type, (unsigned) length, (int) kind, gen);
   }
+
+  return sggc_alloc_kind_type_length (kind, type, length, gen);
 }
 
-  /* Keep looking at objects in the to_look_at set, putting them in
-     the correct old generation, and getting the application to find
-     any pointers they contain (which may add to the to_look_at set),
-     until there are no more in the set. */
 
-void sggc_collect_look_at (void)
+/* ALLOCATE AN OBJECT WITH DATA MAPPED FROM A FILE.  The object must be
+   of a big kind, with the data area taken from the file open as 'fd',
+   starting at 'offset', for as many bytes as are in the chunks for the
+   object.  The range is unmapped when the object is freed.  The offset
+   must be a multiple of GIVEN_DATA_ALIGN. */
+
+#ifdef SGGC_MAPPED
+
+sggc_cptr_t sggc_alloc_mapped (sggc_type_t type, int fd, off_t offset,
+                               sggc_length_t length, int flags)
 {
+  sggc_kind_t kind = sggc_kind(type,length);
+  sggc_nchunks_t nch;
+  size_t page_off, size;
+  struct stat st;
   sggc_cptr_t v;
+  char *p;
 
-# ifdef SGGC_AFTER_MARKING
-  int rep = 0;
-# endif
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_mapped: type %u, length %u, kind %d, offset %lld\n",
+            (unsigned) type, (unsigned) length, (int) kind, (long long) offset);
+  }
 
-  do
-  { 
-    while ((v = sbset_first (&to_look_at, 1)) != SGGC_NO_OBJECT)
+  if (sggc_kind_chunks[kind] != 0 
+       || offset < 0 || offset % GIVEN_DATA_ALIGN != 0)
+  { return SGGC_NO_OBJECT;
+  }
+
+  /* Find the size to map, which must match what is later unmapped, 
+     including any rounding of the number of chunks for huge objects. */
+
+  nch = sggc_nchunks (type, length);
+
+  /* Check that the file covers the chunks for the object, since accessing
+     a mapped page past the end of the file would raise SIGBUS later. */
+
+  if (fstat (fd, &st) != 0 || st.st_size < offset
+       || (uint64_t) (st.st_size - offset) < (uint64_t) SGGC_CHUNK_SIZE * nch)
+  { return SGGC_NO_OBJECT;
+  }
+
+  if (nch >= HUGE_CHUNKS)
+  { nch = HUGE_ROUND (nch);
+  }
+
+  page_off = offset % SGGC_PAGE_SIZE;
+  size = page_off + (size_t) SGGC_CHUNK_SIZE * nch;
+  if (size == 0)
+  { return SGGC_NO_OBJECT;
+  }
+
+  p = mmap (NULL, size, 
+            flags & SGGC_MAP_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE,
+            flags & SGGC_MAP_SHARED ? MAP_SHARED : MAP_PRIVATE,
+            fd, offset - page_off);
+  if (p == MAP_FAILED)
+  { return SGGC_NO_OBJECT;
+  }
+
+  v = alloc_kind_type_length (kind, type, length, p + page_off);
+  if (v == SGGC_NO_OBJECT)
+  { munmap (p, size);
+    return SGGC_NO_OBJECT;
+  }
+
+  SBSET_SEGMENT(SBSET_VAL_INDEX(v))->X.Big.mapped = 1;
+  sggc_info.mapped_mem_usage += size;
+
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_mapped: %x has data mapped at %p\n", 
+            (unsigned) v, p + page_off);
+  }
+
+  return v;
+}
+
+#endif
+
+
+/* ALLOCATE AN OBJECT WITH AN EXTERNAL DATA AREA.  The object must be of 
+   a big kind, with the data area being the 'nbytes' bytes at 'ptr',
+   which must be enough for the chunks of the object, and suitably
+   aligned.  When the object is freed, 'release' is called with 'ptr'
+   and 'nbytes', rather than the data area being freed by SGGC.  The
+   bytes are counted in external_mem_usage, which is included when 
+   checking against the soft limit, with garbage collections done if
+   necessary, as for sggc_alloc. */
+
+#ifdef SGGC_EXTERNAL
+
+sggc_cptr_t sggc_alloc_external (sggc_type_t type, sggc_length_t length,
+                                 void *ptr, size_t nbytes,
+                                 void (*release) (void *, size_t))
+{
+  sggc_kind_t kind = sggc_kind(type,length);
+  sggc_nchunks_t nch;
+  sggc_cptr_t v;
+  int level;
+
+  if (SGGC_DEBUG) 
+  { printf("sggc_alloc_external: type %u, length %u, kind %d, %p, %llu\n",
+            (unsigned) type, (unsigned) length, (int) kind, ptr,
+            (unsigned long long) nbytes);
+  }
+
+  if (sggc_kind_chunks[kind] != 0 || ptr == NULL || release == NULL)
+  { return SGGC_NO_OBJECT;
+  }
+  if ((uintptr_t) ptr % GIVEN_DATA_ALIGN != 0)
+  { return SGGC_NO_OBJECT;
+  }
+
+  /* Check that the data area is big enough, including any rounding of
+     the number of chunks for huge objects. */
+
+  nch = sggc_nchunks (type, length);
+  if (nch >= HUGE_CHUNKS)
+  { nch = HUGE_ROUND (nch);
+  }
+
+  if (nbytes < (size_t) SGGC_CHUNK_SIZE * nch)
+  { return SGGC_NO_OBJECT;
+  }
+
+  /* Allocate the table of release functions if not done before. */
+
+  if (external == NULL)
+  { external = sggc_mem_alloc_zero (maximum_segments * sizeof *external);
+    if (external == NULL)
+    { return SGGC_NO_OBJECT;
+    }
+#   ifdef SGGC_MEM_ACCOUNTING
+      MEM_ADD (table, MEM_SIZE (0, maximum_segments * sizeof *external));
+#   endif
+  }
+
+  /* Do garbage collections if the soft limit would be exceeded, and
+     this was asked for. */
+
+  soft_limit_reached = 0;
+
+  for (level = 0; over_soft_limit (nbytes); level++)
+  { if (!soft_limit_collect || level > 2)
+    { return SGGC_NO_OBJECT;
+    }
+    if (SGGC_DEBUG) 
+    { printf(
+       "sggc_alloc_external: soft limit reached, collecting at level %d\n",
+        level);
+    }
+    sggc_collect (level);
+    soft_limit_reached = 0;
+  }
+
+  v = alloc_kind_type_length (kind, type, length, ptr);
+  if (v == SGGC_NO_OBJECT)
+  { return SGGC_NO_OBJECT;
+  }
+
+  external[SBSET_VAL_INDEX(v)].release = release;
+  external[SBSET_VAL_INDEX(v)].nbytes = nbytes;
+  sggc_info.external_mem_usage += nbytes;
+
+  return v;
+}
+
+#endif
+
+
+/* SET THE GENERATION FOR PRETENURING OBJECTS OF A KIND.  A generation of
+   zero disables pretenuring, so objects are allocated normally. */
+
+void sggc_pretenure_kind (sggc_kind_t kind, int gen)
+{
+  if (gen < 0 || gen > 2) abort();
+
+  kind_pretenure[kind] = gen;
+
+# ifdef SGGC_PRETENURE_FEEDBACK
+    kind_feedback[kind] = 0;
+# endif
+}
+
+
+/* FIND THE GENERATION FOR PRETENURING OBJECTS OF A KIND. */
+
+int sggc_kind_pretenured (sggc_kind_t kind)
+{
+  return kind_pretenure[kind];
+}
+
+
+/* RETURN ACTUAL NUMBER OF CHUNKS IN DATA AREA OF AN OBJECT. */
+
+sggc_nchunks_t sggc_nchunks_allocated (sggc_cptr_t object)
+{
+  sggc_kind_t kind = SGGC_KIND(object);
+
+  return sggc_kind_chunks[kind] != 0 ? sggc_kind_chunks[kind]    /* small seg */
+   : CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(object)));   /* big seg */
+}
+
+
+/* REGISTER A CONSTANT SEGMENT. */
+
+sggc_cptr_t sggc_constant (sggc_type_t type, sggc_kind_t kind, int n_objects,
+                           char *data
+#ifdef SGGC_AUX1_SIZE
+                         , char *aux1
+#endif
+#ifdef SGGC_AUX2_SIZE
+                         , char *aux2
+#endif
+)
+{
+  sbset_bits_t bits;
+  int i;
+
+  if (n_objects < 1) abort();          /* must be at least one object */
+  if (n_objects > kind_objects[kind]) abort(); /* too many objects */
+
+  bits = 0;
+  for (i = 0; i < n_objects; i++)
+  { bits |= (sbset_bits_t)1 << (i*sggc_kind_chunks[kind]);
+  }
+
+  sbset_index_t index = new_segment();
+  if (index < 0)
+  { return SGGC_NO_OBJECT;
+  }
+
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+  sggc_cptr_t v = SGGC_CPTR_VAL(index,0);
+
+  /* The seg->X.Small fields below coincide with the seg->X.Big fields. */
+
+  seg->X.Small.big = sggc_kind_chunks[kind] == 0;
+  seg->X.Small.constant = 1;
+  seg->X.Small.kind = kind;
+
+  sbset_add (&constants, v);
+  sbset_assign_segment_bits (&constants, v, bits);
+
+  sggc_type[index] = type;
+
+  sggc_data[index] = (sggc_dptr) data;
+  OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
+
+# ifdef SGGC_AUX1_SIZE
+    sggc_aux1[index] = (sggc_dptr) aux1;
+    OFFSET(sggc_aux1,index,SGGC_AUX1_SIZE);
+    seg->X.Small.aux1_off = 0;
+# endif
+
+# ifdef SGGC_AUX2_SIZE
+    sggc_aux2[index] = (sggc_dptr) aux2;
+    OFFSET(sggc_aux2,index,SGGC_AUX2_SIZE);
+    seg->X.Small.aux2_off = 0;
+# endif
+    
+  if (SGGC_DEBUG) 
+  { printf("sggc_constant: first object in segment is %x\n", (unsigned)v);
+  }
+
+  return v;
+}
+
+
+/* SEEK TO A POSITION IN AN IMAGE OR CONSTANTS FILE.  Uses fseeko, so
+   positions past 2 GiB work where off_t is 64 bits (which on 32-bit
+   systems may need _FILE_OFFSET_BITS to be 64).  Returns 0 if the seek
+   succeeded, -1 if it failed or the position doesn't fit in an off_t. */
+
+#if defined(SGGC_IMAGE) || defined(SGGC_SHARED_CONSTANTS)
+
+static int file_seek (FILE *f, uint64_t pos)
+{
+  off_t off = (off_t) pos;
+
+  if (off < 0 || (uint64_t) off != pos)
+  { return -1;
+  }
+
+  return fseeko (f, off, SEEK_SET);
+}
+
+#endif
+
+
+/* SAVE AND LOAD FILES OF CONSTANT SEGMENTS.  A file of constants has a
+   header, followed by a record for each constant segment (in order of
+   segment index), followed by the data, aux1, and aux2 areas for the
+   segments, each aligned to SGGC_IMAGE_ALIGN.  When loaded, the file is
+   mapped read-only and shared, and the constant segments created point
+   into the mapping, so the physical memory holding them is shared by
+   all processes that load the same file. */
+
+#ifdef SGGC_SHARED_CONSTANTS
+
+#define CONSTANTS_MAGIC "SGGCCON1"
+
+struct constants_header
+{ char magic[8];               /* Identifies file as SGGC constants */
+  uint32_t chunk_size;         /* Value of SGGC_CHUNK_SIZE */
+  uint32_t aux1_size;          /* Value of SGGC_AUX1_SIZE, or 0 */
+  uint32_t aux2_size;          /* Value of SGGC_AUX2_SIZE, or 0 */
+  uint32_t n_segments;         /* Number of constant segments */
+  uint64_t file_size;          /* Total size of file */
+};
+
+struct constants_segment
+{ uint32_t kind;               /* Kind of constant segment */
+  uint32_t type;               /* Type of objects in segment */
+  uint64_t n_objects;          /* Number of objects in segment */
+  uint64_t data;               /* Offsets in file of areas, 0 if no area */
+  uint64_t aux1;
+  uint64_t aux2;
+};
+
+
+/* FIND THE SIZES OF AREAS FOR A CONSTANT SEGMENT.  Auxiliary information
+   is present only for the offsets of objects, so the area for it ends
+   after the entry for the last object. */
+
+static void constants_sizes (sggc_kind_t kind, uint64_t n, size_t *data, 
+                             size_t *aux1, size_t *aux2)
+{
+  size_t chunks = n * sggc_kind_chunks[kind];
+  size_t offsets = (n-1) * sggc_kind_chunks[kind] + 1;
+
+  *data = chunks * SGGC_CHUNK_SIZE;
+
+# ifdef SGGC_AUX1_SIZE
+    *aux1 = offsets * SGGC_AUX1_SIZE;
+# else
+    *aux1 = 0;
+# endif
+
+# ifdef SGGC_AUX2_SIZE
+    *aux2 = offsets * SGGC_AUX2_SIZE;
+# else
+    *aux2 = 0;
+# endif
+}
+
+
+/* WRITE A FILE CONTAINING ALL CONSTANT SEGMENTS.  Returns 0 if successful, 
+   -1 if the file could not be written, or if there is a constant segment
+   of a kind that uses big segments (whose size is not known). */
+
+int sggc_save_constants (const char *path)
+{
+  struct constants_header hdr;
+  struct constants_segment *recs;
+  sbset_index_t index;
+  uint64_t pos;
+  uint32_t n;
+  FILE *f;
+  int ok;
+
+  recs = sggc_mem_alloc_zero ((next_segment + 1) * sizeof *recs);
+  if (recs == NULL)
+  { return -1;
+  }
+
+  /* Set up records for constant segments, with the positions of their
+     areas in the file. */
+
+  n = 0;
+  for (index = 0; index < next_segment; index++)
+  { struct sbset_segment *seg = SBSET_SEGMENT(index);
+    if (seg != NULL && seg->X.Small.constant)
+    { if (seg->X.Small.big)
+      { sggc_mem_free (recs);
+        return -1;
+      }
+      recs[n].kind = seg->X.Small.kind;
+      recs[n].type = sggc_type[index];
+      recs[n].n_objects = sbset_bit_count (sbset_chain_segment_bits
+                            (SGGC_OLD_GEN2_UNCOL, SGGC_CPTR_VAL(index,0)));
+      n += 1;
+    }
+  }
+
+  pos = sizeof hdr + n * sizeof *recs;
+
+  n = 0;
+  for (index = 0; index < next_segment; index++)
+  { struct sbset_segment *seg = SBSET_SEGMENT(index);
+    if (seg != NULL && seg->X.Small.constant)
+    { struct constants_segment *r = &recs[n];
+      size_t data_size, aux1_size, aux2_size;
+      constants_sizes (r->kind, r->n_objects, 
+                       &data_size, &aux1_size, &aux2_size);
+      if (WITHOUT_OFFSET (sggc_data, index, SGGC_CHUNK_SIZE) != NULL)
+      { pos = IMAGE_ROUND (pos);
+        r->data = pos;
+        pos += data_size;
+      }
+#     ifdef SGGC_AUX1_SIZE
+        if (WITHOUT_OFFSET (sggc_aux1, index, SGGC_AUX1_SIZE) != NULL)
+        { pos = IMAGE_ROUND (pos);
+          r->aux1 = pos;
+          pos += aux1_size;
+        }
+#     endif
+#     ifdef SGGC_AUX2_SIZE
+        if (WITHOUT_OFFSET (sggc_aux2, index, SGGC_AUX2_SIZE) != NULL)
+        { pos = IMAGE_ROUND (pos);
+          r->aux2 = pos;
+          pos += aux2_size;
+        }
+#     endif
+      n += 1;
+    }
+  }
+
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, CONSTANTS_MAGIC, sizeof hdr.magic);
+  hdr.chunk_size = SGGC_CHUNK_SIZE;
+# ifdef SGGC_AUX1_SIZE
+    hdr.aux1_size = SGGC_AUX1_SIZE;
+# endif
+# ifdef SGGC_AUX2_SIZE
+    hdr.aux2_size = SGGC_AUX2_SIZE;
+# endif
+  hdr.n_segments = n;
+  hdr.file_size = pos;
+
+  /* Write the file. */
+
+  ok = 0;
+  f = fopen (path, "wb");
+
+  if (f != NULL
+   && fwrite (&hdr, sizeof hdr, 1, f) == 1
+   && fwrite (recs, sizeof *recs, n, f) == n)
+  { 
+    ok = 1;
+    n = 0;
+    for (index = 0; ok && index < next_segment; index++)
+    { struct sbset_segment *seg = SBSET_SEGMENT(index);
+      if (seg != NULL && seg->X.Small.constant)
+      { struct constants_segment *r = &recs[n];
+        size_t data_size, aux1_size, aux2_size;
+        constants_sizes (r->kind, r->n_objects, 
+                         &data_size, &aux1_size, &aux2_size);
+        if (r->data != 0)
+        { ok = ok && file_seek (f, r->data) == 0
+                  && fwrite (WITHOUT_OFFSET (sggc_data, index, SGGC_CHUNK_SIZE),
+                             1, data_size, f) == data_size;
+        }
+#       ifdef SGGC_AUX1_SIZE
+          if (r->aux1 != 0)
+          { ok = ok && file_seek (f, r->aux1) == 0
+                    && fwrite (WITHOUT_OFFSET (sggc_aux1, index, 
+                                               SGGC_AUX1_SIZE),
+                               1, aux1_size, f) == aux1_size;
+          }
+#       endif
+#       ifdef SGGC_AUX2_SIZE
+          if (r->aux2 != 0)
+          { ok = ok && file_seek (f, r->aux2) == 0
+                    && fwrite (WITHOUT_OFFSET (sggc_aux2, index, 
+                                               SGGC_AUX2_SIZE),
+                               1, aux2_size, f) == aux2_size;
+          }
+#       endif
+        n += 1;
+      }
+    }
+  }
+
+  if (f != NULL && fclose (f) != 0)
+  { ok = 0;
+  }
+
+  sggc_mem_free (recs);
+
+  if (SGGC_DEBUG) 
+  { printf ("sggc_save_constants: %s %s (%u segments)\n", 
+             ok ? "saved" : "failed to save", path, (unsigned) n);
+  }
+
+  return ok ? 0 : -1;
+}
+
+
+/* CREATE CONSTANT SEGMENTS FROM A FILE.  The file is mapped read-only and
+   shared, and constant segments are created (with consecutive indexes) 
+   whose data and auxiliary information are in the mapped file.  Returns 
+   the first object in the first segment created, or SGGC_NO_OBJECT if
+   the file can't be mapped, or is not valid for this configuration, or
+   there is not space for all the segments (in which case some may have
+   been created). */
+
+sggc_cptr_t sggc_load_constants (const char *path)
+{
+  struct constants_header hdr;
+  struct constants_segment *recs;
+  sggc_cptr_t first, v;
+  char *map;
+  off_t size;
+  FILE *f;
+  uint32_t i;
+
+  f = fopen (path, "rb");
+  if (f == NULL)
+  { return SGGC_NO_OBJECT;
+  }
+
+  if (fread (&hdr, sizeof hdr, 1, f) != 1
+   || memcmp (hdr.magic, CONSTANTS_MAGIC, sizeof hdr.magic) != 0
+   || hdr.chunk_size != SGGC_CHUNK_SIZE
+#  ifdef SGGC_AUX1_SIZE
+   || hdr.aux1_size != SGGC_AUX1_SIZE
+#  else
+   || hdr.aux1_size != 0
+#  endif
+#  ifdef SGGC_AUX2_SIZE
+   || hdr.aux2_size != SGGC_AUX2_SIZE
+#  else
+   || hdr.aux2_size != 0
+#  endif
+   || fseeko (f, 0, SEEK_END) != 0 || (size = ftello (f)) < 0
+   || (uint64_t) size < hdr.file_size
+   || (size_t) hdr.file_size != hdr.file_size
+   || hdr.file_size < sizeof hdr + (uint64_t) hdr.n_segments * sizeof *recs)
+  { fclose (f);
+    return SGGC_NO_OBJECT;
+  }
+
+  map = mmap (NULL, hdr.file_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+  fclose (f);
+  if (map == MAP_FAILED)
+  { return SGGC_NO_OBJECT;
+  }
+
+  recs = (struct constants_segment *) (map + sizeof hdr);
+
+  /* Check that the records are valid before creating any segments. */
+
+  for (i = 0; i < hdr.n_segments; i++)
+  { struct constants_segment *r = &recs[i];
+    size_t data_size, aux1_size, aux2_size;
+    if (r->kind >= SGGC_N_KINDS || r->type >= SGGC_N_TYPES
+     || sggc_kind_chunks[r->kind] == 0 || r->n_objects < 1 
+     || r->n_objects > (uint64_t) kind_objects[r->kind])
+    { munmap (map, hdr.file_size);
+      return SGGC_NO_OBJECT;
+    }
+    constants_sizes (r->kind, r->n_objects, &data_size, &aux1_size, &aux2_size);
+    if (r->data + data_size > hdr.file_size
+     || r->aux1 + aux1_size > hdr.file_size
+     || r->aux2 + aux2_size > hdr.file_size)
+    { munmap (map, hdr.file_size);
+      return SGGC_NO_OBJECT;
+    }
+  }
+
+  /* Create the constant segments.  The mapping is never removed. */
+
+  first = SGGC_NO_OBJECT;
+
+  for (i = 0; i < hdr.n_segments; i++)
+  { struct constants_segment *r = &recs[i];
+    v = sggc_constant (r->type, r->kind, r->n_objects,
+                       r->data == 0 ? NULL : map + r->data
+#                    ifdef SGGC_AUX1_SIZE
+                     , r->aux1 == 0 ? NULL : map + r->aux1
+#                    endif
+#                    ifdef SGGC_AUX2_SIZE
+                     , r->aux2 == 0 ? NULL : map + r->aux2
+#                    endif
+                     );
+    if (v == SGGC_NO_OBJECT)
+    { return SGGC_NO_OBJECT;
+    }
+    if (first == SGGC_NO_OBJECT)
+    { first = v;
+    }
+  }
+
+  if (SGGC_DEBUG) 
+  { printf ("sggc_load_constants: loaded %s (%u segments)\n", 
+             path, (unsigned) hdr.n_segments);
+  }
+
+  return first;
+}
+
+#endif
+
+
+/* ---------------------------- GARBAGE COLLECTION -------------------------- */
+
+
+/* PRINT DEBUG INFORMATION FOR GARBAGE COLLECTION. */
+
+static void collect_debug (void)
+{ 
+  int k;
+
+  printf(
+  "  unused: %d, old_to_new: %d, to_look_at: %d, constants: %d\n",
+       (int) sbset_n_elements(&unused), 
+       (int) sbset_n_elements(&old_to_new),
+       (int) sbset_n_elements(&to_look_at),
+       (int) sbset_n_elements(&constants));
+
+#ifdef SGGC_FINALIZERS
+  printf("  finalize: %d\n", (int) sbset_n_elements(&finalize));
+#endif
+
+  printf("    old gen 1");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&old_gen1[k]));
+  }
+  printf(" big: %3d ",(int) sbset_n_elements(&old_gen1_big));
+  printf("\n");
+
+  printf("    old gen 2");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&old_gen2[k]));
+  }
+  printf(" big: %3d ",(int) sbset_n_elements(&old_gen2_big));
+  printf("\n");
+
+#ifdef SGGC_KIND_UNCOLLECTED
+  printf("  uncollected");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&uncollected[k]));
+  }
+  printf("\n");
+#endif
+
+#ifdef SGGC_FREEZE
+  printf("  frozen");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&frozen[k]));
+  }
+  printf("\n");
+#endif
+
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+  printf("  uncol old_to_new");
+  for (k = 0; k < 3; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&uncol_old_to_new[k]));
+  }
+  printf("\n");
+#endif
+
+  printf("  free_or_new");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" [%d]: %3d ",k,(int) sbset_n_elements(&free_or_new[k]));
+  }
+  printf("\n");
+
+  printf("next_free_val");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { if (sggc_next_free_val[k] == SGGC_NO_OBJECT)
+    { printf(" [%d]: --- ",k);
+    }
+    else
+    { printf(" [%d]: %3llx%c",k,(unsigned long long)sggc_next_free_val[k],
+                                 sggc_next_segment_not_free[k] ? ' ' : '^');
+    }
+  }
+  printf("\n");
+
+  printf("             ");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" %08lx ",(unsigned long)(sggc_next_free_bits[k]>>32));
+  }
+  printf("\n");
+
+  printf("             ");
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  { printf(" %08lx ",(unsigned long)(sggc_next_free_bits[k]&0xffffffff));
+  }
+  printf("\n");
+}
+
+
+/* PUT AN OBJECT IN THE APPROPRIATE OLD GENERATION.  The object is
+   assumed to have already been removed from its 'free_or_new' set. */
+
+static void put_in_right_old_gen (sggc_cptr_t v)
+{
+  const sggc_kind_t k = SGGC_KIND(v);
+  struct sbset *ogen1 = sggc_kind_chunks[k]==0 ? &old_gen1_big : &old_gen1[k];
+
+  if (collect_level > 0)
+  { 
+    if (sbset_remove (ogen1, v))
+    { 
+      /* Object is in generation 1; move it to generation 2. */
+
+      sbset_add (sggc_kind_chunks[k]==0 ? &old_gen2_big : &old_gen2[k], v);
+      if (SGGC_DEBUG) printf("sggc_collect: %x now old_gen2\n",(unsigned)v);
+      return;
+    }
+
+    if (collect_level == 2 && sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, v))
+    { 
+      /* Object is in generation 2; leave it there. */
+
+      return;
+    }
+  }  
+
+  /* Object is in generation 0; move it to generation 1. */
+
+  sbset_add (ogen1, v);
+  if (SGGC_DEBUG) printf("sggc_collect: %x now old_gen1\n",(unsigned)v);
+}
+
+
+/* DO A GARBAGE COLLECTION AT THE SPECIFIED LEVEL. 
+
+   This is done using several sub-procedures, primarily so that profiling
+   will show how much time is spent in each.  (Accordingly, most have
+   external scope even though only used here, to discourage inlining.) 
+ */
+
+  /* Handle what needs to be done for an object that is now free.
+     Returns zero if the object turns out not to be free after all.
+     As arguments, takes the object thought to be free and the
+     call_for_newly_freed procedure for its kind (zero if none). */
+
+static inline int object_now_free (sggc_cptr_t v, int (*call)(sggc_cptr_t))
+{
+  /* Call the application-supplied procedure for a newly-freed object, if
+     there is one. */
+
+  if (call && (*call)(v))
+  { if (SGGC_DEBUG)
+    { printf ("sggc_collect: not freeing %x after all\n", (unsigned)v);
+    }
+    return 0;
+  }
+
+# ifdef SGGC_TRACE_CPTR
+    if (v == sggc_trace_cptr)
+    {
+      /* Clear in_use flag for traced ctpr. */
+
+      if (!sggc_trace_cptr_in_use) abort();
+      sggc_trace_cptr_in_use = 0;
+
+      /* Abort if indicated by sggc_trace_free_trap. */
+
+      if (sggc_trace_cptr_count == sggc_trace_free_trap)
+      { if (SGGC_DEBUG)
+        { printf("sggc_collect: abort on free %d of traced cptr %x\n",
+                  sggc_trace_cptr_count, (unsigned) sggc_trace_cptr);
+        }
+        abort();
+      }
+    }
+# endif
+
+  /* Clear freed data and aux areas if asked to do so. */
+
+# ifdef SGGC_CLEAR_FREE
+  { sggc_kind_t k = SGGC_KIND(v);
+    sggc_nchunks_t nch = sggc_kind_chunks[k];
+
+    if (SGGC_DATA(v) != NULL)
+    { char *d = SGGC_DATA(v);
+#     ifdef SGGC_KEEP_CPTR
+        if (* (sggc_cptr_t *) (d + SGGC_KEEP_CPTR) != v)
+        { printf(
+          "sggc_collect: abort from bad cptr (%x) in freed data of %x (%p)\n",
+           * (sggc_cptr_t *) (d + SGGC_KEEP_CPTR), v, d);
+          abort();
+        }
+#     endif
+      memset (d, SGGC_CLEAR_DATA_BYTE, SGGC_CHUNK_SIZE * nch);
+#     ifdef SGGC_KEEP_CPTR
+        * (sggc_cptr_t *) (d + SGGC_KEEP_CPTR) = v;
+#     endif
+    }
+
+#   ifdef SGGC_AUX1_SIZE
+#   ifdef SGGC_AUX1_READ_ONLY
+    if (!kind_aux1_read_only[k])
+#   endif
+    { memset (SGGC_AUX1(v), SGGC_CLEAR_AUX1_BYTE, SGGC_AUX1_SIZE);
+    }
+#   endif
+
+#   ifdef SGGC_AUX2_SIZE
+#   ifdef SGGC_AUX2_READ_ONLY
+    if (!kind_aux2_read_only[k])
+#   endif
+    { memset (SGGC_AUX2(v), SGGC_CLEAR_AUX2_BYTE, SGGC_AUX2_SIZE);
+    }
+#   endif
+  }
+# endif
+
+  return 1;
+}
+
+  /* Put objects in the old generations being collected in the 
+     free_or_new set for their kind. */
+
+void sggc_collect_put_in_free_or_new (void)
+{
+  sggc_kind_t k;
+  sggc_cptr_t v;
+
+  /* Put old objects of small kinds in the corresponding free_or_new set. */
+
+  for (k = 0; k < SGGC_N_KINDS; k++) 
+  {
+    if (!SGGC_SEGMENT_AT_A_TIME) /* do it the old way, one object at a time */
+    {
+      if (collect_level == 2)
+      { for (v = sbset_first(&old_gen2[k], 0);
+             v != SBSET_NO_VALUE;
+             v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
+        { sbset_add (&free_or_new[k], v);
+          if (SGGC_DEBUG)
+          { printf("sggc_collect: put %x from old_gen2 in free\n",(unsigned)v);
+          }
+        }
+      }
+  
+      if (collect_level >= 1)
+      { for (v = sbset_first(&old_gen1[k], 0);
+             v != SBSET_NO_VALUE;
+             v = sbset_chain_next(SGGC_OLD_GEN1,v))
+        { sbset_add (&free_or_new[k], v);
+          if (SGGC_DEBUG)
+          { printf("sggc_collect: put %x from old_gen1 in free\n",(unsigned)v);
+          }
+        }
+      }
+    }
+    else /* do it a segment at a time */
+    {
+      if (collect_level == 2)
+      { for (v = sbset_first(&old_gen2[k], 0); 
+             v != SBSET_NO_VALUE; 
+             v = sbset_chain_next_segment(SGGC_OLD_GEN2_UNCOL,v))
+        { sbset_add_segment (&free_or_new[k], v, SGGC_OLD_GEN2_UNCOL);
+          if (SGGC_DEBUG) 
+          { DO_FOR_SEGMENT (SGGC_OLD_GEN2_UNCOL, v,
+              printf("sggc_collect: put %x from old_gen2 in free\n",
+                      (unsigned)w));
+          }
+        }
+      }
+  
+      if (collect_level >= 1)
+      { for (v = sbset_first(&old_gen1[k], 0);
+             v != SBSET_NO_VALUE; 
+             v = sbset_chain_next_segment(SGGC_OLD_GEN1,v))
+        { sbset_add_segment (&free_or_new[k], v, SGGC_OLD_GEN1);
+          if (SGGC_DEBUG) 
+          { DO_FOR_SEGMENT (SGGC_OLD_GEN1, v,
+              printf("sggc_collect: put %x from old_gen1 in free\n",
+                      (unsigned)w));
+          }
+        }
+      }
+    }
+  }
+
+  /* Put old objects of big kinds in the corresponding free_or_new set. */
+
+  if (collect_level == 2)
+  { for (v = sbset_first(&old_gen2_big, 0);
+         v != SBSET_NO_VALUE;
+         v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
+    { sbset_add (&free_or_new[SGGC_KIND(v)], v);
+      if (SGGC_DEBUG)
+      { printf("sggc_collect: put %x from old_gen2 in free\n",(unsigned)v);
+      }
+    }
+  }
+  
+  if (collect_level >= 1)
+  { for (v = sbset_first(&old_gen1_big, 0);
+         v != SBSET_NO_VALUE;
+         v = sbset_chain_next(SGGC_OLD_GEN1,v))
+    { sbset_add (&free_or_new[SGGC_KIND(v)], v);
+      if (SGGC_DEBUG)
+      { printf("sggc_collect: put %x from old_gen1 in free\n",(unsigned)v);
+      }
+    }
+  }
+}
+
+  /* Handle old-to-new references.  Done in cooperation with
+     sggc_look_at, using the global variables collect_level (the level
+     of collection being done) and sggc_old_to_new_checking (which
+     contains the generation of the referring object (1 or 2, or 3 for
+     uncollected or frozen), except it is cleared to 0 to indicate that
+     further special processing is unnecessary (which may also mean
+     that the old-to-new entry is still needed), and to -1 to indicate
+     that furthermore subsequent calls of sggc_look_at should be ignored.
+
+     Uncollected and frozen objects with old-to-new references are instead in
+     uncol_old_to_new[g] for all g at least as large as the youngest
+     generation they may reference, and only those in the set for the
+     level of collection being done need be looked at.  While doing so,
+     sggc_look_at records in uncol_youngest the youngest generation
+     referenced after this collection (3 if none), which determines
+     which sets the object should be in afterwards. */
+
+  /* GET THE APPLICATION TO LOOK AT ALL REFERENCES FROM AN OBJECT.  If
+     sggc_find_object_ptrs may return references rather than passing
+     them to sggc_look_at, sggc_look_at is called for them here. */
+
+static void look_at_object_ptrs (sggc_cptr_t v)
+{
+# ifdef SGGC_FIND_OBJECT_MULTI
+  { sggc_cptr_t ptrs[SGGC_FIND_OBJECT_MULTI];
+    int i, n;
+    n = sggc_find_object_ptrs (v, ptrs);
+    for (i = 0; i < n; i++)
+    { sggc_look_at (ptrs[i]);
+    }
+  }
+# elif defined(SGGC_FIND_OBJECT_RETURN)
+    sggc_look_at (sggc_find_object_ptrs (v));
+# else
+    sggc_find_object_ptrs (v);
+# endif
+}
+
+void sggc_collect_old_to_new (void)
+{
+  sggc_cptr_t v;
+
+  v = sbset_first(&old_to_new, 0);
+
+  while (v != SBSET_NO_VALUE)
+  { int remove = 0;
+    if (SGGC_DEBUG) 
+    { printf ("sggc_collect: old->new for %x (gen%d)\n", (unsigned)v,
+        sbset_chain_contains(SGGC_OLD_GEN2_UNCOL,v) ? 2 
+        : sbset_chain_contains(SGGC_OLD_GEN1,v) ? 1 : 0);
+    }
+    if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, v)) /* v is oldgen2 */
+    { sggc_old_to_new_checking = 2;
+    }
+    else /* v is in old generation 1 */
+    { if (collect_level == 0)
+      { sggc_old_to_new_checking = 0;
+        remove = 1;
+      }
+      else
+      { sggc_old_to_new_checking = 1;
+      }
+    }
+    look_at_object_ptrs (v);
+    if (sggc_old_to_new_checking > 0) 
+    { remove = 1;
+    }
+    if (SGGC_DEBUG) 
+    { if (remove) 
+      { printf("sggc_collect: old->new for %x no longer needed\n",(unsigned)v);
+      }
+      else 
+      { printf("sggc_collect: old->new for %x still needed\n",(unsigned)v);
+      }
+    }
+    v = sbset_next (&old_to_new, v, remove);
+  }
+
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+
+  v = sbset_first(&uncol_old_to_new[collect_level], 0);
+
+  while (v != SBSET_NO_VALUE)
+  { int g;
+    if (SGGC_DEBUG) 
+    { printf ("sggc_collect: old->new for %x (uncollected)\n", (unsigned)v);
+    }
+    sggc_old_to_new_checking = 3;
+    uncol_youngest = 3;
+    look_at_object_ptrs (v);
+    for (g = 0; g < 3; g++)
+    { if (g != collect_level)
+      { if (g >= uncol_youngest)
+        { sbset_add (&uncol_old_to_new[g], v);
+        }
+        else
+        { sbset_remove (&uncol_old_to_new[g], v);
+        }
+      }
+    }
+    if (SGGC_DEBUG) 
+    { if (uncol_youngest == 3) 
+      { printf("sggc_collect: old->new for %x no longer needed\n",(unsigned)v);
+      }
+      else 
+      { printf("sggc_collect: old->new for %x still needed (gen%d)\n",
+                (unsigned)v, uncol_youngest);
+      }
+    }
+    v = sbset_next (&uncol_old_to_new[collect_level], v, 
+                    uncol_youngest > collect_level);
+  }
+
+#endif
+}
+
+  /* ADD AN OBJECT TO THOSE TO BE LOOKED AT.  With SGGC_MARK_STACK
+     defined, it is pushed on the mark stack, which is enlarged when
+     full.  If enlarging it fails, or would exceed the soft limit, the
+     object is put in the to_look_at set instead.  An object is added 
+     only when it is removed from free_or_new, so it will not be added
+     twice.  Space for the mark stack is counted as table memory. */
+
+#ifdef SGGC_MARK_STACK
+
+#define MARK_STACK_INITIAL 1024  /* Initial number of entries in mark stack */
+
+#ifndef SGGC_MARK_STACK_KEEP
+#define SGGC_MARK_STACK_KEEP 65536  /* Max entries kept after collection */
+#endif
+
+static void add_to_look_at (sggc_cptr_t v)
+{
+  if (mark_stack_top == mark_stack_size)
+  { size_t new_size = mark_stack_size == 0 ? MARK_STACK_INITIAL 
+                                           : 2 * mark_stack_size;
+    sggc_cptr_t *new_stack;
+    if (over_soft_limit (MEM_SIZE (new_size * sizeof *new_stack,
+                                   new_size * sizeof *new_stack))
+     || (new_stack = sggc_mem_alloc (new_size * sizeof *new_stack)) == NULL)
+    { sbset_add (&to_look_at, v);
+      return;
+    }
+    MEM_ADD (table, MEM_SIZE (new_size * sizeof *new_stack,
+                              new_size * sizeof *new_stack));
+    if (mark_stack_top > 0)
+    { memcpy (new_stack, mark_stack, mark_stack_top * sizeof *new_stack);
+    }
+    if (mark_stack != NULL)
+    { sggc_mem_free (mark_stack);
+      MEM_SUB (table, MEM_SIZE (mark_stack_size * sizeof *mark_stack,
+                                mark_stack_size * sizeof *mark_stack));
+    }
+    mark_stack = new_stack;
+    mark_stack_size = new_size;
+  }
+
+  mark_stack[mark_stack_top++] = v;
+}
+
+  /* FREE THE MARK STACK IF IT GREW LARGE.  Called at the end of a 
+     collection, when the mark stack is empty.  A stack with more than
+     SGGC_MARK_STACK_KEEP entries is freed, to be allocated again with
+     its initial size when next needed, so that memory used for the
+     stack in one collection that went unusually deep is not kept. */
+
+static void release_mark_stack (void)
+{
+  if (mark_stack_size > SGGC_MARK_STACK_KEEP)
+  { sggc_mem_free (mark_stack);
+    MEM_SUB (table, MEM_SIZE (mark_stack_size * sizeof *mark_stack,
+                              mark_stack_size * sizeof *mark_stack));
+    mark_stack = NULL;
+    mark_stack_size = 0;
+  }
+}
+
+#else
+
+#define add_to_look_at(v) sbset_add (&to_look_at, v)
+
+#endif
+
+  /* TAKE THE NEXT OBJECT TO LOOK AT.  Takes the most recently added
+     object from the mark stack, if SGGC_MARK_STACK is defined, so that
+     objects are looked at depth-first, or otherwise (or if the mark 
+     stack is empty) the first in the to_look_at set.  Returns 
+     SGGC_NO_OBJECT if there are no objects left to look at. */
+
+static inline sggc_cptr_t next_to_look_at (void)
+{
+# ifdef SGGC_MARK_STACK
+    if (mark_stack_top > 0) 
+    { return mark_stack[--mark_stack_top];
+    }
+# endif
+
+  return sbset_first (&to_look_at, 1);
+}
+
+  /* Keep looking at objects in the to_look_at set (or mark stack),
+     putting them in the correct old generation, and getting the
+     application to find any pointers they contain (which may add to
+     the objects to look at), until there are no more. */
+
+void sggc_collect_look_at (void)
+{
+  sggc_cptr_t v;
+
+# ifdef SGGC_AFTER_MARKING
+  int rep = 0;
+# endif
+
+  do
+  { 
+    while ((v = next_to_look_at()) != SGGC_NO_OBJECT)
     {
 #     ifdef SGGC_FIND_OBJECT_RETURN
       { for (;;)
@@ -1599,618 +3283,2174 @@ void sggc_collect_look_at (void)
           if (v == SGGC_NO_OBJECT)
           { break;
           }
-#         ifdef SGGC_TRACE_CPTR
-            if (v == sggc_trace_cptr && !sggc_trace_cptr_in_use)
-            { printf ("TRACED CPTR LOOKED AT WHEN NOT IN USE: %d %d\n",sv,v);
-              abort();
-            }
+#         ifdef SGGC_TRACE_CPTR
+            if (v == sggc_trace_cptr && !sggc_trace_cptr_in_use)
+            { printf ("TRACED CPTR LOOKED AT WHEN NOT IN USE: %d %d\n",sv,v);
+              abort();
+            }
+#         endif
+          if (SGGC_DEBUG)
+          { printf ("sggc_collect: from find_object_ptrs: %x\n", (unsigned)v);
+          }
+          if (!sbset_chain_contains(SGGC_UNUSED_FREE_NEW,v))
+          { break;
+          }
+          sbset_remove (&free_or_new[SGGC_KIND(v)], v);
+        } 
+      }
+#     elif defined(SGGC_FIND_OBJECT_MULTI)
+      { sggc_cptr_t ptrs[SGGC_FIND_OBJECT_MULTI];
+        int i, n;
+        for (;;)
+        { if (SGGC_DEBUG) printf("sggc_collect: looking at %x\n",(unsigned)v);
+          put_in_right_old_gen (v);
+#         ifdef SGGC_TRACE_CPTR
+            sggc_cptr_t sv = v;
+#         endif
+          n = sggc_find_object_ptrs (v, ptrs);
+          v = SGGC_NO_OBJECT;
+          for (i = 0; i < n; i++)
+          { sggc_cptr_t w = ptrs[i];
+            if (w == SGGC_NO_OBJECT)
+            { continue;
+            }
+#           ifdef SGGC_TRACE_CPTR
+              if (w == sggc_trace_cptr && !sggc_trace_cptr_in_use)
+              { printf ("TRACED CPTR LOOKED AT WHEN NOT IN USE: %d %d\n",sv,w);
+                abort();
+              }
+#           endif
+            if (SGGC_DEBUG)
+            { printf ("sggc_collect: from find_object_ptrs: %x\n",
+                      (unsigned)w);
+            }
+            if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,w))
+            { sbset_remove (&free_or_new[SGGC_KIND(w)], w);
+              if (v != SGGC_NO_OBJECT)
+              { add_to_look_at (v);
+              }
+              v = w;
+            }
+          }
+          if (v == SGGC_NO_OBJECT)
+          { break;
+          }
+        }
+      }
+#     else
+      { if (SGGC_DEBUG) printf("sggc_collect: looking at %x\n",(unsigned)v);
+        put_in_right_old_gen (v);
+        sggc_find_object_ptrs (v);
+      }
+#     endif
+    }
+
+#   ifdef SGGC_AFTER_MARKING
+    sggc_after_marking (collect_level, rep++);
+#   endif
+
+  } while (sbset_first (&to_look_at, 0) != SGGC_NO_OBJECT
+#          ifdef SGGC_MARK_STACK
+             || mark_stack_top > 0
+#          endif
+          );
+}
+
+  /* Call the finalizer for objects registered with sggc_register_finalizer
+     that were not marked as in use, and so are still in a free_or_new set.
+     Only these objects are looked at, so the sweep of their kinds can 
+     still be done a segment at a time.  Objects that the finalizer says
+     should not be freed after all are moved to the right old generation,
+     and stay registered.  Others are unregistered, and are left to be
+     freed as usual. */
+
+#ifdef SGGC_FINALIZERS
+
+void sggc_collect_finalize (void)
+{
+  sggc_cptr_t v, nv;
+
+  for (v = sbset_first (&finalize, 0); v != SGGC_NO_OBJECT; v = nv)
+  { 
+    nv = sbset_chain_next (SGGC_FINALIZE, v);
+
+    if (!sbset_chain_contains (SGGC_UNUSED_FREE_NEW, v))
+    { continue;  /* still in use */
+    }
+
+    if (finalizer && (*finalizer)(v))
+    { if (SGGC_DEBUG)
+      { printf ("sggc_collect: not freeing %x after finalizer\n", (unsigned)v);
+      }
+      (void) sbset_remove (&free_or_new[SGGC_KIND(v)], v);
+      put_in_right_old_gen(v);
+    }
+    else
+    { if (SGGC_DEBUG)
+      { printf ("sggc_collect: finalized %x\n", (unsigned)v);
+      }
+      (void) sbset_remove (&finalize, v);
+    }
+  }
+}
+
+#endif
+
+  /* Remove small objects still in the free_or_new set from the old
+     generations that were collected.  Also remove them from the
+     old-to-new set.  Also calls any functions set up for small kinds
+     with sggc_call_for_newly_freed_object. */
+
+void sggc_collect_remove_free_small (void)
+{
+  sggc_kind_t k;
+  sggc_cptr_t v;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { 
+    if (sggc_kind_chunks[k] != 0)  /* kind is for small objects */
+    {
+      int (*call)(sggc_cptr_t) = call_for_newly_freed[k];
+
+      /* If a function to call for newly-freed objects has been set up
+         for this kind (with sggc_call_for_newly_freed_object), we
+         need to do a preliminary scan of objects in free_or_new[k] up
+         to the point where we reach objects that were freed before
+         this collection and weren't allocated since (which may now be
+         mixed in with objects that were moved from old generations,
+         if collect_level is greater than zero).  (Note that we also
+         have to handle the case where we've used all of the free set
+         and are now allocating from a single newly-created segment.)
+         If one of these newly-freed objects is in an old generation,
+         we remove it now (but note that this doesn't get all free
+         objects, so we still need the scan done below). 
+ 
+         If a cptr is being traced, we always have to do this scan. */
+
+#ifdef SGGC_TRACE_CPTR
+      if ((sggc_trace_cptr != SGGC_NO_OBJECT || call)
+#else
+      if (call 
+#endif
+           && (v = sbset_first (&free_or_new[k], 0)) != SGGC_NO_OBJECT)
+      {
+        sggc_cptr_t next_free = sggc_next_free_val[k];
+
+        for (;;)  /* loop over objects allocated since last collection */
+        { 
+          if (v == SGGC_NO_OBJECT)
+          { break;
+          }
+
+          if (v == next_free)
+          { if (!sggc_next_segment_not_free[k])
+            { break; /* remaining objects not allocated since last collection */
+            }
+            /* remaining objects were allocated since last collection. */
+            v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v);
+            if (v == SGGC_NO_OBJECT)
+            { break;
+            }
+          }
+
+          sggc_cptr_t ov = v;
+
+          v = sbset_chain_next (SGGC_UNUSED_FREE_NEW, v);
+
+          /* Handle operations done for a newly-freed object, including
+             perhaps finding out that it shouldn't be freed after all. */
+  
+          if (!object_now_free(ov,call))
+          { (void) sbset_remove (&free_or_new[k], ov);
+            put_in_right_old_gen(ov);
+            continue;
+          }
+  
+          /* Remove the object from any old_gen or old_to_new, if it's there.
+             (Otherwise, we'd call the function again below.) */
+  
+          if (collect_level > 0)
+          { if (sbset_remove (&old_gen1[k], ov))
+            { if (SGGC_DEBUG)
+              { printf("sggc_collect: %x in old_gen1 now free\n",(unsigned)ov);
+              }
+              (void) sbset_remove (&old_to_new, ov);
+            }
+            else if (collect_level > 1 && sbset_remove (&old_gen2[k], ov))
+            { if (SGGC_DEBUG)
+              { printf("sggc_collect: %x in old_gen2 now free\n",(unsigned)ov);
+              }
+              (void) sbset_remove (&old_to_new, ov);
+            }
+          }
+        }
+      }
+
+      /* Scan the old generation sets, not the free sets (though
+         that's necessary above), since this is likely faster, if lots
+         of objects were allocated but not used for long, and hence
+         are in the free sets. */
+
+#if defined(SGGC_CLEAR_FREE)
+      if (1)
+#elif defined(SGGC_TRACE_CPTR)
+      if (sggc_trace_cptr != SGGC_NO_OBJECT)
+#else
+      if (!SGGC_SEGMENT_AT_A_TIME || call_for_newly_freed[k])
+#endif
+      { 
+        /* Do it one object at a time. */
+
+        if (collect_level == 2)
+        { v = sbset_first (&old_gen2[k], 0); 
+          while (v != SBSET_NO_VALUE)
+          { sggc_cptr_t ov = v;
+            v = sbset_chain_next (SGGC_OLD_GEN2_UNCOL, v);
+            if (sbset_chain_contains (SGGC_UNUSED_FREE_NEW, ov))
+            { if (!object_now_free(ov,call))
+              { (void) sbset_remove (&free_or_new[k], ov);
+                put_in_right_old_gen(ov);
+                continue;
+              }
+              if (SGGC_DEBUG)
+              { printf("sggc_collect: %x in old_gen2 now free\n",
+                        (unsigned) ov);
+              }
+              sbset_remove (&old_to_new, ov);
+              sbset_remove (&old_gen2[k], ov);
+            }
+          }
+        }
+    
+        if (collect_level >= 1)
+        { v = sbset_first (&old_gen1[k], 0); 
+          while (v != SBSET_NO_VALUE)
+          { sggc_cptr_t ov = v;
+            v = sbset_chain_next (SGGC_OLD_GEN1, v);
+            if (sbset_chain_contains (SGGC_UNUSED_FREE_NEW, ov))
+            { if (!object_now_free(ov,call))
+              { (void) sbset_remove (&free_or_new[k], ov);
+                put_in_right_old_gen(ov);
+                continue;
+              }
+              if (SGGC_DEBUG)
+              { printf("sggc_collect: %x in old_gen1 now free\n",
+                        (unsigned) ov);
+              }
+              sbset_remove (&old_to_new, ov);
+              sbset_remove (&old_gen1[k], ov);
+            }
+          }
+        }
+      }
+      else 
+      { 
+        /* Do it a segment at a time. */
+
+        if (collect_level == 2)
+        { v = sbset_first(&old_gen2[k], 0); 
+          while (v != SBSET_NO_VALUE)
+          { if (SGGC_DEBUG)
+            { DO_FOR_SEGMENT (SGGC_OLD_GEN2_UNCOL, v, 
+                if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,w))
+                 printf("sggc_collect: %x in old_gen2 now free\n",(unsigned)w));
+            }
+            sggc_cptr_t nv = sbset_chain_next_segment(SGGC_OLD_GEN2_UNCOL,v);
+            sbset_remove_segment (&old_gen2[k], v, SGGC_UNUSED_FREE_NEW);
+            if (sbset_chain_contains_any_in_segment (SGGC_UNUSED_FREE_NEW, v))
+            { sbset_remove_segment (&old_to_new, v, SGGC_UNUSED_FREE_NEW);
+            }
+            v = nv;
+          }
+        }
+    
+        if (collect_level >= 1)
+        { v = sbset_first(&old_gen1[k], 0); 
+          while (v != SBSET_NO_VALUE)
+          { if (SGGC_DEBUG)
+            { DO_FOR_SEGMENT (SGGC_OLD_GEN1, v, 
+                if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,w))
+                 printf("sggc_collect: %x in old_gen1 now free\n",(unsigned)w));
+            }
+            sggc_cptr_t nv = sbset_chain_next_segment(SGGC_OLD_GEN1,v);
+            sbset_remove_segment (&old_gen1[k], v, SGGC_UNUSED_FREE_NEW);
+            if (sbset_chain_contains_any_in_segment (SGGC_UNUSED_FREE_NEW, v))
+            { sbset_remove_segment (&old_to_new, v, SGGC_UNUSED_FREE_NEW);
+            }
+            v = nv;
+          }
+        }
+      }
+
+      /* Remove all objects from the free set if we aren't reusing them. */
+
+      if (do_not_reuse_memory)
+      { do
+        { v = sbset_first (&free_or_new[k], 1); 
+        } while (v != SGGC_NO_OBJECT);
+      }
+    }
+  }
+}
+
+  /* Remove big objects still in the free_or_new set from the old
+     generations that were collected.  Also remove them from the
+     old-to-new set, put them in 'unused', and free their data storage
+     (but not their auxiliary information).  Also calls any functions
+     set up for big kinds with sggc_call_for_newly_freed_object. */
+
+void sggc_collect_remove_free_big (void)
+{
+  sggc_kind_t k;
+  sggc_cptr_t v;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { 
+    if (sggc_kind_chunks[k] == 0)  /* kind is for big objects */
+    { 
+      int (*call)(sggc_cptr_t) = call_for_newly_freed[k];
+
+      /* Scan the free_or_new[k] set (which contains only newly-free
+         objects), which we have to look at to free their data even if
+         they are not in old_gen1_big or old_gen2_big.  Note that since
+         big objects are stored one-per-segment, there is nothing to be
+         gained by trying to do this a segment at a time. */
+
+      while ((v = sbset_first (&free_or_new[k], 1)) != SGGC_NO_OBJECT)
+      { 
+        /* Handle operations done for a newly-freed object, including
+           perhaps finding out that it shouldn't be freed after all. */
+
+        if (!object_now_free(v,call))
+        { put_in_right_old_gen(v);
+          continue;
+        }
+
+        /* Find the number of chunks used by the object. */
+
+        sggc_nchunks_t nch=CHUNKS_ALLOCATED(SBSET_SEGMENT(SBSET_VAL_INDEX(v)));
+
+        /* Remove the object from any old_gen or old_to_new, if it's there.
+           Modify the sggc_info count of chunks accordingly.  (Chunk counts
+           were previously updated for older generations assuming objects
+           will remain in use.) */
+
+        if (collect_level > 0 && sbset_remove (&old_gen1_big, v))
+        { if (SGGC_DEBUG)
+          { printf("sggc_collect: %x in old_gen1 now free (%d chunks)\n",
+                    (unsigned)v, nch);
+          }
+          (void) sbset_remove (&old_to_new, v);
+          sggc_info.gen2_big_chunks -= nch;
+        }
+        else if (collect_level > 1 && sbset_remove (&old_gen2_big, v))
+        { if (SGGC_DEBUG)
+          { printf("sggc_collect: %x in old_gen2 now free (%d chunks)\n",
+                    (unsigned)v, nch);
+          }
+          (void) sbset_remove (&old_to_new, v);
+          sggc_info.gen2_big_chunks -= nch;
+        }
+        else
+        { if (SGGC_DEBUG)
+          { printf(
+              "sggc_collect: %x that was newly-allocated is free (%d chunks)\n",
+               (unsigned)v, nch);
+          }
+          sggc_info.gen1_big_chunks -= nch;
+        }
+
+        /* Don't free memory or put in 'unused' if we're not reusing memory. */
+
+        if (do_not_reuse_memory)
+        { continue;
+        }
+
+        /* Free the object's data area, and update memory usage in sggc_info. */
+
+        if (SGGC_DEBUG) 
+        { printf ("sggc_collect: calling free for data for %x:: %p\n", 
+                   (unsigned) v, SGGC_DATA(v));
+        }
+        struct sbset_segment *seg = SBSET_SEGMENT (SBSET_VAL_INDEX(v));
+#       ifdef SGGC_EXTERNAL
+          if (external != NULL 
+               && external[SBSET_VAL_INDEX(v)].release != NULL)
+          { struct external *e = &external[SBSET_VAL_INDEX(v)];
+            sggc_info.external_mem_usage -= e->nbytes;
+            e->release (SGGC_DATA(v), e->nbytes);
+            e->release = NULL;
+          }
+          else
+#       endif
+#       ifdef SGGC_MAPPED
+          if (seg->X.Big.mapped)  /* mapping starts at page boundary */
+          { char *d = (char *) SGGC_DATA(v);
+            size_t page_off = (uintptr_t) d % SGGC_PAGE_SIZE;
+            size_t size = page_off + (size_t) SGGC_CHUNK_SIZE * nch;
+            munmap (d - page_off, size);
+            sggc_info.mapped_mem_usage -= size;
+            seg->X.Big.mapped = 0;
+          }
+          else
+#       endif
+#       ifdef SGGC_IMAGE
+          if (IN_IMAGE (SGGC_DATA(v)))  /* data from an image isn't freed */
+          { MEM_SUB (big_data, MEM_SIZE ((size_t) SGGC_CHUNK_SIZE * nch,
+                            (size_t) SGGC_CHUNK_SIZE * nch + BIG_ALIGN_EXTRA));
+          }
+          else
+#       endif
+#       ifdef SGGC_MEDIUM_OBJECTS
+          if (nch <= MEDIUM_MAX_CHUNKS)  /* memory is counted with region */
+          { medium_free_data ((char *) SGGC_DATA(v), nch);
+          }
+          else
+#       endif
+        { sggc_mem_free (((char *) SGGC_DATA(v)) - (seg->X.Big.align_off << 3));
+          MEM_SUB (big_data, MEM_SIZE ((size_t) SGGC_CHUNK_SIZE * nch,
+                            (size_t) SGGC_CHUNK_SIZE * nch + BIG_ALIGN_EXTRA));
+        }
+
+        /* Put it in 'unused', for later re-use. */
+
+        if (SGGC_DEBUG) 
+        { printf("sggc_collect: putting %x in unused\n",(unsigned)v);
+        }
+        sbset_add(&unused,v); /* allowed since v was removed with sbset_first */
+                              /*   and it was the only value in its segment   */
+      }
+    }
+  }
+}
+
+/* FREE BLOCKS OF AUXILIARY INFORMATION NO LONGER USED.  Done only in
+   level 2 collections, if SGGC_FREE_AUX_BLOCKS is defined.  A block
+   can be freed if all segments using it are entirely free (small
+   segments with all objects in free_or_new, and big segments in
+   'unused'), and it is not a block still being allocated from.
+
+   Small segments using a block that is freed are moved from free_or_new
+   to 'aux_freed' for their kind, from which they may later be reused
+   (with their data area, but new auxiliary information) for objects of
+   the same kind.  (Reuse for another kind is not possible, since the
+   segment may still be in the chains for the kind's old_gen sets.)  Big
+   segments in 'unused' using a block that is freed have their pointers 
+   to auxiliary information set to NULL, so that new auxiliary 
+   information will be assigned if they are reused. */
+
+#ifdef SGGC_FREE_AUX_BLOCKS
+
+/* Find the entries for the (not read-only) aux blocks used by a segment,
+   storing them in b[0] and b[1] (NULL if none). */
+
+static void seg_aux_blocks (sbset_index_t index, struct aux_block_info **b)
+{
+  struct sbset_segment *seg = SBSET_SEGMENT(index);
+  int big = seg->X.Big.big;
+
+# if defined(SGGC_AUX1_READ_ONLY) || defined(SGGC_AUX2_READ_ONLY)
+    sggc_kind_t kind = seg->X.Big.kind;
+# endif
+
+  b[0] = b[1] = NULL;
+
+# ifdef SGGC_AUX1_SIZE
+#   ifdef SGGC_AUX1_READ_ONLY
+    if (kind_aux1_read_only[kind] == NULL)
+#   endif
+    { b[0] = aux_block_find (&aux1_blocks,
+               WITHOUT_OFFSET (sggc_aux1, index, SGGC_AUX1_SIZE)
+                - (big ? 0 : seg->X.Small.aux1_off * SGGC_AUX1_SIZE));
+    }
+# endif
+
+# ifdef SGGC_AUX2_SIZE
+#   ifdef SGGC_AUX2_READ_ONLY
+    if (kind_aux2_read_only[kind] == NULL)
+#   endif
+    { b[1] = aux_block_find (&aux2_blocks,
+               WITHOUT_OFFSET (sggc_aux2, index, SGGC_AUX2_SIZE)
+                - (big ? 0 : seg->X.Small.aux2_off * SGGC_AUX2_SIZE));
+    }
+# endif
+}
+
+/* Note that a segment using aux blocks is entirely free. */
+
+static void aux_count_free (sbset_index_t index)
+{
+  struct aux_block_info *b[2];
+  int j;
+
+  seg_aux_blocks (index, b);
+  for (j = 0; j < 2; j++)
+  { if (b[j] != NULL) b[j]->free_users += 1;
+  }
+}
+
+/* Check whether an entirely free segment uses a block to be freed, and
+   if so, stop it using its aux blocks, returning 1 (else 0). */
+
+static int aux_detach (sbset_index_t index)
+{
+  struct aux_block_info *b[2];
+  int j;
+
+  seg_aux_blocks (index, b);
+  if (! ((b[0] != NULL && b[0]->freeable) || (b[1] != NULL && b[1]->freeable)))
+  { return 0;
+  }
+
+  for (j = 0; j < 2; j++)
+  { if (b[j] != NULL) b[j]->users -= 1;
+  }
+
+# ifdef SGGC_AUX1_SIZE
+    sggc_aux1[index] = (sggc_dptr) NULL;
+# endif
+# ifdef SGGC_AUX2_SIZE
+    sggc_aux2[index] = (sggc_dptr) NULL;
+# endif
+
+  return 1;
+}
+
+/* Decide which blocks in a table are to be freed, after counting free
+   users, given the blocks currently being allocated from for each kind. */
+
+static void aux_find_freeable (struct aux_block_table *t, char **current)
+{
+  int i, k;
+
+  for (i = 0; i < t->n; i++)
+  { struct aux_block_info *e = &t->info[i];
+    e->freeable = e->users == e->free_users;
+    for (k = 0; k < SGGC_N_KINDS && e->freeable; k++)
+    { if (current[k] == e->block) e->freeable = 0;
+    }
+  }
+}
+
+/* Free the blocks in a table that were found to be freeable (which 
+   should no longer have any users), removing their entries. */
+
+static void aux_free_blocks (struct aux_block_table *t, size_t bytes)
+{
+  int i, j;
+
+  j = 0;
+  for (i = 0; i < t->n; i++)
+  { struct aux_block_info *e = &t->info[i];
+    if (e->freeable)
+    { if (EXTRA_CHECKS && e->users != 0) abort();
+      if (SGGC_DEBUG)
+      { printf("sggc_collect: freeing aux block %p\n", e->block);
+      }
+      sggc_mem_free (e->block);
+      MEM_SUB (aux, MEM_SIZE (bytes, bytes));
+    }
+    else
+    { e->free_users = 0;
+      t->info[j++] = *e;
+    }
+  }
+  t->n = j;
+}
+
+void sggc_collect_free_aux (void)
+{
+  sggc_kind_t k;
+  sggc_cptr_t v, w;
+
+  /* Count how many entirely free segments use each block. */
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { for (v = sbset_first (&free_or_new[k], 0); 
+           v != SGGC_NO_OBJECT;
+           v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+      { if (sbset_chain_segment_bits(SGGC_UNUSED_FREE_NEW,v) == kind_full[k])
+        { aux_count_free (SBSET_VAL_INDEX(v));
+        }
+      }
+    }
+  }
+
+  for (v = sbset_first (&unused, 0); 
+       v != SGGC_NO_OBJECT; 
+       v = sbset_chain_next (SGGC_UNUSED_FREE_NEW, v))
+  { if (!aux_was_freed (SBSET_VAL_INDEX(v)))
+    { aux_count_free (SBSET_VAL_INDEX(v));
+    }
+  }
+
+  /* Decide which blocks to free. */
+
+# ifdef SGGC_AUX1_SIZE
+    aux_find_freeable (&aux1_blocks, kind_aux1_block);
+# endif
+# ifdef SGGC_AUX2_SIZE
+    aux_find_freeable (&aux2_blocks, kind_aux2_block);
+# endif
+
+  /* Stop segments from using blocks that will be freed, moving small
+     segments to 'aux_freed'. */
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { 
+      while ((v = sbset_first (&free_or_new[k], 0)) != SGGC_NO_OBJECT
+               && sbset_chain_segment_bits(SGGC_UNUSED_FREE_NEW,v)
+                   == kind_full[k]
+               && aux_detach (SBSET_VAL_INDEX(v)))
+      { sbset_move_first (&free_or_new[k], &aux_freed[k]);
+        if (SGGC_DEBUG)
+        { printf("sggc_collect: put %x in aux_freed\n",(unsigned)v);
+        }
+      }
+
+      if (v == SGGC_NO_OBJECT)
+      { continue;
+      }
+
+      while ((w = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+               != SGGC_NO_OBJECT)
+      { if (sbset_chain_segment_bits(SGGC_UNUSED_FREE_NEW,w) == kind_full[k]
+             && aux_detach (SBSET_VAL_INDEX(w)))
+        { sbset_move_next (&free_or_new[k], v, &aux_freed[k]);
+          if (SGGC_DEBUG)
+          { printf("sggc_collect: put %x in aux_freed\n",(unsigned)w);
+          }
+        }
+        else
+        { v = w;
+        }
+      }
+    }
+  }
+
+  for (v = sbset_first (&unused, 0); 
+       v != SGGC_NO_OBJECT; 
+       v = sbset_chain_next (SGGC_UNUSED_FREE_NEW, v))
+  { if (!aux_was_freed (SBSET_VAL_INDEX(v)))
+    { (void) aux_detach (SBSET_VAL_INDEX(v));
+    }
+  }
+
+  /* Free the blocks, which should now have no users. */
+
+# ifdef SGGC_AUX1_SIZE
+    aux_free_blocks (&aux1_blocks, 
+                     AUX_BLOCK_BYTES (SGGC_AUX1_SIZE, SGGC_AUX1_BLOCK_SIZE));
+# endif
+# ifdef SGGC_AUX2_SIZE
+    aux_free_blocks (&aux2_blocks, 
+                     AUX_BLOCK_BYTES (SGGC_AUX2_SIZE, SGGC_AUX2_BLOCK_SIZE));
+# endif
+}
+
+#endif
+
+
+/* RELEASE MEMORY FOR PAGES OF SMALL DATA AREAS THAT ARE ENTIRELY FREE.
+   Called at the end of a level 2 collection if SGGC_RELEASE_FREE_DATA
+   is defined.  Finds the data areas of small segments with no objects
+   in use, sorts them by address, merges adjacent areas, and applies
+   madvise to the whole pages within each merged area.  The memory usage
+   recorded in sggc_info is reduced by the number of bytes released
+   (after adding back what was released at the previous level 2 
+   collection, which may since have been reused). */
+
+#ifdef SGGC_RELEASE_FREE_DATA
+
+static SGGC_HEAP_VAR size_t released_bytes; /* Bytes released at last lev 2 GC*/
+
+static int cmp_area (const void *a, const void *b)
+{
+  char *x = * (char * const *) a, *y = * (char * const *) b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+void sggc_collect_release_free_data (void)
+{
+  sggc_kind_t k;
+  sggc_cptr_t v;
+  size_t n, i, j;
+  char **areas;
+
+  MEM_ADD (small_data, released_bytes);
+  released_bytes = 0;
+
+  /* Count the entirely free segments, then record their data areas. */
+
+  n = 0;
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { for (v = sbset_first (&free_or_new[k], 0); 
+           v != SGGC_NO_OBJECT;
+           v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+      { if (sbset_chain_segment_bits(SGGC_UNUSED_FREE_NEW,v) == kind_full[k])
+        { n += 1;
+        }
+      }
+#     ifdef SGGC_FREE_AUX_BLOCKS
+        for (v = sbset_first (&aux_freed[k], 0); 
+             v != SGGC_NO_OBJECT;
+             v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+        { n += 1;
+        }
+#     endif
+    }
+  }
+
+  if (n == 0)
+  { return;
+  }
+
+  areas = sggc_mem_alloc (n * sizeof *areas);
+  if (areas == NULL)
+  { return;  /* just don't release anything */
+  }
+
+  i = 0;
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { for (v = sbset_first (&free_or_new[k], 0); 
+           v != SGGC_NO_OBJECT;
+           v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+      { if (sbset_chain_segment_bits(SGGC_UNUSED_FREE_NEW,v) == kind_full[k])
+        { areas[i++] = WITHOUT_OFFSET (sggc_data, SBSET_VAL_INDEX(v), 
+                                       SGGC_CHUNK_SIZE);
+        }
+      }
+#     ifdef SGGC_FREE_AUX_BLOCKS
+        for (v = sbset_first (&aux_freed[k], 0); 
+             v != SGGC_NO_OBJECT;
+             v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v))
+        { areas[i++] = WITHOUT_OFFSET (sggc_data, SBSET_VAL_INDEX(v), 
+                                       SGGC_CHUNK_SIZE);
+        }
+#     endif
+    }
+  }
+
+  qsort (areas, n, sizeof *areas, cmp_area);
+
+  /* Release whole pages within each run of adjacent free data areas. */
+
+  for (i = 0; i < n; i = j)
+  { 
+    char *end = areas[i] + SMALL_DATA_AREA_SIZE;
+    for (j = i+1; j < n && areas[j] == end; j++)
+    { end += SMALL_DATA_AREA_SIZE;
+    }
+
+    uintptr_t lo = ((uintptr_t)areas[i] + SGGC_PAGE_SIZE - 1)
+                     & ~ ((uintptr_t)SGGC_PAGE_SIZE - 1);
+    uintptr_t hi = (uintptr_t)end & ~ ((uintptr_t)SGGC_PAGE_SIZE - 1);
+
+    if (hi > lo && madvise ((void *) lo, hi - lo, SGGC_RELEASE_ADVICE) == 0)
+    { released_bytes += hi - lo;
+      if (SGGC_DEBUG)
+      { printf("sggc_collect: released %p to %p\n",(void*)lo,(void*)hi);
+      }
+    }
+  }
+
+  sggc_mem_free (areas);
+
+  MEM_SUB (small_data, released_bytes);
+}
+
+#endif
+
+/* SORT CHAINS OF SETS INTO ORDER OF SEGMENT INDEX.  Called at the end of
+   a level 2 collection if SGGC_SORT_CHAINS is defined.  Since sbset_add
+   puts segments at the front of a chain, chains otherwise end up in
+   effectively random order, so that passes along them jump around in
+   memory.  Segments are mostly created (and their data areas allocated)
+   in order of increasing index, so after sorting, allocation and later
+   collections pass through memory more sequentially.  Free sets of
+   uncollected kinds are not sorted, since allocation may be part way
+   through them. */
+
+#ifdef SGGC_SORT_CHAINS
+
+void sggc_collect_sort_chains (void)
+{
+  sggc_kind_t k;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { 
+#ifdef SGGC_KIND_UNCOLLECTED
+    if (!sggc_kind_uncollected[k])
+#endif
+    { sbset_sort_chain (&free_or_new[k]);
+    }
+    sbset_sort_chain (&old_gen1[k]);
+    sbset_sort_chain (&old_gen2[k]);
+  }
+
+  sbset_sort_chain (&old_gen1_big);
+  sbset_sort_chain (&old_gen2_big);
+}
+
+#endif
+
+
+/* ORDER FREE SEGMENTS BY HOW MANY FREE OBJECTS THEY HAVE.  Called at the
+   end of a level 2 collection if SGGC_ALLOC_DENSE_FIRST is defined, after
+   which allocation starts at the beginning of free_or_new[k].  Putting
+   segments with few free objects first makes allocation fill segments
+   that are mostly in use before those that are mostly free, so that the
+   latter are more likely to become entirely free, and new objects are
+   packed more densely.  Segments with equal numbers of free objects stay
+   in the same order (eg, by index, if SGGC_SORT_CHAINS is also defined).
+   This is not done at level 0 and 1 collections, since the time for a
+   pass over all free segments would then be significant, and the order
+   found at the last level 2 collection largely persists. */
+
+#ifdef SGGC_ALLOC_DENSE_FIRST
+
+void sggc_collect_order_free (void)
+{
+  sggc_kind_t k;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { 
+#ifdef SGGC_KIND_UNCOLLECTED
+      if (!sggc_kind_uncollected[k])
+#endif
+      { sbset_sort_chain_by_count (&free_or_new[k]);
+      }
+    }
+  }
+}
+
+#endif
+
+
+  /* Call the functions set up with sggc_call_for_object_in_use and
+     sggc_call_for_segment_in_use for objects in a set.  Segments are
+     visited one at a time, with their membership bits, so the
+     per-segment function is called once for each segment with objects
+     in the set.  The number of chunks is found from the segment if nch
+     is zero (for big kinds). */
+
+static void call_in_use_for_set (struct sbset *set, sggc_nchunks_t nch)
+{
+  struct sbset_iter it;
+  sbset_bits_t b;
+
+  sbset_for_each_segment (&it, set, b)
+  { 
+    sbset_index_t index = sbset_iter_index(&it);
+    sggc_cptr_t v = SBSET_VAL(index,0);
+    sggc_nchunks_t n = nch != 0 ? nch : CHUNKS_ALLOCATED(SBSET_SEGMENT(index));
+
+    if (call_for_segment_in_use)
+    { call_for_segment_in_use (v, SGGC_KIND(v), b, n);
+    }
+
+    if (call_for_object_in_use)
+    { while (b != 0)
+      { call_for_object_in_use (SBSET_VAL(index,sbset_first_bit_pos(b)), n);
+        b &= b - 1;
+      }
+    }
+  }
+}
+
+  /* For each kind, set up sggc_next_free_val, and sggc_next_free_bits to 
+     use all of free_or_new.  For uncollected kinds, we just leave these as
+     they were, since nothing was freed in the collection. */
+
+static void set_up_next_free (void)
+{
+  int k;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    {
+#ifdef SGGC_KIND_UNCOLLECTED
+      if (!sggc_kind_uncollected[k])
+#endif
+      { sbset_value_t n = sbset_first (&free_or_new[k], 0);
+        sggc_next_free_val[k] = n;
+        if (n == SGGC_NO_OBJECT)
+        { sggc_next_free_bits[k] = 0;
+        }
+        else 
+        { sggc_next_free_bits[k] 
+            = sbset_chain_segment_bits (SGGC_UNUSED_FREE_NEW, n)
+                >> SBSET_VAL_OFFSET(n);
+        }
+        sggc_next_segment_not_free[k] = 0;
+      }
+    }
+  }
+}
+
+
+/* Record which segments of small kinds in free_or_new may have newly
+   allocated objects, for use when conservatively scanning the stack.
+   Uses the invariant described above for sggc_next_free_val: segments
+   before the one for it in the chain for free_or_new[k] have only
+   newly allocated objects, while segments following it have only free
+   objects, unless sggc_next_segment_not_free[k] is 1.  (Segments put
+   at the front of the chain from old generations hold objects still
+   in use, so are also rightly marked.)  The segment of sggc_next_free_val
+   itself is handled separately, using sggc_next_free_bits. */
+
+#ifdef SGGC_CONSERVATIVE
+
+static void mark_segments_with_new (void)
+{
+  int k;
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
+    { sggc_cptr_t nfv = sggc_next_free_val[k];
+      int has_new = 1;
+      sggc_cptr_t w;
+      for (w = sbset_first (&free_or_new[k], 0);
+           w != SBSET_NO_VALUE;
+           w = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, w))
+      { if (nfv != SGGC_NO_OBJECT 
+             && SBSET_VAL_INDEX(w) == SBSET_VAL_INDEX(nfv))
+        { has_new = sggc_next_segment_not_free[k];
+        }
+        SBSET_SEGMENT(SBSET_VAL_INDEX(w))->X.Small.has_new = has_new;
+      }
+    }
+  }
+}
+
+#endif
+
+void sggc_collect (int level)
+{ 
+  int k;
+
+  if (SGGC_DEBUG) printf("sggc_collect: level %d\n",level);
+  if (SGGC_DEBUG) collect_debug();
+
+  if (sbset_first(&to_look_at, 0) != SBSET_NO_VALUE) abort();
+# ifdef SGGC_MARK_STACK
+    if (mark_stack_top != 0) abort();
+# endif
+
+  collect_level = level;
+
+  /* Record sizes of old generation sets, for pretenuring feedback. */
+
+# ifdef SGGC_PRETENURE_FEEDBACK
+    if (level <= 1)
+    { for (k = 0; k < SGGC_N_KINDS; k++)
+      { kind_gen1_before[k] = sbset_n_elements(&old_gen1[k]);
+        kind_gen2_before[k] = sbset_n_elements(&old_gen2[k]);
+      }
+    }
+# endif
+
+  /* Do preliminary update of big chunk counts, which will be modified 
+     later when some big objects are found to be free. */
+
+  if (level > 0) 
+  { sggc_info.gen2_big_chunks += sggc_info.gen1_big_chunks;
+    sggc_info.gen1_big_chunks = 0;
+  }
+  sggc_info.gen1_big_chunks += sggc_info.gen0_big_chunks;
+  sggc_info.gen0_big_chunks = 0;
+
+  /* Put collected generations in free sets. */
+
+  sggc_collect_put_in_free_or_new();
+
+  /* Handle old-to-new references. */
+
+  sggc_collect_old_to_new();
+
+  /* Get the application to take root pointers out of the free_or_new set,
+     and put them in the to_look_at set. */
+
+  sggc_old_to_new_checking = 0;  /* no special old-to-new processing in
+                                    sggc_look_at */
+# ifdef SGGC_CONSERVATIVE
+    mark_segments_with_new();
+# endif
+  sggc_find_root_ptrs();
+
+  /* Look at objects until no more to see. */
+
+  sggc_collect_look_at();
+
+  /* Call finalizers for registered objects that are now free. */
+
+# ifdef SGGC_FINALIZERS
+    sggc_collect_finalize();
+# endif
+
+  /* Free the mark stack if it grew large in this collection. */
+
+# ifdef SGGC_MARK_STACK
+    release_mark_stack();
+# endif
+
+  /* Handle freed small objects. */
+
+  sggc_collect_remove_free_small();
+
+  /* Handle freed big objects. */
+
+  sggc_collect_remove_free_big();
+
+  /* Free blocks of auxiliary information no longer used, if enabled. */
+
+# ifdef SGGC_FREE_AUX_BLOCKS
+    if (level == 2 && !do_not_reuse_memory)
+    { sggc_collect_free_aux();
+    }
+# endif
+
+  /* Release memory for pages of free small data areas, if enabled. */
+
+# ifdef SGGC_RELEASE_FREE_DATA
+    if (level == 2 && !do_not_reuse_memory)
+    { sggc_collect_release_free_data();
+    }
+# endif
+
+  /* Sort chains into order of segment index, if enabled. */
+
+# ifdef SGGC_SORT_CHAINS
+    if (level == 2)
+    { sggc_collect_sort_chains();
+    }
+# endif
+
+  /* Order free segments to fill those mostly in use first, if enabled. */
+
+# ifdef SGGC_ALLOC_DENSE_FIRST
+    if (level == 2)
+    { sggc_collect_order_free();
+    }
+# endif
+
+  /* Set up for allocating from all of free_or_new. */
+
+  set_up_next_free();
+
+  /* Record allocation count at this collection. */
+
+  sggc_info.allocations_at_last_gc = sggc_info.allocations;
+
+  /* Update counts of how many collections have been done. */
+
+  sggc_info.gc_count[level] += 1;
+
+  if (level == 2)
+  { sggc_info.gc_since_lev2[0] = 0;
+    sggc_info.gc_since_lev2[1] = 0;
+    sggc_info.gc_since_lev12 = 0;
+  }
+  else if (level == 1)
+  { sggc_info.gc_since_lev12 = 0;
+    sggc_info.gc_since_lev2[1] += 1;
+  }
+  else
+  { sggc_info.gc_since_lev2[0] += 1;
+    sggc_info.gc_since_lev12 += 1;
+  }
+
+  /* Update object counts in the info structure (big chunks already updated). */
+
+  sggc_info.gen0_count = 0;
+
+  sggc_info.gen1_count = sbset_n_elements(&old_gen1_big);
+  sggc_info.gen2_count = sbset_n_elements(&old_gen2_big);
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { sggc_info.gen1_count += sbset_n_elements(&old_gen1[k]);
+    sggc_info.gen2_count += sbset_n_elements(&old_gen2[k]);
+  }
+
+  /* Pretenure kinds for which most objects survived a level 0 collection,
+     if doing pretenuring feedback.  Objects surviving are those added to
+     old_gen1[k], since objects in generation 1 aren't collected at level 0.
+     At a level 1 collection, stop pretenuring kinds pretenured by feedback
+     for which too few objects in generation 1 survived, which are those
+     added to old_gen2[k]. */
+
+# ifdef SGGC_PRETENURE_FEEDBACK
+    for (k = 0; k < SGGC_N_KINDS; k++)
+    { if (level == 0 && sggc_kind_chunks[k] != 0 && kind_pretenure[k] == 0
+#         ifdef SGGC_KIND_UNCOLLECTED
+            && !sggc_kind_uncollected[k]
 #         endif
+          && sggc_kind_allocations[k] >= SGGC_PRETENURE_MIN)
+      { unsigned survived = sbset_n_elements(&old_gen1[k]) 
+                             - kind_gen1_before[k];
+        if (100.0 * survived >= 
+              (double) SGGC_PRETENURE_SURVIVAL * sggc_kind_allocations[k])
+        { kind_pretenure[k] = 1;
+          kind_feedback[k] = 1;
           if (SGGC_DEBUG)
-          { printf ("sggc_collect: from find_object_ptrs: %x\n", (unsigned)v);
+          { printf("sggc_collect: pretenuring kind %d (%u of %u survived)\n",
+                    k, survived, sggc_kind_allocations[k]);
           }
-          if (!sbset_chain_contains(SGGC_UNUSED_FREE_NEW,v))
-          { break;
+        }
+      }
+      else if (level == 1 && kind_feedback[k]
+                && kind_gen1_before[k] >= SGGC_PRETENURE_MIN)
+      { unsigned survived = sbset_n_elements(&old_gen2[k]) 
+                             - kind_gen2_before[k];
+        if (100.0 * survived < 
+              (double) SGGC_PRETENURE_RETAIN * kind_gen1_before[k])
+        { kind_pretenure[k] = 0;
+          kind_feedback[k] = 0;
+          if (SGGC_DEBUG)
+          { printf(
+             "sggc_collect: not pretenuring kind %d (%u of %u survived)\n",
+              k, survived, kind_gen1_before[k]);
           }
-          sbset_remove (&free_or_new[SGGC_KIND(v)], v);
-        } 
+        }
       }
-#     else
-      { if (SGGC_DEBUG) printf("sggc_collect: looking at %x\n",(unsigned)v);
-        put_in_right_old_gen (v);
-        sggc_find_object_ptrs (v);
+      sggc_kind_allocations[k] = 0;
+    }
+# endif
+
+#ifdef SGGC_KIND_UNCOLLECTED
+  if (1)  /* not expensive, so maybe keep this consistency check enabled */
+  { unsigned cnt = 0;
+    for (k = 0; k < SGGC_N_KINDS; k++)
+    { if (sggc_kind_uncollected[k])
+      { cnt += sbset_n_elements(&uncollected[k]);
       }
-#     endif
     }
+    if (cnt != sggc_info.uncol_count) 
+    { abort();
+    }
+  }
+#endif
+
+  collect_level = -1;
+
+  /* Call the functions registered to be called for every object or
+     segment with objects still in use. */
+
+  if (call_for_object_in_use || call_for_segment_in_use)
+  { 
+    for (k = 0; k < SGGC_N_KINDS; k++)
+    { call_in_use_for_set (&old_gen1[k], sggc_kind_chunks[k]);
+      call_in_use_for_set (&old_gen2[k], sggc_kind_chunks[k]);
+#ifdef SGGC_KIND_UNCOLLECTED
+      call_in_use_for_set (&uncollected[k], sggc_kind_chunks[k]);
+#endif
+#ifdef SGGC_FREEZE
+      call_in_use_for_set (&frozen[k], sggc_kind_chunks[k]);
+#endif
+    }
+
+    call_in_use_for_set (&old_gen1_big, 0);
+    call_in_use_for_set (&old_gen2_big, 0);
+  }
+
+  if (SGGC_DEBUG) printf("sggc_collect: done\n");
+  if (SGGC_DEBUG) collect_debug();
+}
+
+
+/* ------------------------- APPLICATION INTERFACE -------------------------- */
+
+
+/* TELL THE GARBAGE COLLECTOR THAT AN OBJECT NEEDS TO BE LOOKED AT.
+   Called from the inline sggc_look_at function in sggc.h when the
+   object can't quickly be seen to not need looking at.
+
+   The principal use of this is to mark objects as in use.  If the
+   object is presently in the free_or_new set for its kind, it is
+   removed, and put in the set of objects to be looked at.  (If it is
+   not in free_or_new, it has already been looked at, and so needn't
+   be looked at again.)
+
+   This procedure is also used as part of the old-to-new scheme to
+   check whether an object in the old-to-new set still needs to be
+   there, as well as sometimes marking the objects it points to.  Note
+   that for this purpose, it is essential that for now the objects
+   looked at are just put in 'to_look_at', not put in the old
+   generation where they will eventually end up.  Also note that we
+   cannot test for an object being in generation 0 by checking if it
+   is in 'free_or_new', since it may have already been removed. */
+
+void sggc_look_at_slow (sggc_cptr_t cptr)
+{
+  if (cptr == SGGC_NO_OBJECT)
+  { return;
+  }
+
+# ifdef SGGC_TRACE_CPTR
+    if (cptr == sggc_trace_cptr && !sggc_trace_cptr_in_use)
+    { printf ("TRACED CPTR LOOKED AT WHEN NOT IN USE: %d\n",(int)cptr);
+      abort();
+    }
+#  endif
+
+  if (SGGC_DEBUG) 
+  { printf ("sggc_look_at: %x %d\n", (unsigned)cptr, sggc_old_to_new_checking);
+  }
+
+  if (sggc_old_to_new_checking != 0)
+  { if (sggc_old_to_new_checking < 0)
+    { return;
+    }
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+    else if (sggc_old_to_new_checking == 3) /* ref from uncollected object */
+    { if (!sggc_is_constant(cptr)   /* not to a constant or uncollected obj */
+            && !sggc_never_collected(cptr))
+      { 
+        /* Find the generation the object will be in after this collection
+           (if it survives), from the generation it was in before. */
+
+        int g = sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr) ? 2
+              : sbset_chain_contains (SGGC_OLD_GEN1, cptr) ? 1 : 0;
+        if (g <= collect_level && g < 2)
+        { g += 1;
+        }
+        if (g < uncol_youngest)
+        { uncol_youngest = g;
+        }
+      }
+    }
+#endif
+    else if (collect_level == 0) /* ref won't be from generation 1 */
+    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr)) /* to gen 0 or 1 */
+      { sggc_old_to_new_checking = 0;
+      }
+    }
+    else if (collect_level == 1 && sggc_old_to_new_checking == 2)
+    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr) /* ref is to */
+            && !sbset_chain_contains (SGGC_OLD_GEN1, cptr)) /*   gen 0   */
+      { sggc_old_to_new_checking = 0;
+      }
+    }
+    else /* collect_level == 2 
+             || collect_level == 1 && sggc_old_to_new_checking == 1 */
+    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr) /* ref is to */
+            && !sbset_chain_contains (SGGC_OLD_GEN1, cptr)) /*   gen 0   */
+      { sggc_old_to_new_checking = -1;
+      }
+      return;
+    }
+  }
+
+  if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,cptr)) /* faster than remove */
+  { sbset_remove (&free_or_new[SGGC_KIND(cptr)], cptr);
+    add_to_look_at (cptr);
+    if (SGGC_DEBUG) printf("sggc_look_at: will look at %x\n",(unsigned)cptr);
+  }
+}
+
+
+/* NON-INLINE VERSION OF SGGC_LOOK_AT.  Calls in source code use the
+   inline version in sggc.h, through a macro, but this exists for code
+   compiled with earlier versions of sggc.h, or that takes its address.
+   The parentheses keep the macro from being expanded. */
+
+void (sggc_look_at) (sggc_cptr_t cptr)
+{
+  sggc_look_at_inline (cptr);
+}
+
+
+/* MARK AN OBJECT AS IN USE, BUT DON'T FOLLOW REFERENCES WITHIN IT. */
+
+void sggc_mark (sggc_cptr_t cptr)
+{
+  if (SGGC_DEBUG) printf("sggc_mark: %x\n",(unsigned)cptr);
+
+  if (cptr != SGGC_NO_OBJECT)
+  { if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,cptr)) /* faster than remove*/
+    { sbset_remove (&free_or_new[SGGC_KIND(cptr)], cptr);
+      put_in_right_old_gen (cptr);
+    }
+  }
+}
+
+
+/* CONSERVATIVE SCANNING OF THE STACK FOR COMPRESSED POINTERS.  Done
+   only if SGGC_CONSERVATIVE is defined.  Every properly-aligned word of
+   the size of a compressed pointer in the area scanned is checked for
+   being a compressed pointer to an object that has been allocated and
+   not freed, and sggc_look_at is called for those that are. */
+
+#ifdef SGGC_CONSERVATIVE
+
+#include <setjmp.h>
 
-#   ifdef SGGC_AFTER_MARKING
-    sggc_after_marking (collect_level, rep++);
-#   endif
+/* Don't let address sanitizers complain about reading the whole stack. */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NO_SANITIZE __attribute__ ((no_sanitize_address))
+#else
+#define NO_SANITIZE
+#endif
+
+/* Base of the stack (the end furthest from where the stack top will be),
+   as set by sggc_stack_base.  Thread-local if SGGC_HEAPS is defined,
+   but not part of the saved state of a heap, since it describes a
+   thread, not a heap. */
+
+static SGGC_HEAP_VAR char *stack_base;
 
-  } while (sbset_first (&to_look_at, 0) != SGGC_NO_OBJECT);
+void sggc_stack_base (void *base)
+{
+  stack_base = base;
 }
 
-  /* Remove small objects still in the free_or_new set from the old
-     generations that were collected.  Also remove them from the
-     old-to-new set.  Also calls any functions set up for small kinds
-     with sggc_call_for_newly_freed_object. */
 
-void sggc_collect_remove_free_small (void)
+/* Check whether an object of kind k whose bit is set in the chain for
+   free_or_new is newly allocated rather than free.  Objects of big kinds
+   in free_or_new are all new.  For small kinds, objects in the segment
+   of sggc_next_free_val are new if they precede it or are not indicated
+   as free by sggc_next_free_bits, and for other segments, the has_new
+   flag set by mark_segments_with_new at the start of the collection
+   tells whether they are new.  The time taken is constant. */
+
+static int conservative_new (sggc_cptr_t v, sggc_kind_t k)
+{
+  sggc_cptr_t nfv;
+
+  if (sggc_kind_chunks[k] == 0)
+  { return 1;
+  }
+
+  nfv = sggc_next_free_val[k];
+
+  if (nfv != SGGC_NO_OBJECT && SBSET_VAL_INDEX(nfv) == SBSET_VAL_INDEX(v))
+  { if (SBSET_VAL_OFFSET(v) < SBSET_VAL_OFFSET(nfv))
+    { return 1;
+    }
+    return ((sggc_next_free_bits[k] 
+              >> (SBSET_VAL_OFFSET(v) - SBSET_VAL_OFFSET(nfv))) & 1) == 0;
+  }
+
+  return SBSET_SEGMENT(SBSET_VAL_INDEX(v))->X.Small.has_new;
+}
+
+
+/* Check whether a value is a compressed pointer to an object that has
+   been allocated and not freed (or already looked at in this garbage
+   collection, in which case 0 may be returned). */
+
+static int conservative_valid (sggc_cptr_t v)
 {
+  sbset_index_t index = SBSET_VAL_INDEX(v);
+  struct sbset_segment *seg;
   sggc_kind_t k;
-  sggc_cptr_t v;
+  int nch;
 
-  for (k = 0; k < SGGC_N_KINDS; k++)
-  { 
-    if (sggc_kind_chunks[k] != 0)  /* kind is for small objects */
-    {
-      int (*call)(sggc_cptr_t) = call_for_newly_freed[k];
+  if (v == SGGC_NO_OBJECT || index >= next_segment 
+       || (SGGC_NO_OBJECT == 0 && index == 0))
+  { return 0;
+  }
 
-      /* If a function to call for newly-freed objects has been set up
-         for this kind (with sggc_call_for_newly_freed_object), we
-         need to do a preliminary scan of objects in free_or_new[k] up
-         to the point where we reach objects that were freed before
-         this collection and weren't allocated since (which may now be
-         mixed in with objects that were moved from old generations,
-         if collect_level is greater than zero).  (Note that we also
-         have to handle the case where we've used all of the free set
-         and are now allocating from a single newly-created segment.)
-         If one of these newly-freed objects is in an old generation,
-         we remove it now (but note that this doesn't get all free
-         objects, so we still need the scan done below). 
- 
-         If a cptr is being traced, we always have to do this scan. */
+  /* Check that the offset is where an object of its kind would be. */
 
-#ifdef SGGC_TRACE_CPTR
-      if ((sggc_trace_cptr != SGGC_NO_OBJECT || call)
-#else
-      if (call 
-#endif
-           && (v = sbset_first (&free_or_new[k], 0)) != SGGC_NO_OBJECT)
-      {
-        sggc_cptr_t next_free = sggc_next_free_val[k];
+  seg = SBSET_SEGMENT(index);
+  k = seg->X.Small.kind;  /* == X.Big.kind */
+  nch = sggc_kind_chunks[k];
+  if (nch == 0 ? SBSET_VAL_OFFSET(v) != 0 : SBSET_VAL_OFFSET(v) % nch != 0)
+  { return 0;
+  }
 
-        for (;;)  /* loop over objects allocated since last collection */
-        { 
-          if (v == SGGC_NO_OBJECT)
-          { break;
-          }
+  /* Check that it is in use.  Objects in an old generation, uncollected,
+     or constant are in use; objects only in free_or_new may be free. */
 
-          if (v == next_free)
-          { if (!sggc_next_segment_not_free[k])
-            { break; /* remaining objects not allocated since last collection */
-            }
-            /* remaining objects were allocated since last collection. */
-            v = sbset_chain_next_segment (SGGC_UNUSED_FREE_NEW, v);
-            if (v == SGGC_NO_OBJECT)
-            { break;
-            }
-          }
+  if (sbset_chain_contains (SGGC_OLD_GEN1, v)
+   || sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, v))
+  { return 1;
+  }
 
-          sggc_cptr_t ov = v;
+  return sbset_chain_contains (SGGC_UNUSED_FREE_NEW, v) 
+          && conservative_new (v, k);
+}
 
-          v = sbset_chain_next (SGGC_UNUSED_FREE_NEW, v);
 
-          /* Handle operations done for a newly-freed object, including
-             perhaps finding out that it shouldn't be freed after all. */
-  
-          if (!object_now_free(ov,call))
-          { (void) sbset_remove (&free_or_new[k], ov);
-            put_in_right_old_gen(ov);
-            continue;
-          }
-  
-          /* Remove the object from any old_gen or old_to_new, if it's there.
-             (Otherwise, we'd call the function again below.) */
-  
-          if (collect_level > 0)
-          { if (sbset_remove (&old_gen1[k], ov))
-            { if (SGGC_DEBUG)
-              { printf("sggc_collect: %x in old_gen1 now free\n",(unsigned)ov);
-              }
-              (void) sbset_remove (&old_to_new, ov);
-            }
-            else if (collect_level > 1 && sbset_remove (&old_gen2[k], ov))
-            { if (SGGC_DEBUG)
-              { printf("sggc_collect: %x in old_gen2 now free\n",(unsigned)ov);
-              }
-              (void) sbset_remove (&old_to_new, ov);
-            }
-          }
-        }
+/* Look at possible compressed pointers in an area of memory. */
+
+NO_SANITIZE void sggc_look_at_area (void *start, void *end)
+{
+  uintptr_t a = ((uintptr_t) start + sizeof (sggc_cptr_t) - 1)
+                  & ~(uintptr_t) (sizeof (sggc_cptr_t) - 1);
+
+  for ( ; a + sizeof (sggc_cptr_t) <= (uintptr_t) end; 
+          a += sizeof (sggc_cptr_t))
+  { sggc_cptr_t v = * (sggc_cptr_t *) a;
+    if (conservative_valid (v))
+    { if (SGGC_DEBUG) 
+      { printf ("sggc_look_at_area: found %x\n", (unsigned) v);
       }
+      sggc_look_at (v);
+    }
+  }
+}
 
-      /* Scan the old generation sets, not the free sets (though
-         that's necessary above), since this is likely faster, if lots
-         of objects were allocated but not used for long, and hence
-         are in the free sets. */
 
-#if defined(SGGC_CLEAR_FREE)
-      if (1)
-#elif defined(SGGC_TRACE_CPTR)
-      if (sggc_trace_cptr != SGGC_NO_OBJECT)
+/* Look at possible compressed pointers in the stack, between the base
+   set with sggc_stack_base and the current stack top, and in registers,
+   which are stored in the stack by __builtin_unwind_init (for gcc and
+   clang) and setjmp. */
+
+NO_SANITIZE void sggc_look_at_stack (void)
+{
+  jmp_buf regs;
+  char *top;
+
+  if (stack_base == NULL)
+  { abort();
+  }
+
+# if defined(__GNUC__) || defined(__clang__)
+    __builtin_unwind_init();
+# endif
+  setjmp (regs);
+
+  sggc_look_at_area (regs, (char *) regs + sizeof regs);
+
+  top = (char *) &top;
+  if (top < stack_base)
+  { sggc_look_at_area (top, stack_base);
+  }
+  else
+  { sggc_look_at_area (stack_base, top);
+  }
+}
+
+#endif
+
+
+/* FIND THE FIRST UNCOLLECTED OBJECT OF A GIVEN KIND. */
+
+sggc_cptr_t sggc_first_uncollected_of_kind (sggc_kind_t kind)
+{
+#ifdef SGGC_KIND_UNCOLLECTED
+  return sbset_first (&uncollected[kind], 0);
 #else
-      if (!SGGC_SEGMENT_AT_A_TIME || call_for_newly_freed[k])
+  return SGGC_NO_OBJECT;
 #endif
-      { 
-        /* Do it one object at a time. */
+}
 
-        if (collect_level == 2)
-        { v = sbset_first (&old_gen2[k], 0); 
-          while (v != SBSET_NO_VALUE)
-          { sggc_cptr_t ov = v;
-            v = sbset_chain_next (SGGC_OLD_GEN2_UNCOL, v);
-            if (sbset_chain_contains (SGGC_UNUSED_FREE_NEW, ov))
-            { if (!object_now_free(ov,call))
-              { (void) sbset_remove (&free_or_new[k], ov);
-                put_in_right_old_gen(ov);
-                continue;
-              }
-              if (SGGC_DEBUG)
-              { printf("sggc_collect: %x in old_gen2 now free\n",
-                        (unsigned) ov);
-              }
-              sbset_remove (&old_to_new, ov);
-              sbset_remove (&old_gen2[k], ov);
-            }
-          }
-        }
-    
-        if (collect_level >= 1)
-        { v = sbset_first (&old_gen1[k], 0); 
-          while (v != SBSET_NO_VALUE)
-          { sggc_cptr_t ov = v;
-            v = sbset_chain_next (SGGC_OLD_GEN1, v);
-            if (sbset_chain_contains (SGGC_UNUSED_FREE_NEW, ov))
-            { if (!object_now_free(ov,call))
-              { (void) sbset_remove (&free_or_new[k], ov);
-                put_in_right_old_gen(ov);
-                continue;
-              }
-              if (SGGC_DEBUG)
-              { printf("sggc_collect: %x in old_gen1 now free\n",
-                        (unsigned) ov);
-              }
-              sbset_remove (&old_to_new, ov);
-              sbset_remove (&old_gen1[k], ov);
-            }
-          }
-        }
-      }
-      else 
-      { 
-        /* Do it a segment at a time. */
 
-        if (collect_level == 2)
-        { v = sbset_first(&old_gen2[k], 0); 
-          while (v != SBSET_NO_VALUE)
-          { if (SGGC_DEBUG)
-            { DO_FOR_SEGMENT (SGGC_OLD_GEN2_UNCOL, v, 
-                if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,w))
-                 printf("sggc_collect: %x in old_gen2 now free\n",(unsigned)w));
-            }
-            sggc_cptr_t nv = sbset_chain_next_segment(SGGC_OLD_GEN2_UNCOL,v);
-            sbset_remove_segment (&old_gen2[k], v, SGGC_UNUSED_FREE_NEW);
-            if (sbset_chain_contains_any_in_segment (SGGC_UNUSED_FREE_NEW, v))
-            { sbset_remove_segment (&old_to_new, v, SGGC_UNUSED_FREE_NEW);
-            }
-            v = nv;
-          }
-        }
-    
-        if (collect_level >= 1)
-        { v = sbset_first(&old_gen1[k], 0); 
-          while (v != SBSET_NO_VALUE)
-          { if (SGGC_DEBUG)
-            { DO_FOR_SEGMENT (SGGC_OLD_GEN1, v, 
-                if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,w))
-                 printf("sggc_collect: %x in old_gen1 now free\n",(unsigned)w));
-            }
-            sggc_cptr_t nv = sbset_chain_next_segment(SGGC_OLD_GEN1,v);
-            sbset_remove_segment (&old_gen1[k], v, SGGC_UNUSED_FREE_NEW);
-            if (sbset_chain_contains_any_in_segment (SGGC_UNUSED_FREE_NEW, v))
-            { sbset_remove_segment (&old_to_new, v, SGGC_UNUSED_FREE_NEW);
-            }
-            v = nv;
-          }
-        }
-      }
+/* REGISTER A FUNCTION TO BE CALLED FOR NEWLY-FREED OBJECTS. */
 
-      /* Remove all objects from the free set if we aren't reusing them. */
+void sggc_call_for_newly_freed_object (sggc_kind_t kind,
+                                       int (*fun) (sggc_cptr_t))
+{
+  call_for_newly_freed[kind] = fun;
+}
 
-      if (do_not_reuse_memory)
-      { do
-        { v = sbset_first (&free_or_new[k], 1); 
-        } while (v != SGGC_NO_OBJECT);
-      }
-    }
-  }
+
+/* SET THE FUNCTION TO CALL FOR FREED OBJECTS WITH A FINALIZER REGISTERED,
+   AND REGISTER OR UNREGISTER AN OBJECT. */
+
+#ifdef SGGC_FINALIZERS
+
+void sggc_set_finalizer (int (*fun) (sggc_cptr_t))
+{
+  finalizer = fun;
+}
+
+void sggc_register_finalizer (sggc_cptr_t cptr)
+{
+  sbset_add (&finalize, cptr);
+}
+
+void sggc_unregister_finalizer (sggc_cptr_t cptr)
+{
+  (void) sbset_remove (&finalize, cptr);
+}
+
+#endif
+
+
+/* REGISTER A FUNCTION TO BE CALLED FOR OBJECTS IN USE. */
+
+void sggc_call_for_object_in_use (void (*fun) (sggc_cptr_t,sggc_nchunks_t))
+{
+  call_for_object_in_use = fun;
 }
 
-  /* Remove big objects still in the free_or_new set from the old
-     generations that were collected.  Also remove them from the
-     old-to-new set, put them in 'unused', and free their data storage
-     (but not their auxiliary information).  Also calls any functions
-     set up for big kinds with sggc_call_for_newly_freed_object. */
 
-void sggc_collect_remove_free_big (void)
+
+/* REGISTER A FUNCTION TO BE CALLED FOR SEGMENTS WITH OBJECTS IN USE. */
+
+void sggc_call_for_segment_in_use (void (*fun) (sggc_cptr_t, sggc_kind_t,
+                                                sbset_bits_t, sggc_nchunks_t))
 {
-  sggc_kind_t k;
-  sggc_cptr_t v;
+  call_for_segment_in_use = fun;
+}
 
-  for (k = 0; k < SGGC_N_KINDS; k++)
-  { 
-    if (sggc_kind_chunks[k] == 0)  /* kind is for big objects */
-    { 
-      int (*call)(sggc_cptr_t) = call_for_newly_freed[k];
 
-      /* Scan the free_or_new[k] set (which contains only newly-free
-         objects), which we have to look at to free their data even if
-         they are not in old_gen1_big or old_gen2_big.  Note that since
-         big objects are stored one-per-segment, there is nothing to be
-         gained by trying to do this a segment at a time. */
+/* FREEZE ALL OBJECTS NOW IN USE.  After a full garbage collection,
+   all objects in the old generations are moved to the 'frozen' sets,
+   and are never collected afterwards.  Segments containing frozen
+   objects are marked as frozen, and their free objects are taken out
+   of 'free_or_new', so that they are never used for new objects.
+   Chains are then trimmed of segments with no elements, so that later
+   operations on sets do not write to frozen segments (except when a
+   frozen object is found to have an old-to-new reference). */
 
-      while ((v = sbset_first (&free_or_new[k], 1)) != SGGC_NO_OBJECT)
-      { 
-        /* Handle operations done for a newly-freed object, including
-           perhaps finding out that it shouldn't be freed after all. */
+#ifdef SGGC_FREEZE
 
-        if (!object_now_free(v,call))
-        { put_in_right_old_gen(v);
-          continue;
-        }
+static void trim_chain (struct sbset *set)
+{
+  sbset_value_t v;
 
-        /* Find the number of chunks used by the object. */
+  for (v = sbset_first (set, 0); 
+       v != SBSET_NO_VALUE; 
+       v = sbset_chain_next_segment (sbset_chain(set), v)) ;
+}
 
-        sggc_nchunks_t nch=CHUNKS_ALLOCATED(SBSET_SEGMENT(SBSET_VAL_INDEX(v)));
+void sggc_freeze_heap (void)
+{
+  sggc_cptr_t v;
+  int k;
 
-        /* Remove the object from any old_gen or old_to_new, if it's there.
-           Modify the sggc_info count of chunks accordingly.  (Chunk counts
-           were previously updated for older generations assuming objects
-           will remain in use.) */
+  if (SGGC_DEBUG) printf("sggc_freeze_heap: start\n");
 
-        if (collect_level > 0 && sbset_remove (&old_gen1_big, v))
-        { if (SGGC_DEBUG)
-          { printf("sggc_collect: %x in old_gen1 now free (%d chunks)\n",
-                    (unsigned)v, nch);
-          }
-          (void) sbset_remove (&old_to_new, v);
-          sggc_info.gen2_big_chunks -= nch;
-        }
-        else if (collect_level > 1 && sbset_remove (&old_gen2_big, v))
-        { if (SGGC_DEBUG)
-          { printf("sggc_collect: %x in old_gen2 now free (%d chunks)\n",
-                    (unsigned)v, nch);
-          }
-          (void) sbset_remove (&old_to_new, v);
-          sggc_info.gen2_big_chunks -= nch;
-        }
-        else
-        { if (SGGC_DEBUG)
-          { printf(
-              "sggc_collect: %x that was newly-allocated is free (%d chunks)\n",
-               (unsigned)v, nch);
-          }
-          sggc_info.gen1_big_chunks -= nch;
-        }
+  sggc_collect(2);
 
-        /* Don't free memory or put in 'unused' if we're not reusing memory. */
+  /* Move objects in old generations to the frozen sets.  Whole
+     segments are moved for old generation 2, since a segment may not
+     be in two sets using the same chain.  Objects in old generation 1
+     are then added individually, to segments that are either now in a
+     frozen set for the same kind, or not in any set using the chain. */
 
-        if (do_not_reuse_memory)
-        { continue;
-        }
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { while (sbset_first (&old_gen2[k], 0) != SBSET_NO_VALUE)
+    { sbset_move_first (&old_gen2[k], &frozen[k]);
+    }
+    while ((v = sbset_first (&old_gen1[k], 1)) != SBSET_NO_VALUE)
+    { sbset_add (&frozen[k], v);
+    }
+  }
 
-        /* Free the object's data area, and update memory usage in sggc_info. */
+  while ((v = sbset_first (&old_gen2_big, 1)) != SBSET_NO_VALUE)
+  { sbset_add (&frozen[SGGC_KIND(v)], v);
+  }
+  while ((v = sbset_first (&old_gen1_big, 1)) != SBSET_NO_VALUE)
+  { sbset_add (&frozen[SGGC_KIND(v)], v);
+  }
 
-        if (SGGC_DEBUG) 
-        { printf ("sggc_collect: calling free for data for %x:: %p\n", 
-                   v, SGGC_DATA(v));
-        }
-        struct sbset_segment *seg = SBSET_SEGMENT (SBSET_VAL_INDEX(v));
-        sggc_mem_free (((char *) SGGC_DATA(v)) - (seg->X.Big.align_off << 3));
-        sggc_info.total_mem_usage -= (size_t) SGGC_CHUNK_SIZE * nch;
+  /* Mark newly-frozen segments, removing any free objects in them
+     from free_or_new. */
 
-        /* Put it in 'unused', for later re-use. */
+  sggc_info.frozen_count = 0;
 
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { for (v = sbset_first (&frozen[k], 0); 
+         v != SBSET_NO_VALUE; 
+         v = sbset_chain_next_segment (SGGC_OLD_GEN2_UNCOL, v))
+    { struct sbset_segment *seg = SBSET_SEGMENT(SBSET_VAL_INDEX(v));
+      if (!seg->X.Small.frozen)
+      { seg->X.Small.frozen = 1;
+        if (sbset_chain_segment_bits (SGGC_UNUSED_FREE_NEW, v) != 0)
+        { sbset_assign_segment_bits (&free_or_new[k], v, 0);
+        }
         if (SGGC_DEBUG) 
-        { printf("sggc_collect: putting %x in unused\n",(unsigned)v);
+        { printf("sggc_freeze_heap: segment %x frozen\n", 
+                  (unsigned) SBSET_VAL_INDEX(v));
         }
-        sbset_add(&unused,v); /* allowed since v was removed with sbset_first */
-                              /*   and it was the only value in its segment   */
       }
     }
+    sggc_info.frozen_count += sbset_n_elements (&frozen[k]);
   }
-}
 
-void sggc_collect (int level)
-{ 
-  int k;
+  /* All objects with old-to-new references are now frozen, and refer
+     only to frozen objects (or to constants or uncollected objects),
+     so the old_to_new set can be emptied. */
 
-  if (SGGC_DEBUG) printf("sggc_collect: level %d\n",level);
+  while (sbset_first (&old_to_new, 1) != SBSET_NO_VALUE) ;
+
+  /* Trim chains, and set up for allocating from what remains in
+     free_or_new. */
+
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { trim_chain (&free_or_new[k]);
+  }
+  trim_chain (&to_look_at);
+
+  set_up_next_free();
+
+  /* Update counts in sggc_info. */
+
+  sggc_info.frozen_big_chunks += sggc_info.gen1_big_chunks 
+                                   + sggc_info.gen2_big_chunks;
+  sggc_info.gen1_big_chunks = 0;
+  sggc_info.gen2_big_chunks = 0;
+  sggc_info.gen1_count = 0;
+  sggc_info.gen2_count = 0;
+
+  if (SGGC_DEBUG) printf("sggc_freeze_heap: done\n");
   if (SGGC_DEBUG) collect_debug();
+}
 
-  if (sbset_first(&to_look_at, 0) != SBSET_NO_VALUE) abort();
+#endif
 
-  collect_level = level;
 
-  /* Do preliminary update of big chunk counts, which will be modified 
-     later when some big objects are found to be free. */
+/* SAVE AND LOAD HEAP IMAGES.  An image file has a header, followed by
+   a record for each segment, then the auxiliary information for objects
+   in segments with objects in use (except read-only auxiliary
+   information), and finally (starting at a multiple of SGGC_PAGE_SIZE)
+   the data areas of small segments and of big objects in use.  Since
+   compressed pointers are indexes of segments and offsets within them,
+   no adjustment of pointers is needed when an image is loaded, provided
+   the segments are recreated with the same indexes.  Data areas are
+   mapped into memory from the file (copy-on-write), or read if that
+   fails.  Auxiliary information is copied into newly-allocated space.
+
+   Since the file is written directly from the structures in memory,
+   the header records the configuration (byte order, sizes of structures
+   and types, and the kind tables), and an image whose configuration
+   doesn't match exactly is not loaded. */
+
+#ifdef SGGC_IMAGE
+
+#define IMAGE_MAGIC "SGGCIMG2"
+
+#define IMAGE_BYTE_ORDER 0x01020304  /* Reads differently if order differs */
+
+struct image_config
+{ uint32_t byte_order;         /* IMAGE_BYTE_ORDER as written */
+  uint32_t header_size;        /* Size of struct image_header */
+  uint32_t record_size;        /* Size of struct image_segment */
+  uint32_t cptr_size;          /* Size of sggc_cptr_t (see SGGC_CPTR_64) */
+  uint32_t type_size;          /* Size of sggc_type_t */
+  uint32_t chunk_size;         /* Value of SGGC_CHUNK_SIZE */
+  uint32_t n_types;            /* Value of SGGC_N_TYPES */
+  uint32_t n_kinds;            /* Value of SGGC_N_KINDS */
+  uint32_t offset_bits;        /* Value of SBSET_OFFSET_BITS */
+  uint32_t max_segments;       /* Value of SGGC_MAX_SEGMENTS, or 0 */
+  uint32_t aux1_size;          /* Value of SGGC_AUX1_SIZE, or 0 */
+  uint32_t aux2_size;          /* Value of SGGC_AUX2_SIZE, or 0 */
+  uint64_t kinds_hash;         /* Hash of kind chunks, types, uncollected */
+};
+
+struct image_header
+{ char magic[8];               /* Identifies file as an SGGC image */
+  struct image_config config;  /* Configuration image was saved with */
+  uint32_t n_segments;         /* Number of segment records */
+  uint32_t unused;             /* Zero, for alignment */
+  uint64_t root;               /* Root object passed to sggc_save_image */
+  uint64_t aux_size;           /* Bytes of auxiliary information */
+  uint64_t data_offset;        /* Offset in file of data areas */
+  uint64_t data_size;          /* Total bytes in data areas */
+};
+
+#define IMAGE_UNUSED 0         /* Big segment not being used */
+#define IMAGE_SMALL 1          /* Small segment */
+#define IMAGE_BIG 2            /* Big segment with object in use */
+#define IMAGE_CONSTANT 3       /* Segment of constants (data not saved) */
+#define IMAGE_NONE 4           /* Index not used for a segment (eg, zero) */
+
+struct image_segment
+{ uint32_t what;               /* IMAGE_UNUSED, IMAGE_SMALL, etc. */
+  uint32_t kind;               /* Kind of objects in segment */
+  uint64_t type;               /* Type of objects in segment */
+  uint64_t bits;               /* Objects in use (or constants) */
+  uint64_t nchunks;            /* Chunks in data area for big object */
+  uint64_t data;               /* Offset of data area from data_offset */
+};
+
+/* FIND THE CONFIGURATION TO RECORD IN, OR CHECK AGAINST, AN IMAGE.
+   The kind tables are combined with an FNV-1a hash, with entries for
+   tables not defined left out. */
+
+static uint64_t image_hash (uint64_t h, int v)
+{
+  int i;
 
-  if (level > 0) 
-  { sggc_info.gen2_big_chunks += sggc_info.gen1_big_chunks;
-    sggc_info.gen1_big_chunks = 0;
+  for (i = 0; i < 4; i++)
+  { h = (h ^ ((unsigned) v & 0xff)) * 0x100000001b3;
+    v = (int) ((unsigned) v >> 8);
   }
-  sggc_info.gen1_big_chunks += sggc_info.gen0_big_chunks;
-  sggc_info.gen0_big_chunks = 0;
 
-  /* Put collected generations in free sets. */
+  return h;
+}
 
-  sggc_collect_put_in_free_or_new();
+static void image_config (struct image_config *c)
+{
+  uint64_t h = 0xcbf29ce484222325;
+  int k;
 
-  /* Handle old-to-new references. */
+  memset (c, 0, sizeof *c);
+
+  c->byte_order = IMAGE_BYTE_ORDER;
+  c->header_size = sizeof (struct image_header);
+  c->record_size = sizeof (struct image_segment);
+  c->cptr_size = sizeof (sggc_cptr_t);
+  c->type_size = sizeof (sggc_type_t);
+  c->chunk_size = SGGC_CHUNK_SIZE;
+  c->n_types = SGGC_N_TYPES;
+  c->n_kinds = SGGC_N_KINDS;
+  c->offset_bits = SBSET_OFFSET_BITS;
+# ifdef SGGC_MAX_SEGMENTS
+    c->max_segments = SGGC_MAX_SEGMENTS;
+# endif
+# ifdef SGGC_AUX1_SIZE
+    c->aux1_size = SGGC_AUX1_SIZE;
+# endif
+# ifdef SGGC_AUX2_SIZE
+    c->aux2_size = SGGC_AUX2_SIZE;
+# endif
 
-  sggc_collect_old_to_new();
+  for (k = 0; k < SGGC_N_KINDS; k++)
+  { h = image_hash (h, sggc_kind_chunks[k]);
+#   ifdef SGGC_KIND_TYPES
+      h = image_hash (h, (int) sggc_kind_types[k]);
+#   endif
+#   ifdef SGGC_KIND_UNCOLLECTED
+      h = image_hash (h, sggc_kind_uncollected[k]);
+#   endif
+  }
+  c->kinds_hash = h;
+}
 
-  /* Get the application to take root pointers out of the free_or_new set,
-     and put them in the to_look_at set. */
 
-  old_to_new_check = 0;  /* no special old-to-new processing in sggc_look_at */
-  sggc_find_root_ptrs();
+/* FIND WHICH OBJECTS IN A SEGMENT ARE IN USE, FOR SAVING.  Done after a
+   level 2 collection, when objects in use are all in an old generation,
+   or are uncollected or frozen, all of which use chain SGGC_OLD_GEN1 or
+   SGGC_OLD_GEN2_UNCOL. */
 
-  /* Look at objects until no more to see. */
+static sbset_bits_t image_in_use (sggc_cptr_t v)
+{
+  return sbset_chain_segment_bits (SGGC_OLD_GEN1, v)
+           | sbset_chain_segment_bits (SGGC_OLD_GEN2_UNCOL, v);
+}
 
-  sggc_collect_look_at();
 
-  /* Handle freed small objects. */
+/* FIND THE SIZE OF AUXILIARY INFORMATION SAVED FOR A SEGMENT. */
 
-  sggc_collect_remove_free_small();
+static size_t image_aux_size (sggc_kind_t kind, int big)
+{
+  size_t n = big ? 1 : kind_objects[kind];
+  size_t size = 0;
 
-  /* Handle freed big objects. */
+# ifdef SGGC_AUX1_SIZE
+#   ifdef SGGC_AUX1_READ_ONLY
+    if (kind_aux1_read_only[kind] == NULL)
+#   endif
+    { size += n * SGGC_AUX1_SIZE;
+    }
+# endif
 
-  sggc_collect_remove_free_big();
+# ifdef SGGC_AUX2_SIZE
+#   ifdef SGGC_AUX2_READ_ONLY
+    if (kind_aux2_read_only[kind] == NULL)
+#   endif
+    { size += n * SGGC_AUX2_SIZE;
+    }
+# endif
 
-  /* For each kind, set up sggc_next_free_val, and sggc_next_free_bits to 
-     use all of free_or_new.  For uncollected kinds, we just leave these as
-     they were, since nothing was freed in the collection. */
+  return size;
+}
 
-  for (k = 0; k < SGGC_N_KINDS; k++)
-  { if (sggc_kind_chunks[k] != 0)  /* kind uses small segments */
-    {
-#ifdef SGGC_KIND_UNCOLLECTED
-      if (!sggc_kind_uncollected[k])
-#endif
-      { sbset_value_t n = sbset_first (&free_or_new[k], 0);
-        sggc_next_free_val[k] = n;
-        if (n == SGGC_NO_OBJECT)
-        { sggc_next_free_bits[k] = 0;
-        }
-        else 
-        { sggc_next_free_bits[k] 
-            = sbset_chain_segment_bits (SGGC_UNUSED_FREE_NEW, n)
-                >> SBSET_VAL_OFFSET(n);
-        }
-        sggc_next_segment_not_free[k] = 0;
+
+/* COPY AUXILIARY INFORMATION FOR A SEGMENT TO OR FROM A BUFFER.  The
+   buffer pointer is advanced past the information copied. */
+
+static void image_aux_copy (sbset_index_t index, sggc_kind_t kind, int big,
+                            char **buf, int to_buf)
+{
+  int n = big ? 1 : kind_objects[kind];
+  int i;
+
+  for (i = 0; i < n; i++)
+  { sggc_cptr_t v = SGGC_CPTR_VAL (index, i * sggc_kind_chunks[kind]);
+#   ifdef SGGC_AUX1_SIZE
+#     ifdef SGGC_AUX1_READ_ONLY
+      if (kind_aux1_read_only[kind] == NULL)
+#     endif
+      { if (to_buf) memcpy (*buf, SGGC_AUX1(v), SGGC_AUX1_SIZE);
+        else        memcpy (SGGC_AUX1(v), *buf, SGGC_AUX1_SIZE);
+        *buf += SGGC_AUX1_SIZE;
       }
-    }
+#   endif
+#   ifdef SGGC_AUX2_SIZE
+#     ifdef SGGC_AUX2_READ_ONLY
+      if (kind_aux2_read_only[kind] == NULL)
+#     endif
+      { if (to_buf) memcpy (*buf, SGGC_AUX2(v), SGGC_AUX2_SIZE);
+        else        memcpy (SGGC_AUX2(v), *buf, SGGC_AUX2_SIZE);
+        *buf += SGGC_AUX2_SIZE;
+      }
+#   endif
   }
+}
 
-  /* Record allocation count at this collection. */
 
-  sggc_info.allocations_at_last_gc = sggc_info.allocations;
+/* SAVE AN IMAGE OF ALL OBJECTS IN USE.  Does a level 2 collection first.
+   Returns 0 if the image was written successfully, -1 if not. */
 
-  /* Update counts of how many collections have been done. */
+int sggc_save_image (const char *path, sggc_cptr_t root)
+{
+  struct image_header hdr;
+  struct image_segment *recs;
+  char *aux, *a;
+  sbset_index_t index;
+  uint64_t data_pos;
+  FILE *f;
+  int ok;
+
+  sggc_collect(2);
+
+  recs = sggc_mem_alloc_zero ((next_segment + 1) * sizeof *recs);
+  if (recs == NULL)
+  { return -1;
+  }
 
-  sggc_info.gc_count[level] += 1;
+  /* Set up records for the segments, and find the sizes of auxiliary
+     information and data areas. */
 
-  if (level == 2)
-  { sggc_info.gc_since_lev2[0] = 0;
-    sggc_info.gc_since_lev2[1] = 0;
-    sggc_info.gc_since_lev12 = 0;
-  }
-  else if (level == 1)
-  { sggc_info.gc_since_lev12 = 0;
-    sggc_info.gc_since_lev2[1] += 1;
-  }
-  else
-  { sggc_info.gc_since_lev2[0] += 1;
-    sggc_info.gc_since_lev12 += 1;
-  }
+  memset (&hdr, 0, sizeof hdr);
+  memcpy (hdr.magic, IMAGE_MAGIC, sizeof hdr.magic);
 
-  /* Update object counts in the info structure (big chunks already updated). */
+  data_pos = 0;
 
-  sggc_info.gen0_count = 0;
+  for (index = 0; index < next_segment; index++)
+  { struct sbset_segment *seg = SBSET_SEGMENT(index);
+    struct image_segment *r = &recs[index];
+    sggc_cptr_t v = SGGC_CPTR_VAL(index,0);
 
-  sggc_info.gen1_count = sbset_n_elements(&old_gen1_big);
-  sggc_info.gen2_count = sbset_n_elements(&old_gen2_big);
-  for (k = 0; k < SGGC_N_KINDS; k++)
-  { sggc_info.gen1_count += sbset_n_elements(&old_gen1[k]);
-    sggc_info.gen2_count += sbset_n_elements(&old_gen2[k]);
-  }
+    if (seg == NULL)
+    { r->what = IMAGE_NONE;
+      continue;
+    }
 
-#ifdef SGGC_KIND_UNCOLLECTED
-  if (1)  /* not expensive, so maybe keep this consistency check enabled */
-  { unsigned cnt = 0;
-    for (k = 0; k < SGGC_N_KINDS; k++)
-    { if (sggc_kind_uncollected[k])
-      { cnt += sbset_n_elements(&uncollected[k]);
+    r->kind = seg->X.Small.kind;
+    r->type = sggc_type[index];
+
+    if (seg->X.Small.constant)
+    { r->what = IMAGE_CONSTANT;
+      r->bits = sbset_chain_segment_bits (SGGC_OLD_GEN2_UNCOL, v);
+      continue;
+    }
+
+    r->bits = image_in_use (v);
+
+    if (seg->X.Big.big)
+    { if (r->bits == 0)
+      { r->what = IMAGE_UNUSED;
+        continue;
       }
+      r->what = IMAGE_BIG;
+      r->nchunks = CHUNKS_ALLOCATED(seg);
+      data_pos = IMAGE_ROUND (data_pos);
+      r->data = data_pos;
+      data_pos += (uint64_t) SGGC_CHUNK_SIZE * r->nchunks;
     }
-    if (cnt != sggc_info.uncol_count) 
-    { abort();
+    else
+    { r->what = IMAGE_SMALL;
+      data_pos = IMAGE_ROUND (data_pos);
+      r->data = data_pos;
+      data_pos += SMALL_DATA_AREA_SIZE;
+    }
+
+    if (r->bits != 0)
+    { hdr.aux_size += image_aux_size (r->kind, r->what == IMAGE_BIG);
     }
   }
-#endif
 
-  collect_level = -1;
+  image_config (&hdr.config);
+  hdr.n_segments = next_segment;
+  hdr.root = root;
+  hdr.data_size = data_pos;
+  hdr.data_offset = sizeof hdr + next_segment * sizeof *recs + hdr.aux_size;
+  hdr.data_offset = (hdr.data_offset + SGGC_PAGE_SIZE - 1) 
+                      & ~(uint64_t) (SGGC_PAGE_SIZE - 1);
 
-  /* Call the function registered to be called for every object still in use. */
+  /* Gather auxiliary information. */
 
-  if (call_for_object_in_use)
-  { 
-    sggc_cptr_t v;
+  aux = sggc_mem_alloc (hdr.aux_size + 1);
+  if (aux == NULL)
+  { sggc_mem_free (recs);
+    return -1;
+  }
 
-    for (k = 0; k < SGGC_N_KINDS; k++)
-    { sggc_nchunks_t nch = sggc_kind_chunks[k];
-      for (v = sbset_first(&old_gen1[k],0); 
-           v != SGGC_NO_OBJECT;
-           v = sbset_chain_next(SGGC_OLD_GEN1,v))
-      { call_for_object_in_use (v, nch != 0 ? nch 
-          : CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v))));
-      }
-      for (v = sbset_first(&old_gen2[k],0); 
-           v != SGGC_NO_OBJECT;
-           v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
-      { call_for_object_in_use (v, nch != 0 ? nch 
-          : CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v))));
+  a = aux;
+  for (index = 0; index < next_segment; index++)
+  { if (recs[index].what != IMAGE_CONSTANT && recs[index].what != IMAGE_NONE
+         && recs[index].bits != 0)
+    { image_aux_copy (index, recs[index].kind, recs[index].what == IMAGE_BIG,
+                      &a, 1);
+    }
+  }
+
+  /* Write the file. */
+
+  ok = 0;
+  f = fopen (path, "wb");
+
+  if (f != NULL
+   && fwrite (&hdr, sizeof hdr, 1, f) == 1
+   && fwrite (recs, sizeof *recs, next_segment, f) == (size_t) next_segment
+   && fwrite (aux, 1, hdr.aux_size, f) == hdr.aux_size)
+  { 
+    ok = 1;
+    for (index = 0; ok && index < next_segment; index++)
+    { struct image_segment *r = &recs[index];
+      size_t size;
+      if (r->what == IMAGE_SMALL)
+      { size = SMALL_DATA_AREA_SIZE;
       }
-#ifdef SGGC_KIND_UNCOLLECTED
-      for (v = sbset_first(&uncollected[k],0); 
-           v != SGGC_NO_OBJECT;
-           v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
-      { call_for_object_in_use (v, nch != 0 ? nch 
-          : CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v))));
+      else if (r->what == IMAGE_BIG)
+      { size = (size_t) SGGC_CHUNK_SIZE * r->nchunks;
       }
-#endif
+      else
+      { continue;
+      }
+      ok = file_seek (f, hdr.data_offset + r->data) == 0
+            && fwrite (WITHOUT_OFFSET (sggc_data, index, SGGC_CHUNK_SIZE),
+                       1, size, f) == size;
     }
+  }
 
-    for (v = sbset_first(&old_gen1_big,0); 
-         v != SGGC_NO_OBJECT;
-         v = sbset_chain_next(SGGC_OLD_GEN1,v))
-    { call_for_object_in_use (v, 
-        CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v))));
-    }
-    for (v = sbset_first(&old_gen2_big,0); 
-         v != SGGC_NO_OBJECT;
-         v = sbset_chain_next(SGGC_OLD_GEN2_UNCOL,v))
-    { call_for_object_in_use (v, 
-        CHUNKS_ALLOCATED (SBSET_SEGMENT (SBSET_VAL_INDEX(v))));
-    }
+  if (f != NULL && fclose (f) != 0)
+  { ok = 0;
   }
 
-  if (SGGC_DEBUG) printf("sggc_collect: done\n");
-  if (SGGC_DEBUG) collect_debug();
+  sggc_mem_free (aux);
+  sggc_mem_free (recs);
+
+  if (SGGC_DEBUG) 
+  { printf ("sggc_save_image: %s %s (%u segments)\n", 
+             ok ? "saved" : "failed to save", path, (unsigned) next_segment);
+  }
+
+  return ok ? 0 : -1;
 }
 
 
-/* ------------------------- APPLICATION INTERFACE -------------------------- */
+/* LOAD AN IMAGE.  Must be called after sggc_init, before any objects
+   are allocated, but after any constants in the saved image have been
+   created again, in the same order.  Objects in the image are made to
+   be in old generation 2, or uncollected, according to their kind.
+   Returns 0 if successful, with the saved root stored in *root, or -1
+   if the image could not be loaded.  A failure after segments have
+   started to be created is fatal (abort is called). */
 
+int sggc_load_image (const char *path, sggc_cptr_t *root)
+{
+  struct image_header hdr;
+  struct image_config config;
+  struct image_segment *recs;
+  char *aux, *a, *data;
+  sbset_index_t index;
+  int mapped;
+  FILE *f;
+
+  if (image_data != NULL)
+  { return -1;
+  }
 
-/* TELL THE GARBAGE COLLECTOR THAT AN OBJECT NEEDS TO BE LOOKED AT.
+  f = fopen (path, "rb");
+  if (f == NULL)
+  { return -1;
+  }
 
-   The principal use of this is to mark objects as in use.  If the
-   object is presently in the free_or_new set for its kind, it is
-   removed, and put in the set of objects to be looked at.  (If it is
-   not in free_or_new, it has already been looked at, and so needn't
-   be looked at again.)
+  /* Read and check the header, including that the configuration is the
+     same as when the image was saved. */
 
-   This procedure is also used as part of the old-to-new scheme to
-   check whether an object in the old-to-new set still needs to be
-   there, as well as sometimes marking the objects it points to.  Note
-   that for this purpose, it is essential that for now the objects
-   looked at are just put in 'to_look_at', not put in the old
-   generation where they will eventually end up.  Also note that we
-   cannot test for an object being in generation 0 by checking if it
-   is in 'free_or_new', since it may have already been removed. */
+  image_config (&config);
 
-void sggc_look_at (sggc_cptr_t cptr)
-{
-  if (cptr == SGGC_NO_OBJECT)
-  { return;
+  if (fread (&hdr, sizeof hdr, 1, f) != 1
+   || memcmp (hdr.magic, IMAGE_MAGIC, sizeof hdr.magic) != 0
+   || memcmp (&hdr.config, &config, sizeof config) != 0
+   || hdr.n_segments > (uint32_t) maximum_segments
+   || hdr.n_segments < (uint32_t) next_segment)
+  { fclose (f);
+    return -1;
   }
 
-# ifdef SGGC_TRACE_CPTR
-    if (cptr == sggc_trace_cptr && !sggc_trace_cptr_in_use)
-    { printf ("TRACED CPTR LOOKED AT WHEN NOT IN USE: %d\n",cptr);
-      abort();
-    }
-#  endif
+  /* Read the segment records and auxiliary information, and check that
+     segments that already exist are matching constants. */
 
-  if (SGGC_DEBUG) 
-  { printf ("sggc_look_at: %x %d\n", (unsigned)cptr, old_to_new_check);
+  recs = sggc_mem_alloc ((hdr.n_segments + 1) * sizeof *recs);
+  aux = sggc_mem_alloc (hdr.aux_size + 1);
+
+  if (recs == NULL || aux == NULL
+   || fread (recs, sizeof *recs, hdr.n_segments, f) != hdr.n_segments
+   || fread (aux, 1, hdr.aux_size, f) != hdr.aux_size)
+  { goto fail;
   }
 
-  if (old_to_new_check != 0)
-  { if (old_to_new_check < 0)
-    { return;
+  for (index = 0; (uint32_t) index < hdr.n_segments; index++)
+  { struct image_segment *r = &recs[index];
+    if (r->kind >= SGGC_N_KINDS || r->type >= SGGC_N_TYPES)
+    { goto fail;
     }
-#ifdef SGGC_KIND_UNCOLLECTED
-    else if (old_to_new_check == 3) /* reference from an uncollected object */
-    { if (!sggc_is_constant(cptr)   /* not to a constant or uncollected obj */
-            && !sggc_kind_uncollected[SGGC_KIND(cptr)])
-      { old_to_new_check = 0;
+    if (index < next_segment)
+    { struct sbset_segment *seg = SBSET_SEGMENT(index);
+      if (seg == NULL)
+      { if (r->what != IMAGE_NONE)
+        { goto fail;
+        }
       }
-    }
-#endif
-    else if (collect_level == 0) /* ref won't be from generation 1 */
-    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr)) /* to gen 0 or 1 */
-      { old_to_new_check = 0;
+      else if (r->what != IMAGE_CONSTANT || !seg->X.Small.constant
+       || seg->X.Small.kind != r->kind || sggc_type[index] != r->type
+       || sbset_chain_segment_bits (SGGC_OLD_GEN2_UNCOL, 
+                                    SGGC_CPTR_VAL(index,0)) != r->bits)
+      { goto fail;
       }
     }
-    else if (collect_level == 1 && old_to_new_check == 2)
-    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr) /* ref is to */
-            && !sbset_chain_contains (SGGC_OLD_GEN1, cptr)) /*   gen 0   */
-      { old_to_new_check = 0;
-      }
+    else if (r->what == IMAGE_CONSTANT || r->what == IMAGE_NONE)
+    { goto fail;
     }
-    else /* collect_level==2 || collect_level == 1 && old_to_new_check == 1 */
-    { if (!sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, cptr) /* ref is to */
-            && !sbset_chain_contains (SGGC_OLD_GEN1, cptr)) /*   gen 0   */
-      { old_to_new_check = -1;
+  }
+
+  /* Map the data areas into memory, or read them if that fails. */
+
+  data = NULL;
+  mapped = 0;
+  if (hdr.data_size != 0)
+  { data = mmap (NULL, hdr.data_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                 fileno(f), (off_t) hdr.data_offset);
+    mapped = data != MAP_FAILED;
+    if (data == MAP_FAILED)
+    { data = sggc_mem_alloc (hdr.data_size);
+      if (data == NULL 
+       || file_seek (f, hdr.data_offset) != 0
+       || fread (data, 1, hdr.data_size, f) != hdr.data_size)
+      { goto fail;
       }
-      return;
     }
   }
 
-  if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,cptr)) /* faster than remove */
-  { sbset_remove (&free_or_new[SGGC_KIND(cptr)], cptr);
-    sbset_add (&to_look_at, cptr);
-    if (SGGC_DEBUG) printf("sggc_look_at: will look at %x\n",(unsigned)cptr);
-  }
-}
+  fclose (f);
+  f = NULL;
 
+  image_data = data;
+  image_data_size = hdr.data_size;
+  image_data_mapped = mapped;
 
-/* MARK AN OBJECT AS IN USE, BUT DON'T FOLLOW REFERENCES WITHIN IT. */
+  /* Create segments for those in the image, putting objects in use in 
+     old generation 2 (or uncollected), and other objects in small
+     segments in free_or_new.  Uncollected objects are put in the set 
+     of those that may refer to generation 2, since any such references 
+     were not recorded. */
 
-void sggc_mark (sggc_cptr_t cptr)
-{
-  if (SGGC_DEBUG) printf("sggc_mark: %x\n",(unsigned)cptr);
+  a = aux;
 
-  if (cptr != SGGC_NO_OBJECT)
-  { if (sbset_chain_contains(SGGC_UNUSED_FREE_NEW,cptr)) /* faster than remove*/
-    { sbset_remove (&free_or_new[SGGC_KIND(cptr)], cptr);
-      put_in_right_old_gen (cptr);
+  for (index = next_segment; (uint32_t) index < hdr.n_segments; index++)
+  { struct image_segment *r = &recs[index];
+    sggc_kind_t kind = r->kind;
+    int big = r->what != IMAGE_SMALL;
+    sggc_cptr_t v = SGGC_CPTR_VAL(index,0);
+    struct sbset_segment *seg;
+    struct sbset *set;
+
+    if (get_aux_blocks (kind) < 0 || new_segment() != index)
+    { abort();
     }
-  }
-}
 
+    seg = SBSET_SEGMENT(index);
+    seg->X.Big.big = big;
+    seg->X.Big.kind = kind;
+    sggc_type[index] = r->type;
 
-/* FIND THE FIRST UNCOLLECTED OBJECT OF A GIVEN KIND. */
+    assign_aux (kind, index, seg, v, big);
+    if (r->bits != 0)
+    { image_aux_copy (index, kind, big, &a, 0);
+    }
 
-sggc_cptr_t sggc_first_uncollected_of_kind (sggc_kind_t kind)
-{
-#ifdef SGGC_KIND_UNCOLLECTED
-  return sbset_first (&uncollected[kind], 0);
-#else
-  return SGGC_NO_OBJECT;
-#endif
-}
+    if (r->what == IMAGE_UNUSED)
+    { sggc_data[index] = (sggc_dptr) NULL;
+      OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
+      sbset_add (&unused, v);
+      continue;
+    }
 
+    sggc_data[index] = (sggc_dptr) (data + r->data);
+    OFFSET(sggc_data,index,SGGC_CHUNK_SIZE);
 
-/* REGISTER A FUNCTION TO BE CALLED FOR NEWLY-FREED OBJECTS. */
+    if (big)
+    { sggc_nchunks_t nch = r->nchunks;
+      if (nch < HUGE_CHUNKS)
+      { seg->X.Big.alloc_chunks = nch;
+        seg->X.Big.huge = 0;
+      }
+      else
+      { seg->X.Big.alloc_chunks = nch >> SGGC_HUGE_SHIFT;
+        seg->X.Big.huge = 1;
+      }
+      seg->X.Big.align_off = 0;
+      MEM_ADD (big_data, MEM_SIZE ((size_t) SGGC_CHUNK_SIZE * nch,
+                      (size_t) SGGC_CHUNK_SIZE * nch + BIG_ALIGN_EXTRA));
+    }
+    else
+    { MEM_ADD (small_data, SMALL_DATA_AREA_SIZE);
+    }
 
-void sggc_call_for_newly_freed_object (sggc_kind_t kind,
-                                       int (*fun) (sggc_cptr_t))
-{
-  call_for_newly_freed[kind] = fun;
-}
+    set = big ? &old_gen2_big : &old_gen2[kind];
+#   ifdef SGGC_KIND_UNCOLLECTED
+      if (sggc_kind_uncollected[kind])
+      { set = &uncollected[kind];
+      }
+#   endif
+
+    if (r->bits != 0)
+    { sbset_add (set, v);
+      sbset_assign_segment_bits (set, v, r->bits);
+#     ifdef SGGC_KIND_UNCOLLECTED
+        if (set == &uncollected[kind])
+        { sbset_add (&uncol_old_to_new[2], v);
+          sbset_assign_segment_bits (&uncol_old_to_new[2], v, r->bits);
+          sggc_info.uncol_count += sbset_bit_count (r->bits);
+          if (big) sggc_info.uncol_big_chunks += r->nchunks;
+        }
+        else
+#     endif
+      { sggc_info.gen2_count += sbset_bit_count (r->bits);
+        if (big) sggc_info.gen2_big_chunks += r->nchunks;
+      }
+    }
 
+    if (!big && set == &old_gen2[kind] && (kind_full[kind] & ~r->bits) != 0)
+    { sbset_add (&free_or_new[kind], v);
+      sbset_assign_segment_bits (&free_or_new[kind], v, 
+                                 kind_full[kind] & ~r->bits);
+    }
+  }
 
-/* REGISTER A FUNCTION TO BE CALLED FOR OBJECTS IN USE. */
+  set_up_next_free();
 
-void sggc_call_for_object_in_use (void (*fun) (sggc_cptr_t,sggc_nchunks_t))
-{
-  call_for_object_in_use = fun;
+  *root = hdr.root;
+
+  sggc_mem_free (aux);
+  sggc_mem_free (recs);
+
+  if (SGGC_DEBUG) 
+  { printf ("sggc_load_image: loaded %s (%u segments)\n", 
+             path, (unsigned) hdr.n_segments);
+    collect_debug();
+  }
+
+  return 0;
+
+fail:
+
+  if (f != NULL)
+  { fclose (f);
+  }
+  sggc_mem_free (aux);
+  sggc_mem_free (recs);
+
+  return -1;
 }
 
+#endif
 
 
 /* ENABLE OR DISABLE SUPPRESSION OF MEMORY REUSE. */
@@ -2230,7 +5470,7 @@ void sggc_no_reuse (int enable)
 
 sggc_cptr_t sggc_check_valid_cptr (sggc_cptr_t cptr)
 {
-  unsigned index = SGGC_SEGMENT_INDEX(cptr);
+  sbset_index_t index = SGGC_SEGMENT_INDEX(cptr);
   if (index >= next_segment)
   { abort();
   }
@@ -2250,3 +5490,350 @@ sggc_cptr_t sggc_check_valid_cptr (sggc_cptr_t cptr)
 
   return cptr;
 }
+
+
+/* ---------------------------- MULTIPLE HEAPS ------------------------------ */
+
+#ifdef SGGC_HEAPS
+
+/* STRUCTURE HOLDING THE SAVED STATE OF A HEAP THAT IS NOT CURRENT.  The
+   state of the current heap of a thread is in the thread-local global
+   variables above.  A heap that is current for no thread has its state
+   saved in a struct sggc_heap, as a copy of each of these variables, in
+   the order in which heap_state handles them. */
+
+struct sggc_heap
+{ int current;    /* Non-zero if the heap is current for some thread */
+  char state[];   /* Saved state, of size found with heap_state */
+};
+
+static SGGC_HEAP_VAR sggc_heap_t current_heap; /* NULL if thread's initial
+                                                  heap, not yet saved */
+
+
+/* SAVE, RESTORE, OR RESET THE STATE OF THE CURRENT HEAP.  Copies to or
+   from 'buf', or resets the state to that of a heap for which sggc_init
+   has not yet been called.  Returns the number of bytes of state. */
+
+#define HEAP_SIZE  0  /* Just find size of state */
+#define HEAP_SAVE  1  /* Copy state of current heap to buf */
+#define HEAP_LOAD  2  /* Copy state in buf to the current heap */
+#define HEAP_RESET 3  /* Reset state to its initial values */
+
+static size_t heap_state (char *buf, int op)
+{
+  size_t n = 0;
+
+# define STATE(v) \
+    do { \
+      if (op == HEAP_SAVE) memcpy (buf+n, &(v), sizeof(v)); \
+      else if (op == HEAP_LOAD) memcpy (&(v), buf+n, sizeof(v)); \
+      else if (op == HEAP_RESET) memset (&(v), 0, sizeof(v)); \
+      n += sizeof(v); \
+    } while (0)
+
+  /* Variables declared in sggc.h and sbset-app.h. */
+
+  STATE(sggc_segment);
+  STATE(sggc_data);
+# ifdef SGGC_AUX1_SIZE
+    STATE(sggc_aux1);
+# endif
+# ifdef SGGC_AUX2_SIZE
+    STATE(sggc_aux2);
+# endif
+  STATE(sggc_type);
+  STATE(sggc_info);
+# ifdef SGGC_PRETENURE_FEEDBACK
+    STATE(sggc_kind_allocations);
+# endif
+
+  /* Variables declared in this file. */
+
+# ifdef SGGC_IMAGE
+    STATE(image_data);
+    STATE(image_data_size);
+    STATE(image_data_mapped);
+# endif
+  STATE(heap_mem_list);
+  STATE(kind_objects);
+  STATE(kind_chunk_end);
+# ifdef SGGC_AUX1_SIZE
+    STATE(kind_aux1_block);
+    STATE(kind_aux1_block_pos);
+# endif
+# ifdef SGGC_AUX2_SIZE
+    STATE(kind_aux2_block);
+    STATE(kind_aux2_block_pos);
+# endif
+# ifdef SGGC_AUX1_READ_ONLY
+    STATE(kind_aux1_read_only);
+# endif
+# ifdef SGGC_AUX2_READ_ONLY
+    STATE(kind_aux2_read_only);
+# endif
+# ifdef SGGC_FREE_AUX_BLOCKS
+#   ifdef SGGC_AUX1_SIZE
+      STATE(aux1_blocks);
+#   endif
+#   ifdef SGGC_AUX2_SIZE
+      STATE(aux2_blocks);
+#   endif
+# endif
+# if SGGC_SEG_BLOCKING > 1
+    STATE(seg_block);
+    STATE(seg_block_remaining);
+# endif
+  STATE(small_data_area_next);
+  STATE(small_data_area_end);
+  STATE(kind_full);
+# ifdef SGGC_MEDIUM_OBJECTS
+    STATE(medium_chunks);
+    STATE(medium_free);
+    STATE(medium_next);
+    STATE(medium_end);
+# endif
+# ifdef SGGC_EXTERNAL
+    STATE(external);
+# endif
+  STATE(kind_pretenure);
+# ifdef SGGC_PRETENURE_FEEDBACK
+    STATE(kind_gen1_before);
+    STATE(kind_gen2_before);
+    STATE(kind_feedback);
+# endif
+
+  STATE(free_or_new);
+  STATE(unused);
+  STATE(old_gen1);
+  STATE(old_gen1_big);
+  STATE(old_gen2);
+  STATE(old_gen2_big);
+  STATE(old_to_new);
+  STATE(to_look_at);
+# ifdef SGGC_MARK_STACK
+    STATE(mark_stack);
+    STATE(mark_stack_size);
+    STATE(mark_stack_top);
+# endif
+  STATE(constants);
+# ifdef SGGC_FREE_AUX_BLOCKS
+    STATE(aux_freed);
+# endif
+# ifdef SGGC_FINALIZERS
+    STATE(finalize);
+# endif
+# ifdef SGGC_FREEZE
+    STATE(frozen);
+# endif
+# ifdef SGGC_KIND_UNCOLLECTED
+    STATE(uncollected);
+# endif
+# ifdef SGGC_UNCOL_OLD_TO_NEW
+    STATE(uncol_old_to_new);
+# endif
+
+  STATE(call_for_newly_freed);
+# ifdef SGGC_FINALIZERS
+    STATE(finalizer);
+# endif
+  STATE(call_for_object_in_use);
+  STATE(call_for_segment_in_use);
+
+  STATE(sggc_next_free_val);
+  STATE(sggc_next_free_bits);
+  STATE(sggc_next_segment_not_free);
+
+  STATE(maximum_segments);
+  STATE(next_segment);
+  STATE(collect_level);
+  STATE(sggc_old_to_new_checking);
+# ifdef SGGC_UNCOL_OLD_TO_NEW
+    STATE(uncol_youngest);
+# endif
+  STATE(do_not_reuse_memory);
+  STATE(soft_limit);
+  STATE(soft_limit_collect);
+  STATE(soft_limit_reached);
+# ifdef SGGC_RELEASE_FREE_DATA
+    STATE(released_bytes);
+# endif
+
+# undef STATE
+
+  if (op == HEAP_RESET)
+  { collect_level = -1;
+  }
+
+  return n;
+}
+
+
+/* ALLOCATE A STRUCTURE FOR SAVED HEAP STATE.  Aborts if there isn't
+   enough memory, since the caller has no way of proceeding. */
+
+static sggc_heap_t heap_alloc (void)
+{
+  sggc_heap_t heap;
+
+  heap = heap_raw_alloc (sizeof *heap + heap_state (NULL, HEAP_SIZE));
+  if (heap == NULL)
+  { abort();
+  }
+
+  return heap;
+}
+
+
+/* CREATE A NEW HEAP.  The new heap is not current for any thread.  It
+   must be made current with sggc_heap_switch, and then initialized with
+   sggc_init, before being used. */
+
+sggc_heap_t sggc_heap_new (void)
+{
+  sggc_heap_t heap = heap_alloc();
+  sggc_heap_t cur = heap_alloc();
+
+  heap_state (cur->state, HEAP_SAVE);
+  heap_state (NULL, HEAP_RESET);
+  heap_state (heap->state, HEAP_SAVE);
+  heap_state (cur->state, HEAP_LOAD);
+  heap->current = 0;
+
+  heap_raw_free (cur);
+
+  return heap;
+}
+
+
+/* SWITCH THE CURRENT HEAP FOR THIS THREAD.  The state of the heap that
+   was current is saved, and the heap passed is made current, with all
+   other SGGC functions (and the sggc_info structure, etc.) then referring
+   to it.  The heap passed must not be current for another thread (the
+   program aborts if it is).  The heap that was current is returned, so
+   it can be switched back to later (including a thread's initial heap,
+   which is given a structure here the first time it is switched away
+   from).  Must not be called during a garbage collection. */
+
+sggc_heap_t sggc_heap_switch (sggc_heap_t heap)
+{
+  sggc_heap_t prev = current_heap;
+  int not_current = 0;
+
+  if (heap == prev)
+  { return prev;
+  }
+
+  /* Claim the new heap, so no other thread can switch to it, with acquire
+     ordering so its state saved by another thread is seen. */
+
+  if (!__atomic_compare_exchange_n (&heap->current, &not_current, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+  { abort();
+  }
+
+  if (prev == NULL)
+  { prev = heap_alloc();
+  }
+
+  /* Save the state of the previous heap, then release it, with release
+     ordering so another thread switching to it sees the saved state. */
+
+  heap_state (prev->state, HEAP_SAVE);
+  __atomic_store_n (&prev->current, 0, __ATOMIC_RELEASE);
+
+  heap_state (heap->state, HEAP_LOAD);
+  current_heap = heap;
+
+  if (SGGC_DEBUG)
+  { printf ("sggc_heap_switch: switched to heap with %u segments\n",
+             (unsigned) next_segment);
+  }
+
+  return prev;
+}
+
+
+/* RELEASE ALL MEMORY USED BY THE CURRENT HEAP.  Data areas that were
+   mapped, or supplied by the application with sggc_alloc_external, are
+   released as they would be if their objects were freed.  All blocks
+   allocated for the heap are then freed, including segments, data
+   areas, auxiliary information, and the tables indexed by segment.
+   Nothing is done for a heap that was never initialized, other than
+   freeing any (unlikely) blocks it has.  Afterwards, the variables
+   for the heap are invalid, and must be reloaded or reset. */
+
+static void heap_release (void)
+{
+  union heap_mem_hdr *h, *next;
+
+# if defined(SGGC_MAPPED) || defined(SGGC_EXTERNAL)
+  { sbset_index_t i;
+    for (i = 0; i < next_segment; i++)
+    { struct sbset_segment *seg = SBSET_SEGMENT(i);
+      sggc_cptr_t v = SGGC_CPTR_VAL(i,0);
+      if (seg == NULL || !seg->X.Big.big)
+      { continue;
+      }
+#     ifdef SGGC_EXTERNAL
+        if (external != NULL && external[i].release != NULL)
+        { external[i].release (SGGC_DATA(v), external[i].nbytes);
+        }
+#     endif
+#     ifdef SGGC_MAPPED
+        if (seg->X.Big.mapped)  /* mapping starts at page boundary */
+        { char *d = (char *) SGGC_DATA(v);
+          size_t page_off = (uintptr_t) d % SGGC_PAGE_SIZE;
+          munmap (d - page_off, page_off 
+                   + (size_t) SGGC_CHUNK_SIZE * CHUNKS_ALLOCATED(seg));
+        }
+#     endif
+    }
+  }
+# endif
+
+# ifdef SGGC_IMAGE
+    if (image_data != NULL && image_data_mapped)
+    { munmap (image_data, image_data_size);
+    }
+# endif
+
+  for (h = heap_mem_list; h != NULL; h = next)
+  { next = h->link.next;
+    heap_raw_free (h);
+  }
+
+  heap_mem_list = NULL;
+}
+
+
+/* FREE A HEAP THAT IS NOT CURRENT FOR ANY THREAD.  All memory used by
+   the heap is released (see heap_release), as well as the structure
+   recording it.  Shared constants loaded with sggc_load_constants are
+   not unmapped, since other heaps may refer to the same mapping. */
+
+void sggc_heap_free (sggc_heap_t heap)
+{
+  sggc_heap_t saved;
+  int not_current = 0;
+
+  /* Claim the heap, as for sggc_heap_switch, so its state is seen here
+     and no other thread can switch to it while it is being freed. */
+
+  if (!__atomic_compare_exchange_n (&heap->current, &not_current, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+  { abort();
+  }
+
+  saved = heap_alloc();
+  heap_state (saved->state, HEAP_SAVE);
+  heap_state (heap->state, HEAP_LOAD);
+
+  heap_release();
+
+  heap_state (saved->state, HEAP_LOAD);
+  heap_raw_free (saved);
+  heap_raw_free (heap);
+}
+
+#endif
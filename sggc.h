@@ -30,6 +30,13 @@
 #endif
 
 
+/* SELECT WHETHER COMPRESSED POINTERS ARE 32 OR 64 BITS. */
+
+#ifdef SGGC_CPTR_64
+#define SBSET_VALUE_64
+#endif
+
+
 /* CONTROL EXTERN DECLARATIONS FOR GLOBAL VARIABLES.  SGGC_EXTERN will
    be defined as nothing in sggc.c, where globals will actually be
    defined, but will be "extern" elsewhere. */
@@ -42,12 +49,27 @@
 #define SBSET_NO_FUNCTIONS
 #endif
 
+
+/* HANDLE FOR A HEAP, IF MULTIPLE HEAPS ARE ENABLED.  The tables indexed
+   by segment are swapped in and out with the rest of a heap's state, so
+   they may not be statically allocated. */
+
+#ifdef SGGC_HEAPS
+#ifdef SGGC_MAX_SEGMENTS
+#error "SGGC_HEAPS cannot be used with SGGC_MAX_SEGMENTS"
+#endif
+typedef struct sggc_heap *sggc_heap_t;
+#endif
+
 #include "sbset-app.h"
 #include <stdio.h>
 #include <stdlib.h>
 #ifdef SGGC_USE_MEMSET
 #include <string.h>
 #endif
+#ifdef SGGC_MAPPED
+#include <sys/types.h>
+#endif
 
 
 /* DEBUGGING FLAG.  Set to 1 to enable debug output.  May be set by a compiler
@@ -58,6 +80,14 @@
 #endif
 
 
+/* WHETHER SETS ARE KEPT OF UNCOLLECTED OBJECTS WITH OLD-TO-NEW REFERENCES.
+   Needed if there are uncollected kinds, or if objects can be frozen. */
+
+#if defined(SGGC_KIND_UNCOLLECTED) || defined(SGGC_FREEZE)
+#define SGGC_UNCOL_OLD_TO_NEW
+#endif
+
+
 /* COMPRESSED POINTER (INDEX, OFFSET) TYPE, AND NO OBJECT CONSTANT. */
 
 typedef sbset_value_t sggc_cptr_t; /* Type of compressed pointer, index+offset*/
@@ -91,29 +121,31 @@ typedef char *sggc_dptr;      /* Ordinary pointer arithmetic */
 
 #ifdef SGGC_MAX_SEGMENTS
 
-SGGC_EXTERN sggc_dptr sggc_data[SGGC_MAX_SEGMENTS]; /* Pointers to arrays of 
-                                                       blocks for objs in seg */
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr sggc_data[SGGC_MAX_SEGMENTS];
+                              /* Pointers to arrays of blocks for objs in seg */
 
 #ifdef SGGC_AUX1_SIZE
-SGGC_EXTERN sggc_dptr sggc_aux1[SGGC_MAX_SEGMENTS]; /* Pointers to aux1 data */
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr sggc_aux1[SGGC_MAX_SEGMENTS];
+                                                /* Pointers to aux1 data */
 #endif
 
 #ifdef SGGC_AUX2_SIZE
-SGGC_EXTERN sggc_dptr sggc_aux2[SGGC_MAX_SEGMENTS]; /* Pointers to aux2 data */
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr sggc_aux2[SGGC_MAX_SEGMENTS];
+                                                /* Pointers to aux2 data */
 #endif
 
 #else  /* max number of segments determined at run time */
 
-SGGC_EXTERN sggc_dptr *sggc_data; /* Pointer to array of pointers 
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr *sggc_data; /* Pointer to array of pointers
                          to arrays of data blocks for objects within segments */
 
 #ifdef SGGC_AUX1_SIZE
-SGGC_EXTERN sggc_dptr *sggc_aux1; /* Pointer to array of pointers
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr *sggc_aux1; /* Pointer to array of pointers
                                   to auxiliary info 1 for objects in segments */
 #endif
 
 #ifdef SGGC_AUX2_SIZE
-SGGC_EXTERN sggc_dptr *sggc_aux2; /* Pointer to array of pointers
+SGGC_EXTERN SGGC_HEAP_VAR sggc_dptr *sggc_aux2; /* Pointer to array of pointers
                                   to auxiliary info 2 for objects in segments */
 #endif
 
@@ -195,9 +227,10 @@ typedef unsigned char sggc_type_t;
 typedef unsigned char sggc_kind_t;
 
 #ifdef SGGC_MAX_SEGMENTS
-SGGC_EXTERN sggc_type_t sggc_type[SGGC_MAX_SEGMENTS];  /* Types for segments */
+SGGC_EXTERN SGGC_HEAP_VAR sggc_type_t sggc_type[SGGC_MAX_SEGMENTS];
+                                                /* Types for segments */
 #else
-SGGC_EXTERN sggc_type_t *sggc_type;  /* Types of objects in each segment */
+SGGC_EXTERN SGGC_HEAP_VAR sggc_type_t *sggc_type; /* Types of objs in segs */
 #endif
 
 /* Macro to access type of object, using the index of its segment. */
@@ -218,7 +251,7 @@ SGGC_EXTERN const int sggc_kind_chunks[SGGC_N_KINDS];
 /* STRUCTURE HOLDING INFORMATION ON CURRENT SPACE USAGE.  This structure
    is kept up-to-date after calls to sggc_alloc and sggc_collect. */
 
-SGGC_EXTERN struct sggc_info
+SGGC_EXTERN SGGC_HEAP_VAR struct sggc_info
 { 
   unsigned gen0_count;     /* Number of newly-allocated objects */
   unsigned gen1_count;     /* Number of objects in old generation 1 */
@@ -230,9 +263,30 @@ SGGC_EXTERN struct sggc_info
   size_t gen2_big_chunks;  /* # of chunks in big objects in old generation 2*/
   size_t uncol_big_chunks; /* # of chunks in uncollected big objects */
 
+#ifdef SGGC_FREEZE
+  unsigned frozen_count;    /* Number of frozen objects */
+  size_t frozen_big_chunks; /* # of chunks in frozen big objects */
+#endif
+
   unsigned n_segments;     /* Number of segments in use */
   size_t total_mem_usage;  /* Approximate total memory usage (in bytes) */
 
+#ifdef SGGC_MEM_ACCOUNTING
+  size_t seg_mem_usage;        /* Memory for segment structures */
+  size_t table_mem_usage;      /* Memory for tables, and the mark stack */
+  size_t small_data_mem_usage; /* Memory for data areas of small segments */
+  size_t big_data_mem_usage;   /* Memory for data areas of big segments */
+  size_t aux_mem_usage;        /* Memory for blocks of auxiliary information */
+#endif
+
+#ifdef SGGC_MAPPED
+  size_t mapped_mem_usage;     /* Bytes of files mapped for object data */
+#endif
+
+#ifdef SGGC_EXTERNAL
+  size_t external_mem_usage;   /* Bytes in data areas given by application */
+#endif
+
   uint64_t allocations;    /* Number of objects allocated since startup */
   uint64_t allocations_at_last_gc;  /* # of allocations at time of last GC */
 
@@ -243,6 +297,26 @@ SGGC_EXTERN struct sggc_info
 } sggc_info;
 
 
+/* FLAGS FOR sggc_alloc_mapped.  One of SGGC_MAP_PRIVATE or SGGC_MAP_SHARED,
+   possibly or'd with SGGC_MAP_READ_ONLY. */
+
+#ifdef SGGC_MAPPED
+#define SGGC_MAP_PRIVATE   0  /* Changes to data are not written to the file */
+#define SGGC_MAP_SHARED    1  /* Changes to data are written to the file */
+#define SGGC_MAP_READ_ONLY 2  /* Data may not be changed */
+#endif
+
+
+/* COUNTS OF ALLOCATIONS OF EACH KIND SINCE THE LAST COLLECTION.  Kept
+   only if SGGC_PRETENURE_FEEDBACK is defined, and used to decide which
+   kinds to pretenure.  Objects allocated in an old generation aren't
+   counted. */
+
+#ifdef SGGC_PRETENURE_FEEDBACK
+SGGC_EXTERN SGGC_HEAP_VAR unsigned sggc_kind_allocations[SGGC_N_KINDS];
+#endif
+
+
 /* TRACED COMPRESSED POINTER AND ASSOCIATED INFORMATION. */
 
 #ifdef SGGC_TRACE_CPTR
@@ -272,6 +346,13 @@ void sggc_find_root_ptrs (void);
 #endif
 
 #ifndef sggc_find_object_ptrs
+#ifdef SGGC_FIND_OBJECT_MULTI
+#ifdef SGGC_FIND_OBJECT_RETURN
+#error "SGGC_FIND_OBJECT_MULTI cannot be used with SGGC_FIND_OBJECT_RETURN"
+#endif
+int sggc_find_object_ptrs (sggc_cptr_t cptr, 
+                           sggc_cptr_t ptrs[SGGC_FIND_OBJECT_MULTI]);
+#else
 #ifdef SGGC_FIND_OBJECT_RETURN
 sggc_cptr_t
 #else
@@ -279,6 +360,7 @@ void
 #endif
 sggc_find_object_ptrs (sggc_cptr_t cptr);
 #endif
+#endif
 
 #ifdef SGGC_AUX1_READ_ONLY
 #ifndef sggc_aux1_read_only
@@ -308,6 +390,18 @@ void sggc_after_marking (int level, int rep);
 
 int sggc_init (unsigned max_segments);
 sggc_cptr_t sggc_alloc (sggc_type_t type, sggc_length_t length);
+sggc_cptr_t sggc_alloc_old (sggc_type_t type, sggc_length_t length, int gen);
+void sggc_pretenure_kind (sggc_kind_t kind, int gen);
+int sggc_kind_pretenured (sggc_kind_t kind);
+#ifdef SGGC_MAPPED
+sggc_cptr_t sggc_alloc_mapped (sggc_type_t type, int fd, off_t offset,
+                               sggc_length_t length, int flags);
+#endif
+#ifdef SGGC_EXTERNAL
+sggc_cptr_t sggc_alloc_external (sggc_type_t type, sggc_length_t length,
+                                 void *ptr, size_t nbytes,
+                                 void (*release) (void *, size_t));
+#endif
 #ifdef SGGC_KIND_TYPES
 sggc_cptr_t sggc_alloc_kind (sggc_kind_t kind, sggc_length_t length);
 sggc_cptr_t sggc_alloc_small_kind (sggc_kind_t kind);
@@ -315,14 +409,30 @@ sggc_cptr_t sggc_alloc_small_kind (sggc_kind_t kind);
 sggc_nchunks_t sggc_nchunks_allocated (sggc_cptr_t object);
 void sggc_collect (int level);
 void sggc_look_at (sggc_cptr_t cptr);
+void sggc_look_at_slow (sggc_cptr_t cptr);
 void sggc_mark (sggc_cptr_t cptr);
 sggc_cptr_t sggc_first_uncollected_of_kind (sggc_kind_t kind);
 int sggc_is_uncollected (sggc_cptr_t cptr);
 void sggc_call_for_newly_freed_object (sggc_kind_t kind,
                                        int (*fun) (sggc_cptr_t));
 void sggc_call_for_object_in_use (void (*fun) (sggc_cptr_t, sggc_nchunks_t));
+void sggc_call_for_segment_in_use (void (*fun) (sggc_cptr_t, sggc_kind_t,
+                                                sbset_bits_t, sggc_nchunks_t));
+#ifdef SGGC_FINALIZERS
+void sggc_set_finalizer (int (*fun) (sggc_cptr_t));
+void sggc_register_finalizer (sggc_cptr_t cptr);
+void sggc_unregister_finalizer (sggc_cptr_t cptr);
+#endif
 void sggc_no_reuse (int enable);
+void sggc_set_soft_limit (size_t limit, int collect);
 sggc_cptr_t sggc_check_valid_cptr (sggc_cptr_t cptr);
+#ifdef SGGC_FREEZE
+void sggc_freeze_heap (void);
+#endif
+#ifdef SGGC_IMAGE
+int sggc_save_image (const char *path, sggc_cptr_t root);
+int sggc_load_image (const char *path, sggc_cptr_t *root);
+#endif
 sggc_cptr_t sggc_constant (sggc_type_t type, sggc_kind_t kind, int n_objects,
                            char *data
 #ifdef SGGC_AUX1_SIZE
@@ -332,6 +442,20 @@ sggc_cptr_t sggc_constant (sggc_type_t type, sggc_kind_t kind, int n_objects,
                          , char *aux2
 #endif
 );
+#ifdef SGGC_SHARED_CONSTANTS
+int sggc_save_constants (const char *path);
+sggc_cptr_t sggc_load_constants (const char *path);
+#endif
+#ifdef SGGC_CONSERVATIVE
+void sggc_stack_base (void *base);
+void sggc_look_at_stack (void);
+void sggc_look_at_area (void *start, void *end);
+#endif
+#ifdef SGGC_HEAPS
+sggc_heap_t sggc_heap_new (void);
+sggc_heap_t sggc_heap_switch (sggc_heap_t heap);
+void sggc_heap_free (sggc_heap_t heap);
+#endif
 
 #endif
 
@@ -356,6 +480,34 @@ static inline int sggc_not_marked (sggc_cptr_t cptr)
 }
 
 
+/* TELL THE GARBAGE COLLECTOR THAT AN OBJECT NEEDS TO BE LOOKED AT.
+   Most calls are for objects already marked, or for SGGC_NO_OBJECT,
+   and are rejected here, with sggc_look_at_slow in sggc.c called only
+   when the object is not yet marked, or when sggc_look_at is being
+   used for old-to-new processing (sggc_old_to_new_checking non-zero).
+   All calls go to sggc_look_at_slow when debugging or tracing.  Calls
+   of sggc_look_at use this inline version through a macro, but a
+   non-inline sggc_look_at is also defined in sggc.c (as for getc). */
+
+static inline void sggc_look_at_inline (sggc_cptr_t cptr)
+{
+  extern SGGC_HEAP_VAR int sggc_old_to_new_checking;
+  extern void sggc_look_at_slow (sggc_cptr_t cptr);
+
+# ifndef SGGC_TRACE_CPTR
+    if (!SGGC_DEBUG && sggc_old_to_new_checking == 0
+         && (cptr == SGGC_NO_OBJECT
+              || !sbset_chain_contains (SGGC_UNUSED_FREE_NEW, cptr)))
+    { return;
+    }
+# endif
+
+  sggc_look_at_slow (cptr);
+}
+
+#define sggc_look_at(cptr) sggc_look_at_inline(cptr)
+
+
 /* TEST WHETHER AN OBJECT IS A CONSTANT. */
 
 static inline int sggc_is_constant (sggc_cptr_t cptr)
@@ -365,14 +517,47 @@ static inline int sggc_is_constant (sggc_cptr_t cptr)
 }
 
 
-/* QUICKLY ALLOCATE AN OBJECT WITH GIVEN KIND, WHICH MUST BE FOR SMALL SEGMENT. 
-   Returns SGGC_NO_OBJECT if can't allocate quickly in an existing segment. */
+/* TEST WHETHER AN OBJECT IS NEVER COLLECTED, BECAUSE IT IS OF AN
+   UNCOLLECTED KIND OR HAS BEEN FROZEN.  Constants are not included. */
 
-static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+
+static inline int sggc_never_collected (sggc_cptr_t cptr)
 {
-  extern sggc_cptr_t sggc_next_free_val[SGGC_N_KINDS];
-  extern sbset_bits_t sggc_next_free_bits[SGGC_N_KINDS];
-  extern int sggc_next_segment_not_free[SGGC_N_KINDS];
+#ifdef SGGC_FREEZE
+  if (SBSET_SEGMENT(SBSET_VAL_INDEX(cptr)) -> X.Small.frozen)
+  { return 1;
+  }
+#endif
+#ifdef SGGC_KIND_UNCOLLECTED
+  extern const int sggc_kind_uncollected[SGGC_N_KINDS];
+  if (sggc_kind_uncollected[SGGC_KIND(cptr)])
+  { return 1;
+  }
+#endif
+  return 0;
+}
+
+#endif
+
+
+/* QUICKLY ALLOCATE AN OBJECT WITH GIVEN KIND, WHICH MUST BE FOR SMALL SEGMENT. 
+   Returns SGGC_NO_OBJECT if can't allocate quickly in an existing segment.
+   The number of chunks for the kind and whether it is uncollected (only
+   if SGGC_KIND_UNCOLLECTED is defined) are passed as arguments, so that
+   they can be compile-time constants when used from the functions 
+   defined by SGGC_DEFINE_ALLOC_KIND_QUICKLY. */
+
+static inline sggc_cptr_t sggc_alloc_quickly_for (sggc_kind_t kind, 
+                                                  sggc_nchunks_t nch
+#ifdef SGGC_KIND_UNCOLLECTED
+                                                , int uncol
+#endif
+                                                 )
+{
+  extern SGGC_HEAP_VAR sggc_cptr_t sggc_next_free_val[SGGC_N_KINDS];
+  extern SGGC_HEAP_VAR sbset_bits_t sggc_next_free_bits[SGGC_N_KINDS];
+  extern SGGC_HEAP_VAR int sggc_next_segment_not_free[SGGC_N_KINDS];
 
   sbset_bits_t nfb = sggc_next_free_bits[kind]; /* bits indicating where free */
 
@@ -381,7 +566,6 @@ static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
   }
 
   sggc_cptr_t nfv = sggc_next_free_val[kind];  /* pointer to current free obj */
-  sggc_nchunks_t nch = sggc_kind_chunks[kind]; /* number of chunks for object */
 
   nfb >>= nch;
   if (nfb != 0)
@@ -421,9 +605,8 @@ static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
 #endif
 
 #ifdef SGGC_KIND_UNCOLLECTED
-  extern const int sggc_kind_uncollected[SGGC_N_KINDS];
-  extern struct sbset sggc_uncollected_sets[SGGC_N_KINDS];
-  if (sggc_kind_uncollected[kind])
+  extern SGGC_HEAP_VAR struct sbset sggc_uncollected_sets[SGGC_N_KINDS];
+  if (uncol)
   { sbset_add (&sggc_uncollected_sets[kind], nfv);
     sggc_info.uncol_count += 1;
   }
@@ -434,6 +617,10 @@ static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
 
   sggc_info.allocations += 1;
 
+# ifdef SGGC_PRETENURE_FEEDBACK
+    sggc_kind_allocations[kind] += 1;
+# endif
+
 # ifdef SGGC_TRACE_CPTR
     if (nfv == sggc_trace_cptr)
     { sggc_trace_cptr_count += 1;
@@ -443,7 +630,7 @@ static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
       { if (SGGC_DEBUG) 
         { printf(
          "sggc_alloc_small_kind_quickly: abort on alloc %d of traced cptr %x\n",
-          sggc_trace_cptr_count, sggc_trace_cptr);
+          sggc_trace_cptr_count, (unsigned) sggc_trace_cptr);
         }
         abort();
       }
@@ -453,6 +640,48 @@ static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
   return nfv;
 }
 
+static inline sggc_cptr_t sggc_alloc_small_kind_quickly (sggc_kind_t kind)
+{
+# ifdef SGGC_KIND_UNCOLLECTED
+    extern const int sggc_kind_uncollected[SGGC_N_KINDS];
+    return sggc_alloc_quickly_for (kind, sggc_kind_chunks[kind],
+                                   sggc_kind_uncollected[kind]);
+# else
+    return sggc_alloc_quickly_for (kind, sggc_kind_chunks[kind]);
+# endif
+}
+
+
+/* DEFINE A FUNCTION TO QUICKLY ALLOCATE AN OBJECT OF A PARTICULAR KIND.
+   SGGC_DEFINE_ALLOC_KIND_QUICKLY(k), with k an integer constant for a
+   small kind, defines sggc_alloc_kind_k_quickly, which takes no
+   arguments and does the same as sggc_alloc_small_kind_quickly(k), but
+   with the number of chunks and whether the kind is uncollected taken
+   from SGGC_KIND_CHUNKS and SGGC_KIND_UNCOLLECTED as constants, so
+   that the compiler can unroll zeroing of the data and drop tests. */
+
+#define SGGC_KIND_CHUNKS_CONST(k) (((const int []) SGGC_KIND_CHUNKS) [k])
+
+#ifdef SGGC_KIND_UNCOLLECTED
+
+#define SGGC_KIND_UNCOLLECTED_CONST(k) \
+  (((const int []) SGGC_KIND_UNCOLLECTED) [k])
+
+#define SGGC_DEFINE_ALLOC_KIND_QUICKLY(k) \
+  static inline sggc_cptr_t sggc_alloc_kind_##k##_quickly (void) \
+  { return sggc_alloc_quickly_for (k, SGGC_KIND_CHUNKS_CONST(k), \
+                                   SGGC_KIND_UNCOLLECTED_CONST(k)); \
+  }
+
+#else
+
+#define SGGC_DEFINE_ALLOC_KIND_QUICKLY(k) \
+  static inline sggc_cptr_t sggc_alloc_kind_##k##_quickly (void) \
+  { return sggc_alloc_quickly_for (k, SGGC_KIND_CHUNKS_CONST(k)); \
+  }
+
+#endif
+
 
 /* RECORD AN OLD-TO-NEW REFERENCE IF NECESSARY. */
 
@@ -466,10 +695,21 @@ static inline void sggc_old_to_new_check (sggc_cptr_t from_ptr,
   }
 
   /* Can quit now if from_ptr is already in an old-to-new set (which are
-     the only ones using the SGGC_OLD_TO_NEW chain). */
+     the only ones using the SGGC_OLD_TO_NEW chain), except that an
+     uncollected object may need to be put in the set for those that
+     reference a younger generation than previously recorded (not
+     needed if it's in the set for those referencing generation 0). */
 
   if (sbset_chain_contains (SGGC_OLD_TO_NEW, from_ptr))
-  { return;
+  { 
+#ifndef SGGC_UNCOL_OLD_TO_NEW
+    return;
+#else
+    if (!sggc_never_collected (from_ptr)
+         || sbset_chain_contains (SGGC_UNCOL_REF_GEN0, from_ptr))
+    { return;
+    }
+#endif
   }
 
   /* Note:  from_ptr shouldn't be a constant, so below can look in whole chain,
@@ -477,32 +717,41 @@ static inline void sggc_old_to_new_check (sggc_cptr_t from_ptr,
 
   if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, from_ptr))
   { 
-    /* If from_ptr is in old generation 2 or uncollected, only others in 
-       old generation 2, uncollected, or constants, can possibly be 
-       referenced without using old-to-new. */
-
-    if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, to_ptr)) 
-    { 
-#ifndef SGGC_KIND_UNCOLLECTED
-
-      return; /* no need for further checks if can't be an uncollected object */
-
-#else
-      /* If the reference is from old generation 2 rather than an uncollected
-         object, we don't need to use old_to_new. */
-
-      extern const int sggc_kind_uncollected[SGGC_N_KINDS];
-      if (!sggc_kind_uncollected[SGGC_KIND(from_ptr)])
-      { return;
+#ifdef SGGC_UNCOL_OLD_TO_NEW
+
+    /* If the reference is from an uncollected (or frozen) object, record
+       it in the sets of uncollected objects that may reference the
+       generation of to_ptr or any older one, unless to_ptr is a constant,
+       uncollected, or frozen object (which needs no record).  Note that
+       an uncollected object may be in the SGGC_OLD_GEN1 chain, so that's
+       checked only after SGGC_OLD_GEN2_UNCOL. */
+
+    if (sggc_never_collected (from_ptr))
+    { extern SGGC_HEAP_VAR struct sbset sggc_uncol_old_to_new_sets[3];
+      int g;
+      if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, to_ptr))
+      { if (sggc_is_constant(to_ptr) || sggc_never_collected(to_ptr))
+        { return;
+        }
+        g = 2;
       }
-
-      /* If the reference is from an uncollected object, a reference to a
-         constant or uncollected object doesn't need to use old_to_new. */
-
-      if (sggc_is_constant(to_ptr) || sggc_kind_uncollected[SGGC_KIND(to_ptr)])
-      { return;
+      else 
+      { g = sbset_chain_contains (SGGC_OLD_GEN1, to_ptr) ? 1 : 0;
       }
+      do
+      { sbset_add (&sggc_uncol_old_to_new_sets[g], from_ptr);
+        g += 1;
+      } while (g < 3);
+      return;
+    }
 #endif
+
+    /* If from_ptr is in old generation 2, only others in old generation 2,
+       uncollected, or constants, can possibly be referenced without using
+       old-to-new. */
+
+    if (sbset_chain_contains (SGGC_OLD_GEN2_UNCOL, to_ptr)) 
+    { return;
     }
   }
 
@@ -519,7 +768,7 @@ static inline void sggc_old_to_new_check (sggc_cptr_t from_ptr,
   /* If we get here, we need to record the existence of an old-to-new
      reference in from_ptr. */
 
-  extern struct sbset sggc_old_to_new_set;
+  extern SGGC_HEAP_VAR struct sbset sggc_old_to_new_set;
   sbset_add (&sggc_old_to_new_set, from_ptr);
 }
 
@@ -25,7 +25,7 @@ static struct sbset_segment *SBSET_SEGMENT ();
 
 #include "sbset.h"
 
-#define N_SEG 10
+#define N_SEG 1024
 
 struct sbset_segment segment[N_SEG];
 
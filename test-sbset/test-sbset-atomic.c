@@ -0,0 +1,218 @@
+/* SGGC - A LIBRARY SUPPORTING SEGMENTED GENERATIONAL GARBAGE COLLECTION.
+          Facility for maintaining sets of objects - stress test of
+          atomic operations
+
+   The SGGC library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+
+/* Several threads call sbset_add_atomic and sbset_remove_atomic on shared
+   sets, checking that each operation behaves as if done at a single
+   instant.
+
+   In the first phase, each thread owns the values whose offsets are
+   congruent to its number modulo N_THREADS, in all segments, so that
+   threads contend for the same bit vectors, but not the same bits.
+   Each thread randomly adds and removes its own values, checking that
+   the results returned agree with its own record of which are present.
+   Once all threads finish, the final membership, count of elements,
+   and chain of segments are checked.
+
+   In the second phase, in each of many rounds, all threads try to add
+   the same value to a set, and then all try to remove it, with exactly
+   one thread required to succeed each time. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "sbset-app.h"
+#if SBSET_STATIC
+#include "sbset.c"
+#endif
+
+#define N_THREADS 4        /* Number of threads */
+#define N_OPS 1000000      /* Operations done by each thread in phase 1 */
+#define N_ROUNDS 10000     /* Rounds of contention for one value in phase 2 */
+
+#define N_USED_SEG 10      /* Number of segments holding values used */
+
+#define N_VALS (N_USED_SEG << SBSET_OFFSET_BITS)
+
+struct sbset set[2];
+
+static char present[N_VALS];     /* Membership of values in phase 1 */
+static int errors[N_THREADS];    /* Errors found by each thread */
+
+static pthread_barrier_t barrier;
+static int add_winners, remove_winners;  /* Counts for a phase 2 round */
+static int round_errors;                 /* Rounds with wrong counts */
+
+
+/* PHASE 1. */
+
+static void *phase1 (void *arg)
+{
+  int t = * (int *) arg;
+  unsigned r = 12345 + 1000 * t;  /* random number state */
+  long i;
+
+  for (i = 0; i < N_OPS; i++)
+  {
+    r = r * 1103515245 + 12345;
+    int k = (r >> 8) % (N_VALS / N_THREADS);
+    int v = k * N_THREADS + t;
+    sbset_value_t val = SBSET_VAL (v >> SBSET_OFFSET_BITS,
+                                   v & ((1 << SBSET_OFFSET_BITS) - 1));
+
+    if ((r >> 30) & 1)
+    { if (sbset_add_atomic (&set[0], val) != present[v]) errors[t] += 1;
+      present[v] = 1;
+    }
+    else
+    { if (sbset_remove_atomic (&set[0], val) != present[v]) errors[t] += 1;
+      present[v] = 0;
+    }
+
+    if (sbset_chain_contains_atomic (0, val) != present[v]) errors[t] += 1;
+  }
+
+  return NULL;
+}
+
+
+/* PHASE 2. */
+
+static void *phase2 (void *arg)
+{
+  int t = * (int *) arg;
+  int i;
+
+  for (i = 0; i < N_ROUNDS; i++)
+  {
+    sbset_value_t val = SBSET_VAL (i % N_USED_SEG, i % (1 << SBSET_OFFSET_BITS));
+
+    if (sbset_add_atomic (&set[1], val) == 0)
+    { __atomic_fetch_add (&add_winners, 1, __ATOMIC_RELAXED);
+    }
+    pthread_barrier_wait (&barrier);
+
+    if (sbset_remove_atomic (&set[1], val) == 1)
+    { __atomic_fetch_add (&remove_winners, 1, __ATOMIC_RELAXED);
+    }
+    pthread_barrier_wait (&barrier);
+
+    if (t == 0)
+    { if (add_winners != 1 || remove_winners != 1) round_errors += 1;
+      add_winners = remove_winners = 0;
+    }
+    pthread_barrier_wait (&barrier);
+  }
+
+  return NULL;
+}
+
+
+/* RUN THREADS FOR A PHASE. */
+
+static void run_threads (void *(*fun) (void *))
+{
+  pthread_t thread[N_THREADS];
+  int num[N_THREADS];
+  int t;
+
+  for (t = 0; t < N_THREADS; t++)
+  { num[t] = t;
+    if (pthread_create (&thread[t], NULL, fun, &num[t]) != 0)
+    { fprintf (stderr, "Can't create thread\n");
+      exit(1);
+    }
+  }
+
+  for (t = 0; t < N_THREADS; t++)
+  { pthread_join (thread[t], NULL);
+  }
+}
+
+
+/* MAIN PROGRAM. */
+
+int main (void)
+{
+  int in_chain[N_SEG];
+  int i, j, t, n, bad;
+
+  for (j = 0; j < N_SEG; j++)
+  { sbset_segment_init (&segment[j]);
+  }
+  sbset_init (&set[0], 0);
+  sbset_init (&set[1], 1);
+
+  pthread_barrier_init (&barrier, NULL, N_THREADS);
+
+  /* Phase 1. */
+
+  run_threads (phase1);
+
+  bad = 0;
+  for (t = 0; t < N_THREADS; t++)
+  { bad += errors[t];
+  }
+  printf ("Phase 1: %d threads, %d operations each, results %s\n",
+           N_THREADS, N_OPS, bad ? "WRONG" : "OK");
+
+  n = 0;
+  bad = 0;
+  for (i = 0; i < N_VALS; i++)
+  { sbset_value_t val = SBSET_VAL (i >> SBSET_OFFSET_BITS,
+                                   i & ((1 << SBSET_OFFSET_BITS) - 1));
+    if (sbset_contains (&set[0], val) != present[i]) bad += 1;
+    n += present[i];
+  }
+  printf ("Phase 1: final membership %s, count of elements %s\n",
+           bad ? "WRONG" : "OK", 
+           n == sbset_n_elements(&set[0]) ? "OK" : "WRONG");
+
+  /* Check that the chain for set 0 has every segment with elements
+     exactly once, by following links directly (since sbset_first and
+     sbset_next would unlink empty segments, hiding duplicates). */
+
+  for (j = 0; j < N_SEG; j++)
+  { in_chain[j] = 0;
+  }
+  bad = 0;
+  for (j = set[0].first; j != SBSET_END_OF_CHAIN; j = segment[j].next[0])
+  { if (j < 0 || j >= N_SEG || in_chain[j])
+    { bad = 1;
+      break;
+    }
+    in_chain[j] = 1;
+  }
+  for (j = 0; j < N_SEG; j++)
+  { if (segment[j].bits[0] != 0 && !in_chain[j]) bad = 1;
+  }
+  printf ("Phase 1: chain of segments %s\n", bad ? "WRONG" : "OK");
+
+  /* Phase 2. */
+
+  run_threads (phase2);
+
+  printf ("Phase 2: %d rounds, one thread adding and removing each time %s\n",
+           N_ROUNDS, round_errors ? "WRONG" : "OK");
+  printf ("Phase 2: final count of elements %s\n",
+           sbset_n_elements(&set[1]) == 0 ? "OK" : "WRONG");
+
+  return 0;
+}
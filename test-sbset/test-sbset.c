@@ -21,6 +21,8 @@
 #include <stdio.h>
 #include "sbset-app.h"
 #if SBSET_STATIC
+#define SBSET_USE_SORT_CHAIN
+#define SBSET_USE_SORT_CHAIN_BY_COUNT
 #include "sbset.c"
 #endif
 
@@ -58,6 +60,9 @@ int main (void)
         m  set                       sbset_move_first (to other of set 1/2)
         A  set  index  offset        sbset_add_segment (from chain 0)
         R  set  index  offset        sbset_remove_segment (from chain 0)
+        i  set  index  offset        sbset_for_each_segment (clearing index)
+        o  set                       sbset_sort_chain
+        O  set                       sbset_sort_chain_by_count
   */
 
   for (;;)
@@ -76,7 +81,7 @@ int main (void)
     s[0] = 0;
     fscanf(f,"%[^\n]",s);
 
-    if (c == 'm')
+    if (c == 'm' || c == 'o' || c == 'O')
     { if (r != 2)
       { printf("Wrong number of arguments\n");
       }
@@ -94,7 +99,7 @@ int main (void)
       continue;
     }
 
-    if (c != 'm')
+    if (c != 'm' && c != 'o' && c != 'O')
     { if (x < 0 || x >= N_SEG) 
       { printf("Invalid segment\n");
         continue;
@@ -140,6 +145,27 @@ int main (void)
       { sbset_remove_segment (&set[i], SBSET_VAL(x,o), 0);
         break;
       }
+      case 'o':
+      { sbset_sort_chain (&set[i]);
+        break;
+      }
+      case 'O':
+      { sbset_sort_chain_by_count (&set[i]);
+        break;
+      }
+      case 'i':
+      { struct sbset_iter it;
+        sbset_bits_t b;
+        printf("segments:");
+        sbset_for_each_segment (&it, &set[i], b)
+        { printf(" %d:%016llx", sbset_iter_index(&it), (long long) b);
+          if (sbset_iter_index(&it) == x)
+          { sbset_iter_assign_bits (&it, 0);
+          }
+        }
+        printf("\n");
+        break;
+      }
       
       default: 
       { printf("Unknown operation");
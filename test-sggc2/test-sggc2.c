@@ -173,6 +173,13 @@ static void in_use (sggc_cptr_t v, sggc_nchunks_t nch)
           (unsigned)v, (int) nch);
 }
 
+static void in_use_seg (sggc_cptr_t v, sggc_kind_t k, sbset_bits_t b,
+                        sggc_nchunks_t nch)
+{ printf("CALLED_FOR_SEGMENT_IN_USE: Segment %x of kind %d, bits %llx, "
+         "with %d chunks\n",
+          (unsigned)v, (int) k, (unsigned long long) b, (int) nch);
+}
+
 int main (int argc, char **argv)
 { 
   int segs = argc<2 ? 5 /* min for no failure */ : atoi(argv[1]);
@@ -193,6 +200,7 @@ int main (int argc, char **argv)
   }
 
   sggc_call_for_object_in_use (in_use);
+  sggc_call_for_segment_in_use (in_use_seg);
 
   (void) alloc (2, 3);   /* Type 2, of small and big kinds */
   (void) alloc (2, 12);
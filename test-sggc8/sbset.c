@@ -0,0 +1 @@
+../sbset.c
\ No newline at end of file
@@ -0,0 +1 @@
+../sbset.h
\ No newline at end of file
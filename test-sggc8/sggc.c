@@ -0,0 +1 @@
+../sggc.c
\ No newline at end of file
@@ -0,0 +1,356 @@
+/* SGGC - A LIBRARY SUPPORTING SEGMENTED GENERATIONAL GARBAGE COLLECTION.
+          Test program #8 - main program
+
+   The SGGC library is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License along
+   with this program; if not, write to the Free Software Foundation, Inc.,
+   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA. */
+
+
+/* This test program uses multiple heaps (with SGGC_HEAPS defined).  In
+   the first phase, several threads each switch to their own heap and
+   build a list of numbers in it, allocating garbage and a big vector
+   as well, with frequent garbage collections, which for different heaps
+   are done in parallel.  In the second phase, the main thread switches
+   to each heap in turn, checks its contents, collects it, and extends
+   the list, checking that heaps are unaffected by each other.  In the
+   third phase, heaps are repeatedly created, used, and freed, checking
+   that the number of memory blocks in use does not grow.  Output is
+   produced only by the main thread, so that it is deterministic. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "sggc-app.h"
+
+
+/* TYPE OF A POINTER USED IN THIS APPLICATION.  Uses compressed pointers. */
+
+typedef sggc_cptr_t ptr_t;
+
+
+/* TYPES FOR THIS APPLICATION.  Type 0 is a "dotted pair" type, type 1
+   is a number, and type 2 is a vector of integers, in big segments. */
+
+struct type0 { ptr_t x, y; };
+struct type1 { int64_t value; };
+struct type2 { int32_t length; int32_t data[1]; };
+
+#define TYPE0(v) ((struct type0 *) SGGC_DATA(v))
+#define TYPE1(v) ((struct type1 *) SGGC_DATA(v))
+#define TYPE2(v) ((struct type2 *) SGGC_DATA(v))
+
+
+/* CONSTANTS FOR THE TEST. */
+
+#define N_HEAPS 4         /* Number of heaps, and of threads in phase 1 */
+#define N_ITERS 20000     /* Iterations building list in phase 1 */
+#define N_MORE 1000       /* Iterations extending list in phase 2 */
+#define VEC_EVERY 500     /* How often to allocate a new vector */
+#define N_FREED 50        /* Heaps created and freed in phase 3 */
+
+
+/* VARIABLES THAT ARE ROOTS FOR THE GARBAGE COLLECTOR, FOR EACH HEAP.
+   The heap a thread is working on is recorded in heap_num. */
+
+static ptr_t list[N_HEAPS];       /* List of numbers */
+static ptr_t vec[N_HEAPS];        /* Most recently allocated vector */
+static ptr_t num[N_HEAPS];        /* Number not yet put in list */
+
+static __thread int heap_num;     /* Index of heap now current in thread */
+
+static sggc_heap_t heap[N_HEAPS]; /* The heaps */
+static unsigned alloc_count[N_HEAPS]; /* Allocations done in each heap */
+static int errors[N_HEAPS];       /* Errors found when checking each heap */
+
+
+/* WRAPPERS FOR MALLOC, CALLOC, AND FREE.  Keep count of the number of
+   blocks in use, atomically, since heaps are used in several threads. */
+
+static int in_use = 0;
+
+void *test_malloc (size_t size)
+{
+  void *res = malloc (size);
+  if (res != NULL)
+  { __atomic_add_fetch (&in_use, 1, __ATOMIC_RELAXED);
+  }
+  return res;
+}
+
+void *test_calloc (size_t size)
+{
+  void *res = calloc (size, 1);
+  if (res != NULL)
+  { __atomic_add_fetch (&in_use, 1, __ATOMIC_RELAXED);
+  }
+  return res;
+}
+
+void test_free (void *ptr)
+{
+  if (ptr == NULL) abort();
+  if (__atomic_sub_fetch (&in_use, 1, __ATOMIC_RELAXED) < 0) abort();
+  free (ptr);
+}
+
+
+/* FUNCTIONS THAT THE APPLICATION NEEDS TO PROVIDE TO THE SGGC MODULE. */
+
+sggc_kind_t sggc_kind (sggc_type_t type, sggc_length_t length)
+{
+  return type;
+}
+
+sggc_nchunks_t sggc_nchunks (sggc_type_t type, sggc_length_t length)
+{
+  return type != 2 ? 1 : (4 + 4*length + SGGC_CHUNK_SIZE-1) / SGGC_CHUNK_SIZE;
+}
+
+void sggc_find_root_ptrs (void)
+{ sggc_look_at (list[heap_num]);
+  sggc_look_at (vec[heap_num]);
+  sggc_look_at (num[heap_num]);
+}
+
+void sggc_find_object_ptrs (sggc_cptr_t cptr)
+{
+  if (SGGC_TYPE(cptr) == 0)
+  { sggc_look_at (TYPE0(cptr)->x);
+    sggc_look_at (TYPE0(cptr)->y);
+  }
+}
+
+
+/* ALLOCATE FUNCTION FOR THIS APPLICATION.  Calls the garbage collector
+   when necessary, or otherwise every 100th allocation, with every 500th
+   being level 1, and every 2000th being level 2. */
+
+static ptr_t alloc (sggc_type_t type, sggc_length_t length)
+{
+  unsigned cnt = alloc_count[heap_num] += 1;
+  ptr_t a;
+
+  if (cnt % 100 == 0)
+  { sggc_collect (cnt % 2000 == 0 ? 2 : cnt % 500 == 0 ? 1 : 0);
+  }
+
+  a = sggc_alloc (type, length);
+  if (a == SGGC_NO_OBJECT)
+  { sggc_collect (2);
+    a = sggc_alloc (type, length);
+    if (a == SGGC_NO_OBJECT)
+    { abort();
+    }
+  }
+
+  if (type == 0)
+  { TYPE0(a)->x = TYPE0(a)->y = SGGC_NO_OBJECT;
+  }
+
+  return a;
+}
+
+
+/* ADD ITERATIONS TO THE LIST FOR THE CURRENT HEAP.  Numbers for
+   iterations that are multiples of 4 are put in the list, others are
+   garbage.  A new vector, filled with the heap number, replaces the
+   old one every VEC_EVERY iterations. */
+
+static void extend (int from, int to)
+{
+  int t = heap_num;
+  int i, j;
+
+  for (i = from; i <= to; i++)
+  { num[t] = alloc (1, 1);
+    TYPE1(num[t])->value = 1000000 * t + i;
+    if (i % 4 == 0)
+    { ptr_t p = alloc (0, 1);
+      TYPE0(p)->x = num[t];
+      TYPE0(p)->y = list[t];
+      list[t] = p;
+    }
+    num[t] = SGGC_NO_OBJECT;
+    if (i % VEC_EVERY == 0)
+    { int len = 100 + i / VEC_EVERY;
+      vec[t] = alloc (2, len);
+      TYPE2(vec[t])->length = len;
+      for (j = 0; j < len; j++)
+      { TYPE2(vec[t])->data[j] = t;
+      }
+    }
+  }
+}
+
+
+/* CHECK THE CONTENTS OF THE CURRENT HEAP, UP TO ITERATION 'last'.
+   Returns the number of errors found. */
+
+static int check (int last)
+{
+  int t = heap_num;
+  int err = 0;
+  int i, j;
+  ptr_t p;
+
+  p = list[t];
+  for (i = last - last % 4; i > 0; i -= 4)
+  { if (p == SGGC_NO_OBJECT || SGGC_TYPE(p) != 0)
+    { return err + 1;
+    }
+    ptr_t n = TYPE0(p)->x;
+    if (SGGC_TYPE(n) != 1 || TYPE1(n)->value != 1000000 * t + i)
+    { err += 1;
+    }
+    p = TYPE0(p)->y;
+  }
+  if (p != SGGC_NO_OBJECT)
+  { err += 1;
+  }
+
+  if (SGGC_TYPE(vec[t]) != 2
+       || TYPE2(vec[t])->length != 100 + last / VEC_EVERY)
+  { return err + 1;
+  }
+  for (j = 0; j < TYPE2(vec[t])->length; j++)
+  { if (TYPE2(vec[t])->data[j] != t)
+    { err += 1;
+    }
+  }
+
+  return err;
+}
+
+
+/* PHASE 1.  Each thread switches to its own heap, initializes it, builds
+   its list, and checks it, then switches back to its initial heap. */
+
+static void *phase1 (void *arg)
+{
+  int t = * (int *) arg;
+  sggc_heap_t init;
+
+  init = sggc_heap_switch (heap[t]);
+  heap_num = t;
+
+  if (sggc_init (10000) != 0)
+  { abort();
+  }
+  list[t] = vec[t] = num[t] = SGGC_NO_OBJECT;
+
+  extend (1, N_ITERS);
+  errors[t] = check (N_ITERS);
+
+  sggc_heap_switch (init);
+
+  return NULL;
+}
+
+
+/* MAIN PROGRAM. */
+
+int main (void)
+{
+  pthread_t thread[N_HEAPS];
+  int index[N_HEAPS];
+  int before, grew;
+  sggc_heap_t h, prev;
+  int t, k;
+
+  for (t = 0; t < N_HEAPS; t++)
+  { heap[t] = sggc_heap_new();
+  }
+
+  /* Phase 1, with heaps used in parallel threads. */
+
+  for (t = 0; t < N_HEAPS; t++)
+  { index[t] = t;
+    if (pthread_create (&thread[t], NULL, phase1, &index[t]) != 0)
+    { fprintf (stderr, "Can't create thread\n");
+      exit(1);
+    }
+  }
+  for (t = 0; t < N_HEAPS; t++)
+  { pthread_join (thread[t], NULL);
+  }
+
+  for (t = 0; t < N_HEAPS; t++)
+  { printf ("Phase 1, heap %d: %u allocations, %d errors\n",
+             t, alloc_count[t], errors[t]);
+  }
+
+  /* Phase 2, with the main thread switching between heaps. */
+
+  for (t = 0; t < N_HEAPS; t++)
+  { sggc_heap_switch (heap[t]);
+    heap_num = t;
+    printf ("\nPhase 2, heap %d\n", t);
+    printf ("Contents before collection: %d errors\n", check (N_ITERS));
+    sggc_collect (2);
+    printf ("Contents after collection: %d errors\n", check (N_ITERS));
+  }
+
+  for (t = 0; t < N_HEAPS; t++)
+  { sggc_heap_switch (heap[t]);
+    heap_num = t;
+    extend (N_ITERS + 1, N_ITERS + N_MORE * (t+1));
+    printf ("\nPhase 2, heap %d extended: %d errors\n",
+             t, check (N_ITERS + N_MORE * (t+1)));
+    printf ("Counts... Gen0: %u, Gen1: %u, Gen2: %u, Segments: %u\n",
+             sggc_info.gen0_count, sggc_info.gen1_count,
+             sggc_info.gen2_count, sggc_info.n_segments);
+    printf ("Allocations: %llu,  GC counts: %u %u %u\n",
+             (unsigned long long) sggc_info.allocations,
+             (unsigned) sggc_info.gc_count[0],
+             (unsigned) sggc_info.gc_count[1],
+             (unsigned) sggc_info.gc_count[2]);
+  }
+
+  /* Phase 3, creating, using, and freeing heaps, checking that this does
+     not increase the memory in use.  Heap 0's roots are used for these
+     heaps, after heap 0 itself is freed.  A heap that is never initialized
+     is also freed each time. */
+
+  prev = sggc_heap_switch (heap[N_HEAPS-1]);
+  sggc_heap_free (heap[0]);
+  heap_num = 0;
+
+  before = in_use;
+  grew = 0;
+
+  for (k = 0; k < N_FREED; k++)
+  { h = sggc_heap_new();
+    prev = sggc_heap_switch (h);
+    if (sggc_init (1000) != 0)
+    { abort();
+    }
+    list[0] = vec[0] = num[0] = SGGC_NO_OBJECT;
+    alloc_count[0] = 0;
+    extend (1, N_MORE);
+    errors[0] += check (N_MORE);
+    sggc_heap_switch (prev);
+    sggc_heap_free (h);
+    sggc_heap_free (sggc_heap_new());
+    if (in_use > before)
+    { grew += 1;
+    }
+  }
+
+  printf ("\nPhase 3, %d heaps created and freed: %d errors, %s\n",
+           N_FREED, errors[0], 
+           grew ? "memory in use grew" : "memory in use did not grow");
+
+  return 0;
+}